@@ -19,7 +19,7 @@ EXE_EXT = '.exe' if os.name == 'nt' else ''
 # For now, we'll keep compiler source in 'src/compiler' and VM source in 'src/vm', with shared stuff in 'src/' directly.
 BIN_NAME = 'coyote' + EXE_EXT
 
-DEFAULT_FLAGS = {'-Wall', '-pedantic','-std=c99'}
+DEFAULT_FLAGS = {'-Wall', '-pedantic','-std=c99', '-pthread'}
 DEBUG_FLAGS = {'-g', '-Og', '-DCOY_DEBUG'}
 # pixelherodev's personal flag set :P I'm insane, I know.
 PIXELS_DEVEL_FLAGS = { '-Werror', '-Wextra', '-Wno-error=unused-parameter', '-Wno-error=missing-field-initializers', '-Wno-error=deprecated-declarations', '-pedantic', '-march=native', '-mtune=native', '-falign-functions=32' }
@@ -131,6 +131,16 @@ with Executable('coyote') as coyote:
     coyote.add_includes('src')
     coyote.add_dependencies('libcoy')
 
+with Executable('gcbench') as gcbench:
+    gcbench.add_sources_glob('programs/gcbench.c')
+    gcbench.add_includes('src')
+    gcbench.add_dependencies('libcoy')
+
+with Executable('loadbench') as loadbench:
+    loadbench.add_sources_glob('programs/loadbench.c')
+    loadbench.add_includes('src')
+    loadbench.add_dependencies('libcoy')
+
 with Executable('test') as test:
     test.add_sources_glob('test/main.c')
     test.add_headers_glob('test/**/*.h', 'test/**/*.inl')
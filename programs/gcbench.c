@@ -0,0 +1,88 @@
+#define _POSIX_C_SOURCE 199309L
+#include "vm/env.h"
+#include "vm/context.h"
+#include "vm/gc.h"
+#include "typeinfo.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <inttypes.h>
+
+// Measures how marking scales with `nmarkers`: builds a large binary tree, and then runs full collections over it.
+
+struct node
+{
+    struct node* left;
+    struct node* right;
+};
+static void node_mark(struct coy_gc_* gc, void* ptr)
+{
+    struct node* node = ptr;
+    coy_gc_mark_(gc, node->left);
+    coy_gc_mark_(gc, node->right);
+}
+static const struct coy_typeinfo_ ti_node = {
+    .category = COY_TYPEINFO_CAT_INTERNAL_,
+    .u={.internal_name = "gcbench_node"},
+    .cb_mark = node_mark,
+};
+static struct node* build_tree(coy_context_t* ctx, uint32_t depth)
+{
+    struct node* node = coy_gc_malloc_(&ctx->gc, sizeof(struct node), &ti_node);
+    node->left = depth ? build_tree(ctx, depth - 1) : NULL;
+    node->right = depth ? build_tree(ctx, depth - 1) : NULL;
+    return node;
+}
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+int main(int argc, char** argv)
+{
+    uint32_t depth = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 22;
+    uint32_t maxmarkers = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : 16;
+    const uint32_t nreps = 5;
+
+    coy_env_t env;
+    if(!coy_env_init(&env))
+        return 1;
+    coy_context_t* ctx = coy_context_create(&env);
+    ctx->gc.threshold = SIZE_MAX;
+    struct node* root = build_tree(ctx, depth);
+    coy_gc_add_root_(&ctx->gc, root);
+
+    printf("%" PRIu32 " objects, best of %" PRIu32 " collections\n", ((uint32_t)2 << depth) - 1u, nreps);
+    double base = 0.0;
+    for(uint32_t nmarkers = 1; nmarkers <= maxmarkers; nmarkers *= 2)
+    {
+        ctx->gc.nmarkers = nmarkers;
+        double best = 0.0;
+        for(uint32_t r = 0; r < nreps; r++)
+        {
+            double start = now_ms();
+            coy_gc_collect_(&ctx->gc);
+            double elapsed = now_ms() - start;
+            if(!r || elapsed < best)
+                best = elapsed;
+        }
+        if(nmarkers == 1)
+            base = best;
+        printf("%2" PRIu32 " markers: %8.2f ms (%.2fx)\n", nmarkers, best, base / best);
+    }
+
+    struct coy_gc_stats stats;
+    if(coy_gc_stats(ctx, &stats))
+    {
+        printf("heap: %zu bytes live (peak %zu) in %zu bytes of pages; %" PRIu32 " collections\n",
+            stats.nbytes_live, stats.nbytes_peak, stats.nbytes_heap, stats.ncollections_minor + stats.ncollections_major);
+        for(size_t t = 0; t < stats.ntypes; t++)
+            printf("  %-16s %10zu objects %12zu bytes\n", stats.types[t].repr, stats.types[t].nobjects, stats.types[t].nbytes);
+        coy_gc_stats_free(&stats);
+    }
+
+    coy_env_deinit(&env);
+    return 0;
+}
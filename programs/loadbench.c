@@ -0,0 +1,113 @@
+#define _POSIX_C_SOURCE 199309L
+#include "vm/env.h"
+#include "vm/function.h"
+#include "vm/register.h"
+#include "util/memio.h"
+#include "bytecode.h"
+
+#include "stb_ds.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+
+// Measures how fast serialized functions load: builds one large function, and then times deserializing it (by copying,
+// and in place), against a word-at-a-time read of the same data.
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+static void build_function(struct coy_function_* func, uint32_t nadds, uint32_t nconsts)
+{
+    coy_function_init_empty_(func, NULL, 0);
+    struct coy_function_block_ block = {0, 2, NULL};
+    stbds_arrput(func->u.coy.blocks, block);
+    stbds_arrsetlen(func->u.coy.consts.data, nconsts);
+    for(uint32_t c = 0; c < nconsts; c++)
+    {
+        memset(&func->u.coy.consts.data[c], 0, sizeof(union coy_register_));
+        func->u.coy.consts.data[c].u64 = c * UINT64_C(0x9E3779B97F4A7C15);
+    }
+    func->u.coy.consts.count = nconsts;
+    for(uint32_t i = 0; i < nadds; i++)
+    {
+        // (alternately adding the previous result to an argument and a constant)
+        union coy_instruction_ op = {.op={COY_OPCODE_ADD, COY_OPFLG_TYPE_UINT32, 0, 2}};
+        union coy_instruction_ lhs = {.arg={1 + i, 0}};
+        union coy_instruction_ rhs = {.arg={i % 2 ? 0 : i % nconsts, i % 2 ? 0 : 1}};
+        stbds_arrput(func->u.coy.instrs, op);
+        stbds_arrput(func->u.coy.instrs, lhs);
+        stbds_arrput(func->u.coy.instrs, rhs);
+    }
+    union coy_instruction_ ret = {.op={COY_OPCODE_RET, 0, 0, 1}};
+    union coy_instruction_ arg = {.arg={1 + nadds, 0}};
+    stbds_arrput(func->u.coy.instrs, ret);
+    stbds_arrput(func->u.coy.instrs, arg);
+    func->u.coy.ninstrs = stbds_arrlenu(func->u.coy.instrs);
+    coy_function_coy_compute_maxslots_(func);
+}
+int main(int argc, char** argv)
+{
+    uint32_t nadds = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 1u << 20;
+    uint32_t nconsts = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : 1u << 16;
+    const uint32_t nreps = 10;
+    if(!nconsts)
+        nconsts = 1;
+
+    coy_env_t env;
+    if(!coy_env_init(&env))
+        return 1;
+    struct coy_function_ func;
+    build_function(&func, nadds, nconsts);
+    uint8_t* data = NULL;
+    if(!coy_function_write_data_(&func, &data))
+        return 1;
+    size_t len = stbds_arrlenu(data);
+    coy_function_deinit_(&func);
+    // (kept aside, since loading in place writes into the data)
+    uint8_t* scratch = NULL;
+    stbds_arrsetlen(scratch, len);
+
+    printf("%" PRIu32 " instructions, %" PRIu32 " constants: %.2f MiB; best of %" PRIu32 " loads\n",
+        3 * nadds + 2, nconsts, len / (1024.0 * 1024.0), nreps);
+    const char* names[3] = {"word reads", "copy", "in place"};
+    double best[3] = {0.0, 0.0, 0.0};
+    for(uint32_t r = 0; r < nreps; r++)
+    {
+        for(int m = 0; m < 3; m++)
+        {
+            memcpy(scratch, data, len);
+            double start = now_ms();
+            if(m == 0)
+            {
+                // (roughly what loading did before bulk reads)
+                struct coy_memio_ memio = {.data = scratch, .pos = 0, .len = len, .ok = true};
+                volatile uint32_t sink = 0;
+                while(memio.pos + sizeof(uint32_t) <= len)
+                    sink ^= coy_memio_read32le_(&memio);
+                (void)sink;
+            }
+            else if(!(m == 1 ? coy_function_init_data_(&func, &env, NULL, 0, scratch, len) : coy_function_init_mapped_(&func, &env, NULL, 0, scratch, len)))
+            {
+                fprintf(stderr, "failed to load the function\n");
+                return 1;
+            }
+            double elapsed = now_ms() - start;
+            if(m != 0)
+                coy_function_deinit_(&func);
+            if(!r || elapsed < best[m])
+                best[m] = elapsed;
+        }
+    }
+    for(int m = 0; m < 3; m++)
+        printf("%-10s %8.3f ms (%8.1f MiB/s)\n", names[m], best[m], len / (1024.0 * 1024.0) / (best[m] / 1e3));
+
+    stbds_arrfree(scratch);
+    stbds_arrfree(data);
+    coy_env_deinit(&env);
+    return 0;
+}
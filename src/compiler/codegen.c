@@ -43,12 +43,14 @@ static int64_t expr_value_reg(coyc_cctx_t *ctx, struct coy_function_builder_ *bu
         for (size_t i = 0; i < arg_count; i += 1) {
             regs[i] = expr_value_reg(ctx, builder, value.call.arguments[i]);
         }
-        size_t size = snprintf(NULL, 0, "%s;%s", ctx->module->name, value.call.name);
+        size_t size = snprintf(NULL, 0, "%s;%s", ctx->module->name->str, value.call.name);
         char *buf = malloc(size + 1);
-        sprintf(buf, "%s;%s", ctx->module->name, value.call.name);
+        sprintf(buf, "%s;%s", ctx->module->name->str, value.call.name);
         printf("Generating call to '%s'\n", buf);
         uint32_t reg = coy_function_builder_op_(builder, COY_OPCODE_CALL, 0, false);
+        // (the symbol gets interned, so we can free our copy)
         coy_function_builder_arg_const_sym_(builder, buf);
+        free(buf);
         for (size_t i = 0; i < arg_count; i += 1) {
             if (regs[i] == -1) {
                 uint32_t v;
@@ -208,7 +210,7 @@ static void coyc_gen_func(coyc_cctx_t *ctx, function_t func) {
     ctx->func = &func;
     
     struct coy_function_builder_ builder;
-    coy_function_builder_init_(&builder, &func.type, 0);
+    coy_function_builder_init_(&builder, ctx->env, &func.type, 0);
     for (size_t i = 0; i < arrlenu(func.blocks); i += 1) {
         printf("Codegenning block %lu\n", i);
         ctx->block = &func.blocks[i];
@@ -1,6 +1,6 @@
 #include "function_builder.h"
 #include "vm/register.h"
-#include "util/string.h"
+#include "vm/env.h"
 #include "util/debug.h"
 
 #include "stb_ds.h"
@@ -13,7 +13,7 @@ struct coy_function_builder_instr_ref_
 };
 struct coy_function_builder_const_sym_entry_
 {
-    char* key;
+    const struct coy_istring_* key;
     struct coy_function_builder_instr_ref_* value;
 };
 struct coy_function_builder_const_reg_entry_
@@ -22,13 +22,14 @@ struct coy_function_builder_const_reg_entry_
     struct coy_function_builder_instr_ref_* value;
 };
 
-struct coy_function_builder_* coy_function_builder_init_(struct coy_function_builder_* builder, const struct coy_typeinfo_* type, uint32_t attrib)
+struct coy_function_builder_* coy_function_builder_init_(struct coy_function_builder_* builder, struct coy_env* env, const struct coy_typeinfo_* type, uint32_t attrib)
 {
     if(!builder) return NULL;
     if(!coy_function_init_empty_(&builder->func, type, attrib)) return NULL;
     if(!COY_ENSURE(!(attrib & COY_FUNCTION_ATTRIB_NATIVE_), "misuse: cannot create a Coyote function builder with a `native` attribute"))
         return NULL;
-    stbds_sh_new_arena(builder->consts.syms);
+    builder->env = env;
+    builder->consts.syms = NULL;
     builder->consts.refs = NULL;
     builder->consts.vals = NULL;
     builder->blocks = NULL;
@@ -62,16 +63,17 @@ void coy_function_builder_finish_(struct coy_function_builder_* builder, struct
 {
     // copy consts over
     struct coy_function_constants_* fconsts = &builder->func.u.coy.consts;
-    size_t nsyms = stbds_shlenu(builder->consts.syms);
+    size_t nsyms = stbds_hmlenu(builder->consts.syms);
     size_t nrefs = stbds_hmlenu(builder->consts.refs);
     size_t nvals = stbds_hmlenu(builder->consts.vals);
     fconsts->nsymbols = nsyms;
     fconsts->nrefs = nrefs;
+    fconsts->count = nsyms + nrefs + nvals;
     stbds_arrsetlen(fconsts->data, nsyms + nrefs + nvals);
     for(size_t s = 0; s < nsyms; s++)
     {
         struct coy_function_builder_const_sym_entry_* entry = &builder->consts.syms[s];
-        fconsts->data[s].ptr = coy_strdup_(entry->key, -1);
+        fconsts->data[s].ptr = (void*)entry->key;
         coy_function_builder_patch_constrefs_(builder, entry->value, s);
     }
     for(size_t r = nsyms; r < nsyms + nrefs; r++)
@@ -92,6 +94,7 @@ void coy_function_builder_finish_(struct coy_function_builder_* builder, struct
         ninstrs += stbds_arrlenu(builder->blocks[b].instrs);
     // copy instructions over
     stbds_arrsetlen(builder->func.u.coy.instrs, ninstrs);
+    builder->func.u.coy.ninstrs = ninstrs;
     ninstrs = 0;
     for(size_t b = 0; b < stbds_arrlenu(builder->blocks); b++)
     {
@@ -108,7 +111,7 @@ void coy_function_builder_finish_(struct coy_function_builder_* builder, struct
     // return `func` (via parameter)
     *func = builder->func;
     // free own data
-    stbds_shfree(builder->consts.syms);
+    stbds_hmfree(builder->consts.syms);
     stbds_hmfree(builder->consts.refs);
     stbds_hmfree(builder->consts.vals);
     stbds_arrfree(builder->blocks);
@@ -210,10 +213,11 @@ void coy_function_builder_arg_const_(struct coy_function_builder_* builder, unio
 void coy_function_builder_arg_const_sym_(struct coy_function_builder_* builder, const char* sym)
 {
     struct coy_function_builder_block_* bblock = coy_function_builder_curbblock_(builder);
+    const struct coy_istring_* isym = coy_env_intern_(builder->env, sym);
 #if 0   // stb_ds bug
-    struct coy_function_builder_const_sym_entry_* entry = stbds_shgetp_null(builder->consts.syms, sym);
+    struct coy_function_builder_const_sym_entry_* entry = stbds_hmgetp_null(builder->consts.syms, isym);
 #else
-    ptrdiff_t entryidx = stbds_shgeti(builder->consts.syms, sym);
+    ptrdiff_t entryidx = stbds_hmgeti(builder->consts.syms, isym);
     struct coy_function_builder_const_sym_entry_* entry = entryidx >= 0 ? &builder->consts.syms[entryidx] : NULL;
 #endif
     struct coy_function_builder_instr_ref_ constref = {
@@ -224,9 +228,9 @@ void coy_function_builder_arg_const_sym_(struct coy_function_builder_* builder,
         stbds_arrput(entry->value, constref);
     else
     {
-        struct coy_function_builder_const_sym_entry_ nentry = {(char*)sym, NULL};
+        struct coy_function_builder_const_sym_entry_ nentry = {isym, NULL};
         stbds_arrput(nentry.value, constref);
-        stbds_shputs(builder->consts.syms, nentry);
+        stbds_hmputs(builder->consts.syms, nentry);
     }
     // add a use pointer
     ++coy_function_builder_curinstr_(builder)->op.nargs;
@@ -7,6 +7,7 @@
 #define COY_FUNCTION_BUILDER_CONST_TYPE_REF_    1
 #define COY_FUNCTION_BUILDER_CONST_TYPE_VAL_    2
 
+struct coy_env;
 struct coy_function_builder_const_sym_entry_;
 struct coy_function_builder_const_reg_entry_;
 
@@ -17,6 +18,7 @@ struct coy_function_builder_block_
 };
 struct coy_function_builder_
 {
+    struct coy_env* env;    //< (symbols are interned in its string pool)
     struct coy_function_ func;
     struct
     {
@@ -27,7 +29,7 @@ struct coy_function_builder_
     struct coy_function_builder_block_* blocks;
     uint32_t curblock;  //< current "active" block
 };
-struct coy_function_builder_* coy_function_builder_init_(struct coy_function_builder_* builder, const struct coy_typeinfo_* type, uint32_t attrib);
+struct coy_function_builder_* coy_function_builder_init_(struct coy_function_builder_* builder, struct coy_env* env, const struct coy_typeinfo_* type, uint32_t attrib);
 void coy_function_builder_finish_(struct coy_function_builder_* builder, struct coy_function_* func);
 void coy_function_builder_abort_(struct coy_function_builder_* builder);
 
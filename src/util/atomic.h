@@ -0,0 +1,26 @@
+#ifndef COY_UTIL_ATOMIC_H_
+#define COY_UTIL_ATOMIC_H_
+
+#include <stdbool.h>
+
+/*
+Atomic accesses to data that the contexts of an env share (and may run on separate threads); for word-sized values only.
+Without compiler support, these fall back to plain accesses, so the contexts of an env must then stay on one thread.
+*/
+#ifdef __GNUC__
+#define COY_ATOMIC_LOAD_RELAXED(PTR)        __atomic_load_n((PTR), __ATOMIC_RELAXED)
+#define COY_ATOMIC_LOAD_ACQUIRE(PTR)        __atomic_load_n((PTR), __ATOMIC_ACQUIRE)
+#define COY_ATOMIC_STORE_RELEASE(PTR, VAL)  __atomic_store_n((PTR), (VAL), __ATOMIC_RELEASE)
+// adds `VAL`, and returns the new value; for counters that do not order other accesses
+#define COY_ATOMIC_ADD_RELAXED(PTR, VAL)    __atomic_add_fetch((PTR), (VAL), __ATOMIC_RELAXED)
+// replaces `*PTR` by `DESIRED` if it equals `*EXPECTED` (returning true), or else stores it into `*EXPECTED`
+#define COY_ATOMIC_CAS(PTR, EXPECTED, DESIRED)  __atomic_compare_exchange_n((PTR), (EXPECTED), (DESIRED), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#else
+#define COY_ATOMIC_LOAD_RELAXED(PTR)        (*(PTR))
+#define COY_ATOMIC_LOAD_ACQUIRE(PTR)        (*(PTR))
+#define COY_ATOMIC_STORE_RELEASE(PTR, VAL)  ((void)(*(PTR) = (VAL)))
+#define COY_ATOMIC_ADD_RELAXED(PTR, VAL)    (*(PTR) += (VAL))
+#define COY_ATOMIC_CAS(PTR, EXPECTED, DESIRED)  (*(PTR) == *(EXPECTED) ? (*(PTR) = (DESIRED), true) : (*(EXPECTED) = *(PTR), false))
+#endif
+
+#endif /* COY_UTIL_ATOMIC_H_ */
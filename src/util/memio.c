@@ -0,0 +1,155 @@
+#include "memio.h"
+#include "debug.h"
+
+#include "stb_ds.h"
+#include <string.h>
+
+// can little-endian data be copied as-is? (if we do not know, the bytes are always reassembled, which is correct either way)
+#if defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define COY_MEMIO_LITTLE_ENDIAN_    1
+#else
+#define COY_MEMIO_LITTLE_ENDIAN_    0
+#endif
+
+size_t coy_memio_read_at_(struct coy_memio_* memio, size_t pos, void* buf, size_t len)
+{
+    if(pos > memio->len || len > memio->len - pos)
+    {
+        memio->ok = false;
+        len = pos < memio->len ? memio->len - pos : 0;
+    }
+    memcpy(buf, &memio->data[pos], len);
+    return len;
+}
+size_t coy_memio_read_(struct coy_memio_* memio, void* buf, size_t len)
+{
+    size_t r = coy_memio_read_at_(memio, memio->pos, buf, len);
+    memio->pos += len;
+    return r;
+}
+uint32_t coy_memio_read32le_at_(struct coy_memio_* memio, size_t pos)
+{
+    uint32_t v;
+    COY_CHECK(!(pos & (sizeof(v) - 1))); // check alignment
+    if(pos > memio->len || sizeof(v) > memio->len - pos)
+    {
+        memio->ok = false;
+        return 0;
+    }
+    v = 0;
+    for(size_t i = 1; i <= sizeof(v); i++)
+        v = (v << 8) | (uint32_t)memio->data[pos+sizeof(v)-i];
+    return v;
+}
+uint32_t coy_memio_read32le_(struct coy_memio_* memio)
+{
+    uint32_t v = coy_memio_read32le_at_(memio, memio->pos);
+    memio->pos += sizeof(v);
+    return v;
+}
+uint64_t coy_memio_read64le_at_(struct coy_memio_* memio, size_t pos)
+{
+    uint64_t v;
+    COY_CHECK(!(pos & (sizeof(v) - 1))); // check alignment
+    if(pos > memio->len || sizeof(v) > memio->len - pos)
+    {
+        memio->ok = false;
+        return 0;
+    }
+    v = 0;
+    for(size_t i = 1; i <= sizeof(v); i++)
+        v = (v << 8) | (uint32_t)memio->data[pos+sizeof(v)-i];
+    return v;
+}
+uint64_t coy_memio_read64le_(struct coy_memio_* memio)
+{
+    uint64_t v = coy_memio_read64le_at_(memio, memio->pos);
+    memio->pos += sizeof(v);
+    return v;
+}
+
+static bool coy_memio_read_array_at_(struct coy_memio_* memio, size_t pos, void* buf, size_t count, size_t size)
+{
+    COY_CHECK(!(pos & (size - 1))); // check alignment
+    if(pos > memio->len || count > (memio->len - pos) / size)
+    {
+        memio->ok = false;
+        if(count)
+            memset(buf, 0, count * size);
+        return false;
+    }
+    if(count)
+        memcpy(buf, &memio->data[pos], count * size);
+    return true;
+}
+bool coy_memio_read32le_array_at_(struct coy_memio_* memio, size_t pos, uint32_t* buf, size_t count)
+{
+    if(!coy_memio_read_array_at_(memio, pos, buf, count, sizeof(*buf)))
+        return false;
+    if(!COY_MEMIO_LITTLE_ENDIAN_)
+        for(size_t c = 0; c < count; c++)
+        {
+            const uint8_t* bytes = (const uint8_t*)&buf[c];
+            buf[c] = (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+        }
+    return true;
+}
+bool coy_memio_read32le_array_(struct coy_memio_* memio, uint32_t* buf, size_t count)
+{
+    bool ok = coy_memio_read32le_array_at_(memio, memio->pos, buf, count);
+    memio->pos += count * sizeof(*buf);
+    return ok;
+}
+bool coy_memio_read64le_array_at_(struct coy_memio_* memio, size_t pos, uint64_t* buf, size_t count)
+{
+    if(!coy_memio_read_array_at_(memio, pos, buf, count, sizeof(*buf)))
+        return false;
+    if(!COY_MEMIO_LITTLE_ENDIAN_)
+        for(size_t c = 0; c < count; c++)
+        {
+            const uint8_t* bytes = (const uint8_t*)&buf[c];
+            uint64_t v = 0;
+            for(size_t i = 1; i <= sizeof(v); i++)
+                v = (v << 8) | bytes[sizeof(v)-i];
+            buf[c] = v;
+        }
+    return true;
+}
+bool coy_memio_read64le_array_(struct coy_memio_* memio, uint64_t* buf, size_t count)
+{
+    bool ok = coy_memio_read64le_array_at_(memio, memio->pos, buf, count);
+    memio->pos += count * sizeof(*buf);
+    return ok;
+}
+
+void coy_memio_write_(uint8_t** buf, const void* data, size_t len)
+{
+    size_t pos = stbds_arrlenu(*buf);
+    stbds_arrsetlen(*buf, pos + len);
+    if(len)
+        memcpy(*buf + pos, data, len);
+}
+void coy_memio_write32le_(uint8_t** buf, uint32_t v)
+{
+    uint8_t bytes[sizeof(v)];
+    for(size_t i = 0; i < sizeof(v); i++)
+        bytes[i] = (uint8_t)(v >> (i * 8));
+    coy_memio_write_(buf, bytes, sizeof(bytes));
+}
+void coy_memio_write64le_(uint8_t** buf, uint64_t v)
+{
+    uint8_t bytes[sizeof(v)];
+    for(size_t i = 0; i < sizeof(v); i++)
+        bytes[i] = (uint8_t)(v >> (i * 8));
+    coy_memio_write_(buf, bytes, sizeof(bytes));
+}
+void coy_memio_patch32le_(uint8_t* buf, size_t pos, uint32_t v)
+{
+    for(size_t i = 0; i < sizeof(v); i++)
+        buf[pos + i] = (uint8_t)(v >> (i * 8));
+}
+void coy_memio_align_(uint8_t** buf, size_t align)
+{
+    while(stbds_arrlenu(*buf) % align)
+        stbds_arrput(*buf, 0);
+}
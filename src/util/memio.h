@@ -0,0 +1,41 @@
+#ifndef COY_UTIL_MEMIO_H_
+#define COY_UTIL_MEMIO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+Bounds-checked reading of little-endian data from a memory buffer (used for serialized functions & module images).
+Reads past the end set `ok` to false (and read zeroes), so that a sequence of reads only needs to be checked once.
+*/
+struct coy_memio_
+{
+    const uint8_t* data;
+    size_t pos;
+    size_t len;
+    bool ok;
+};
+size_t coy_memio_read_at_(struct coy_memio_* memio, size_t pos, void* buf, size_t len);
+size_t coy_memio_read_(struct coy_memio_* memio, void* buf, size_t len);
+uint32_t coy_memio_read32le_at_(struct coy_memio_* memio, size_t pos);
+uint32_t coy_memio_read32le_(struct coy_memio_* memio);
+uint64_t coy_memio_read64le_at_(struct coy_memio_* memio, size_t pos);
+uint64_t coy_memio_read64le_(struct coy_memio_* memio);
+// bulk versions of the above: the whole range is checked once, and then copied as-is (byte-swapped, on big-endian hosts);
+// on failure, `buf` is zeroed and false is returned
+bool coy_memio_read32le_array_at_(struct coy_memio_* memio, size_t pos, uint32_t* buf, size_t count);
+bool coy_memio_read32le_array_(struct coy_memio_* memio, uint32_t* buf, size_t count);
+bool coy_memio_read64le_array_at_(struct coy_memio_* memio, size_t pos, uint64_t* buf, size_t count);
+bool coy_memio_read64le_array_(struct coy_memio_* memio, uint64_t* buf, size_t count);
+
+// the writers append to an `stb_ds` array of bytes
+void coy_memio_write_(uint8_t** buf, const void* data, size_t len);
+void coy_memio_write32le_(uint8_t** buf, uint32_t v);
+void coy_memio_write64le_(uint8_t** buf, uint64_t v);
+// overwrites 4 bytes at `pos` (for offsets that are only known once the data they point to has been written)
+void coy_memio_patch32le_(uint8_t* buf, size_t pos, uint32_t v);
+// pads `buf` with zeroes to a multiple of `align` bytes
+void coy_memio_align_(uint8_t** buf, size_t align);
+
+#endif /* COY_UTIL_MEMIO_H_ */
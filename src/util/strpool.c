@@ -0,0 +1,115 @@
+#include "strpool.h"
+#include "debug.h"
+
+#include "stb_ds.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define COY_STRPOOL_CHUNK_SIZE_     16384u
+#define COY_STRPOOL_MIN_CAPACITY_   64u
+
+struct coy_strpool_* coy_strpool_init_(struct coy_strpool_* pool)
+{
+    if(!pool) return NULL;
+    pool->table = NULL;
+    pool->capacity = 0;
+    pool->count = 0;
+    pool->chunks = NULL;
+    pool->chunkpos = 0;
+    pool->chunklen = 0;
+    pool->nbytes = 0;
+    return pool;
+}
+void coy_strpool_deinit_(struct coy_strpool_* pool)
+{
+    if(!pool) return;
+    for(size_t c = 0; c < stbds_arrlenu(pool->chunks); c++)
+        free(pool->chunks[c]);
+    stbds_arrfree(pool->chunks);
+    free(pool->table);
+    coy_strpool_init_(pool);
+}
+
+// FNV-1a
+uint32_t coy_strpool_hash_(const char* str, size_t len)
+{
+    uint32_t hash = UINT32_C(2166136261);
+    for(size_t i = 0; i < len; i++)
+        hash = (hash ^ (uint8_t)str[i]) * UINT32_C(16777619);
+    return hash;
+}
+// returns the slot of `str`, or of the empty slot where it would go
+static size_t coy_strpool_probe_(const struct coy_strpool_* pool, const char* str, size_t len, uint32_t hash)
+{
+    size_t mask = pool->capacity - 1u;
+    for(size_t i = hash & mask;; i = (i + 1) & mask)
+    {
+        const struct coy_istring_* istr = pool->table[i];
+        if(!istr || (istr->hash == hash && istr->len == len && !memcmp(istr->str, str, len)))
+            return i;
+    }
+}
+static void coy_strpool_grow_(struct coy_strpool_* pool)
+{
+    size_t ocapacity = pool->capacity;
+    const struct coy_istring_** otable = pool->table;
+    pool->capacity = ocapacity ? ocapacity * 2 : COY_STRPOOL_MIN_CAPACITY_;
+    pool->table = calloc(pool->capacity, sizeof(*pool->table));
+    COY_CHECK(pool->table);
+    size_t mask = pool->capacity - 1u;
+    // (hashes are precomputed, and the strings are all distinct, so this need not compare anything)
+    for(size_t o = 0; o < ocapacity; o++)
+    {
+        const struct coy_istring_* istr = otable[o];
+        if(!istr) continue;
+        size_t i = istr->hash & mask;
+        while(pool->table[i])
+            i = (i + 1) & mask;
+        pool->table[i] = istr;
+    }
+    free(otable);
+}
+static struct coy_istring_* coy_strpool_alloc_(struct coy_strpool_* pool, size_t size)
+{
+    size = (size + (sizeof(uint32_t) - 1u)) & ~(size_t)(sizeof(uint32_t) - 1u);
+    if(pool->chunkpos + size > pool->chunklen)
+    {
+        // (large strings get a chunk of their own, which then gets filled up by subsequent strings as usual)
+        size_t chunklen = size > COY_STRPOOL_CHUNK_SIZE_ ? size : COY_STRPOOL_CHUNK_SIZE_;
+        uint8_t* chunk = malloc(chunklen);
+        COY_CHECK(chunk);
+        stbds_arrput(pool->chunks, chunk);
+        pool->chunkpos = 0;
+        pool->chunklen = chunklen;
+    }
+    struct coy_istring_* istr = (struct coy_istring_*)&pool->chunks[stbds_arrlenu(pool->chunks) - 1u][pool->chunkpos];
+    pool->chunkpos += size;
+    return istr;
+}
+const struct coy_istring_* coy_strpool_intern_(struct coy_strpool_* pool, const char* str, size_t len)
+{
+    if(!COY_ENSURE(len < UINT32_MAX, "misuse: string is too long to intern"))
+        return NULL;
+    // (kept at most 3/4 full)
+    if(4 * (pool->count + 1) > 3 * pool->capacity)
+        coy_strpool_grow_(pool);
+    uint32_t hash = coy_strpool_hash_(str, len);
+    size_t slot = coy_strpool_probe_(pool, str, len, hash);
+    if(pool->table[slot])
+        return pool->table[slot];
+    struct coy_istring_* istr = coy_strpool_alloc_(pool, sizeof(struct coy_istring_) + len + 1u);
+    istr->hash = hash;
+    istr->len = len;
+    memcpy(istr->str, str, len);
+    istr->str[len] = 0;
+    pool->table[slot] = istr;
+    pool->count++;
+    pool->nbytes += len + 1u;
+    return istr;
+}
+const struct coy_istring_* coy_strpool_find_(const struct coy_strpool_* pool, const char* str, size_t len)
+{
+    if(!pool->count)
+        return NULL;
+    return pool->table[coy_strpool_probe_(pool, str, len, coy_strpool_hash_(str, len))];
+}
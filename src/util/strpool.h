@@ -0,0 +1,37 @@
+#ifndef COY_UTIL_STRPOOL_H_
+#define COY_UTIL_STRPOOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+A pool of interned strings: interning the same contents twice gives the same handle, so interned strings can be compared
+(and used as hashmap keys) by pointer. Handles are stable until the pool is deinitialized.
+*/
+struct coy_istring_
+{
+    uint32_t hash;  //< precomputed `coy_strpool_hash_` of `str`
+    uint32_t len;
+    char str[];     //< (NUL-terminated)
+};
+struct coy_strpool_
+{
+    const struct coy_istring_** table;  //< open-addressed, with a power-of-two capacity
+    size_t capacity;
+    size_t count;
+    uint8_t** chunks;   //< storage for the strings themselves (an `stb_ds` array of chunks, which are never moved)
+    size_t chunkpos;    //< used bytes in the last chunk
+    size_t chunklen;    //< size of the last chunk
+    size_t nbytes;      //< total size of all interned strings (for statistics)
+};
+struct coy_strpool_* coy_strpool_init_(struct coy_strpool_* pool);
+void coy_strpool_deinit_(struct coy_strpool_* pool);
+
+uint32_t coy_strpool_hash_(const char* str, size_t len);
+// returns the handle for `str`, adding it to the pool if necessary
+const struct coy_istring_* coy_strpool_intern_(struct coy_strpool_* pool, const char* str, size_t len);
+// returns the handle for `str`, or NULL if it was never interned (so nothing can be keyed by it either)
+const struct coy_istring_* coy_strpool_find_(const struct coy_strpool_* pool, const char* str, size_t len);
+
+#endif /* COY_UTIL_STRPOOL_H_ */
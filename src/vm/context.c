@@ -2,6 +2,7 @@
 #include "env.h"
 #include "stack.h"
 #include "function.h"
+#include "decode.h"
 #include "register.h"
 #include "vm.h"
 #include "../util/debug.h"
@@ -9,23 +10,39 @@
 #include "stb_ds.h"
 #include <string.h>
 
+// the stack segments (which mark their own registers, and their parents), spare segments, and the native slots
+static void coy_context_gc_roots_(struct coy_gc_* gc, void* udata)
+{
+    coy_context_t* ctx = udata;
+    coy_gc_mark_dirty_(gc, ctx->top);   //< (stack segments are written to without a barrier)
+    for(size_t i = 0; i < stbds_arrlenu(ctx->spare_segments); i++)
+        coy_gc_mark_(gc, ctx->spare_segments[i]);
+    coy_slots_gc_mark_(&ctx->slots, gc, coy_slots_getlen_(&ctx->slots));
+}
+
 coy_context_t* coy_context_create(struct coy_env* env)
 {
     coy_context_t* ctx = malloc(sizeof(coy_context_t));
     ctx->env = env;
     coy_gc_init_(&ctx->gc);
+    ctx->gc.cb_roots = coy_context_gc_roots_;
+    ctx->gc.udata = ctx;
     ctx->index = stbds_arrlenu(env->contexts.ptr);
     ctx->id = env->contexts.next_id++;
     ctx->top = NULL;
+    ctx->spare_segments = NULL;
+    coy_slots_init_(&ctx->slots, 0);    //< (before allocating anything, since the slots are GC roots)
+    coy_trace_init_(&ctx->trace);
     ctx->top = coy_stack_segment_create_(ctx);
-    coy_slots_init_(&ctx->slots, 0);
     return stbds_arrput(env->contexts.ptr, ctx);
 }
 void coy_context_destroy(coy_context_t* ctx)
 {
     if(!ctx) return;
     coy_gc_deinit_(&ctx->gc);
+    stbds_arrfree(ctx->spare_segments);
     coy_slots_deinit_(&ctx->slots);
+    coy_trace_deinit_(&ctx->trace);
     uint32_t index = ctx->index;
     stbds_arrdelswap(ctx->env->contexts.ptr, index);
     if(stbds_arrlenu(ctx->env->contexts.ptr))
@@ -36,25 +53,27 @@ void coy_context_push_frame_(coy_context_t* ctx, struct coy_function_* function,
 {
     if(!ctx->top || segmented)
         ctx->top = coy_stack_segment_create_(ctx);
+    COY_ASSERT_MSG(!(function->attrib & COY_FUNCTION_ATTRIB_STUB_), "misuse: stubs must be resolved before they are called");
     struct coy_stack_segment_* seg = ctx->top;
+    coy_function_get_dcode_(function);
 
     struct coy_stack_frame_ frame;
     uint32_t nframes = stbds_arrlenu(seg->frames);
     if(nframes && !segmented)
     {
+        // the new frame starts at the destination register of the parent's current instruction
         const struct coy_stack_frame_* pframe = &seg->frames[nframes-1u];
-        frame.fp = pframe->bp + (pframe->pc - pframe->function->u.coy.blocks[pframe->block].offset);
+        frame.fp = pframe->fp + pframe->function->u.coy.dcode->instrs[pframe->pc].dst;
     }
     else
         frame.fp = 0;
 
-    frame.bp = frame.fp + function->u.coy.blocks[0].nparams;
     frame.block = 0;
     frame.return_native = return_native;
     frame.pc = 0;
     frame.function = function;
     stbds_arrput(seg->frames, frame);
-    coy_slots_setlen_(&seg->slots, frame.fp + function->u.coy.maxslots);
+    coy_regs_reserve_(&seg->regs, frame.fp + function->u.coy.maxslots);
 }
 void coy_context_pop_frame_(coy_context_t* ctx)
 {
@@ -63,17 +82,12 @@ void coy_context_pop_frame_(coy_context_t* ctx)
     size_t nframes = stbds_arrlenu(seg->frames);
     COY_CHECK(nframes);
     stbds_arrsetlen(seg->frames, nframes - 1);
-    if(nframes == 1 && seg->parent)    // if we had 1 frame earlier, then the entire stack segment can be destroyed
-        ctx->top = seg->parent;
-    // update slots back to old value
-    nframes = stbds_arrlenu(ctx->top->frames);
-    if(nframes)
+    if(nframes == 1 && seg->parent)    // if we had 1 frame earlier, then the entire stack segment can be reused
     {
-        struct coy_stack_frame_* frame = &ctx->top->frames[nframes-1];
-        struct coy_function_* function = frame->function;
-        if(!(function->attrib & COY_FUNCTION_ATTRIB_NATIVE_))
-            coy_slots_setlen_(&seg->slots, frame->fp + function->u.coy.maxslots);
+        ctx->top = seg->parent;
+        coy_stack_segment_retire_(ctx, seg);
     }
+    // (registers are left as-is; the parent's are still reserved, and the rest are reused by the next push)
 }
 
 uint32_t coy_num_slots(coy_context_t* ctx)
@@ -127,34 +141,20 @@ void coy_set_uint_vector(coy_context_t* ctx, int32_t index, const uint32_t* vect
 
 bool coy_call(coy_context_t* ctx, const char* module_name, const char* function_name)
 {
-#if 0
-    // ... this is apparently buggy?!
-    struct coy_module_entry_* mentry = stbds_shgetp_null(ctx->env->modules, module_name);
-#else
-    ptrdiff_t mentryidx = stbds_shgeti(ctx->env->modules, module_name);
-    struct coy_module_entry_* mentry = mentryidx >= 0 ? &ctx->env->modules[mentryidx] : NULL;
-#endif
-    if(!mentry) //< error: module not found
+    struct coy_module_* module = coy_env_find_module_(ctx->env, module_name);
+    if(!module) //< error: module not found
         return false;
-    COY_ASSERT(mentry->key);
-    struct coy_module_* module = mentry->value;
-    COY_ASSERT(module);
-#if 0
-    struct coy_module_symbol_entry_* sentry = stbds_shgetp_null(module->symbols, function_name);
-#else
-    ptrdiff_t sentryidx = stbds_shgeti(module->symbols, function_name);
-    struct coy_module_symbol_entry_* sentry = sentryidx >= 0 ? &module->symbols[sentryidx] : NULL;
-#endif
-    if(!sentry || sentry->value.category != COY_MODULE_SYMCAT_FUNCTION_)    //< error: symbol not found, or symbol is not a function
+    struct coy_module_symbol_* sym = coy_module_find_symbol_(module, function_name);
+    if(!sym || sym->category != COY_MODULE_SYMCAT_FUNCTION_)    //< error: symbol not found, or symbol is not a function
         return false;
     struct coy_function_* func;
-    if(stbds_arrlenu(sentry->value.u.functions) > 1)
+    if(stbds_arrlenu(sym->u.functions) > 1)
     {
         COY_TODO("overloaded function resolution");
         return false;   //< unreachable, but to avoid a maybe-uninitialized warning
     }
     else
-        func = sentry->value.u.functions[0];
+        func = sym->u.functions[0];
     coy_vm_call_(ctx, func, false);
     return true;
 }
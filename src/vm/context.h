@@ -3,6 +3,7 @@
 
 #include "gc.h"
 #include "slots.h"
+#include "trace.h"
 
 #include <stdbool.h>
 
@@ -20,7 +21,9 @@ typedef struct coy_context
     uint32_t index;                 //< thread index in thread list; not unique
     uint32_t id;                    //< thread ID; unique for a particular execution
     struct coy_stack_segment_* top; //< top (current) stack segment
+    struct coy_stack_segment_** spare_segments; //< retired stack segments, for reuse (see `coy_stack_segment_retire_`)
     struct coy_slots_ slots;        //< slots for native<->Coyote calls, and as a scratch buffer
+    struct coy_trace_ trace;        //< execution trace (see trace.h)
 } coy_context_t;
 
 coy_context_t* coy_context_create(struct coy_env* env);
@@ -0,0 +1,308 @@
+#include "decode.h"
+#include "function.h"
+#include "register.h"
+#include "jit.h"
+
+#include "../bytecode.h"
+#include "../util/atomic.h"
+#include "../util/debug.h"
+
+#include "stb_ds.h"
+#include <stdlib.h>
+
+// `block` is the block that the operand is in (its `ptrs` tell us which registers hold pointers)
+static bool coy_function_decode_operand_(struct coy_function_* func, const struct coy_function_block_* block, union coy_instruction_ arg, struct coy_doperand_* op)
+{
+    op->cptr = NULL;
+    op->index = 0;
+    op->isptr = false;
+    if(arg.arg.isconst)
+    {
+        if(arg.arg.index >= func->u.coy.consts.count)
+            return false;
+        op->cptr = &func->u.coy.consts.data[arg.arg.index];
+        op->isptr = arg.arg.index < func->u.coy.consts.nsymbols + func->u.coy.consts.nrefs;
+    }
+    else
+    {
+        op->index = arg.arg.index;
+        op->isptr = coy_function_block_isptr_(block, arg.arg.index);
+    }
+    return true;
+}
+static bool coy_function_decode_operands_(struct coy_function_* func, const struct coy_function_block_* block, struct coy_dcode_* dcode, const union coy_instruction_* args, uint32_t nargs)
+{
+    for(uint32_t a = 0; a < nargs; a++)
+    {
+        struct coy_doperand_* op = stbds_arraddnptr(dcode->operands, 1);
+        if(!coy_function_decode_operand_(func, block, args[a], op))
+            return false;
+    }
+    return true;
+}
+// does any pending move (other than `except`) still need to read register `index`?
+static bool coy_function_decode_is_read_(const struct coy_dmove_* pending, size_t except, uint32_t index)
+{
+    for(size_t p = 0; p < stbds_arrlenu(pending); p++)
+        if(p != except && pending[p].kind == COY_DMOVE_COPY_ && !pending[p].src.cptr && pending[p].src.index == index)
+            return true;
+    return false;
+}
+// appends a parallel move of `args` into registers `0..nargs-1` to `dcode->moves`
+static bool coy_function_decode_moves_(struct coy_function_* func, const struct coy_function_block_* block, struct coy_dcode_* dcode, const union coy_instruction_* args, uint32_t nargs)
+{
+    struct coy_dmove_* pending = NULL;
+    for(uint32_t a = 0; a < nargs; a++)
+    {
+        struct coy_dmove_ move = {.dst = a, .kind = COY_DMOVE_COPY_};
+        if(!coy_function_decode_operand_(func, block, args[a], &move.src))
+        {
+            stbds_arrfree(pending);
+            return false;
+        }
+        if(!move.src.cptr && move.src.index == a)
+            continue;   //< already in place
+        stbds_arrput(pending, move);
+    }
+    // sequentialize: a move can be done once nothing else reads its destination
+    while(stbds_arrlenu(pending))
+    {
+        size_t m;
+        for(m = 0; m < stbds_arrlenu(pending); m++)
+            if(!coy_function_decode_is_read_(pending, m, pending[m].dst))
+                break;
+        if(m == stbds_arrlenu(pending))
+        {
+            // everything left is part of a cycle; break one by saving the destination of the first move into the temporary
+            // (the temporary is always free here, because a pending `RESTORE` would have an unblocked move in its chain)
+            uint32_t dst = pending[0].dst;
+            for(size_t p = 0; p < stbds_arrlenu(pending); p++)
+                COY_ASSERT(pending[p].kind != COY_DMOVE_RESTORE_);
+            struct coy_dmove_ save = {.src = {.cptr = NULL, .index = dst}, .kind = COY_DMOVE_SAVE_};
+            stbds_arrput(dcode->moves, save);
+            for(size_t p = 1; p < stbds_arrlenu(pending); p++)
+                if(pending[p].kind == COY_DMOVE_COPY_ && !pending[p].src.cptr && pending[p].src.index == dst)
+                    pending[p].kind = COY_DMOVE_RESTORE_;
+            m = 0;
+        }
+        stbds_arrput(dcode->moves, pending[m]);
+        stbds_arrdel(pending, m);
+    }
+    stbds_arrfree(pending);
+    return true;
+}
+static bool coy_function_decode_jump_(struct coy_function_* func, const struct coy_function_block_* block, struct coy_dcode_* dcode, const uint32_t* blockpcs, uint32_t target, const union coy_instruction_* args, uint32_t nargs)
+{
+    if(target >= stbds_arrlenu(func->u.coy.blocks))
+        return false;
+    struct coy_djump_ jump = {
+        .block = target,
+        .pc = blockpcs[target],
+        .moves = stbds_arrlenu(dcode->moves),
+    };
+    if(!coy_function_decode_moves_(func, block, dcode, args, nargs))
+        return false;
+    jump.nmoves = stbds_arrlenu(dcode->moves) - jump.moves;
+    stbds_arrput(dcode->jumps, jump);
+    return true;
+}
+// picks the type-specific variant of an arithmetic or `jmpc` instruction
+static uint8_t coy_function_quicken_(uint8_t code, uint8_t flags)
+{
+    bool is_signed;
+    bool is_x2;
+    switch(flags & COY_OPFLG_TYPE_MASK)
+    {
+    case COY_OPFLG_TYPE_INT32:          is_signed = true; is_x2 = false; break;
+    case COY_OPFLG_TYPE_UINT32:         is_signed = false; is_x2 = false; break;
+    case COY_OPFLG_TYPE_INT32X2_TEMP:   is_signed = true; is_x2 = true; break;
+    case COY_OPFLG_TYPE_UINT32X2_TEMP:  is_signed = false; is_x2 = true; break;
+    default:
+        return COY_DOPCODE_INVALID_;
+    }
+    switch(code)
+    {
+    case COY_OPCODE_ADD: return is_x2 ? COY_DOPCODE_ADD_32X2_ : COY_DOPCODE_ADD_32_;
+    case COY_OPCODE_SUB: return is_x2 ? COY_DOPCODE_SUB_32X2_ : COY_DOPCODE_SUB_32_;
+    case COY_OPCODE_MUL:
+        if(is_x2) return is_signed ? COY_DOPCODE_MUL_I32X2_ : COY_DOPCODE_MUL_U32X2_;
+        else return is_signed ? COY_DOPCODE_MUL_I32_ : COY_DOPCODE_MUL_U32_;
+    case COY_OPCODE_DIV:
+        if(is_x2) return is_signed ? COY_DOPCODE_DIV_I32X2_ : COY_DOPCODE_DIV_U32X2_;
+        else return is_signed ? COY_DOPCODE_DIV_I32_ : COY_DOPCODE_DIV_U32_;
+    case COY_OPCODE_REM:
+        if(is_x2) return is_signed ? COY_DOPCODE_REM_I32X2_ : COY_DOPCODE_REM_U32X2_;
+        else return is_signed ? COY_DOPCODE_REM_I32_ : COY_DOPCODE_REM_U32_;
+    case COY_OPCODE_JMPC:
+        switch(flags & COY_OPFLG_CMP_MASK)
+        {
+        case COY_OPFLG_CMP_EQ: return is_x2 ? COY_DOPCODE_JMPC_EQ_32X2_ : COY_DOPCODE_JMPC_EQ_32_;
+        case COY_OPFLG_CMP_NE: return is_x2 ? COY_DOPCODE_JMPC_NE_32X2_ : COY_DOPCODE_JMPC_NE_32_;
+        // vectors only support equality tests
+        case COY_OPFLG_CMP_LE: return is_x2 ? COY_DOPCODE_INVALID_ : is_signed ? COY_DOPCODE_JMPC_LE_I32_ : COY_DOPCODE_JMPC_LE_U32_;
+        case COY_OPFLG_CMP_LT: return is_x2 ? COY_DOPCODE_INVALID_ : is_signed ? COY_DOPCODE_JMPC_LT_I32_ : COY_DOPCODE_JMPC_LT_U32_;
+        default: COY_UNREACHABLE();
+        }
+    default:
+        COY_UNREACHABLE();
+    }
+}
+static bool coy_function_decode_instr_(struct coy_function_* func, const struct coy_function_block_* block, struct coy_dcode_* dcode, const uint32_t* blockpcs, const union coy_instruction_* instr, struct coy_dinstr_* dinstr)
+{
+    uint32_t nargs = instr->op.nargs;
+    switch(instr->op.code)
+    {
+    case COY_OPCODE_ADD:
+    case COY_OPCODE_SUB:
+    case COY_OPCODE_MUL:
+    case COY_OPCODE_DIV:
+    case COY_OPCODE_REM:
+        if(nargs != 2) return false;
+        dinstr->code = coy_function_quicken_(instr->op.code, instr->op.flags);
+        return coy_function_decode_operand_(func, block, instr[1], &dinstr->a)
+            && coy_function_decode_operand_(func, block, instr[2], &dinstr->b);
+    case COY_OPCODE_JMP:
+        if(nargs < 1) return false;
+        dinstr->extra = stbds_arrlenu(dcode->jumps);
+        return coy_function_decode_jump_(func, block, dcode, blockpcs, instr[1].raw, &instr[2], nargs - 1u);
+    case COY_OPCODE_JMPC:
+    {
+        if(nargs < 5) return false;
+        uint32_t moves_sep = instr[5].raw;
+        if(5 + moves_sep > nargs) return false;
+        dinstr->code = coy_function_quicken_(instr->op.code, instr->op.flags);
+        dinstr->extra = stbds_arrlenu(dcode->jumps);
+        return coy_function_decode_operand_(func, block, instr[1], &dinstr->a)
+            && coy_function_decode_operand_(func, block, instr[2], &dinstr->b)
+            && coy_function_decode_jump_(func, block, dcode, blockpcs, instr[3].raw, &instr[6], moves_sep)
+            && coy_function_decode_jump_(func, block, dcode, blockpcs, instr[4].raw, &instr[6 + moves_sep], nargs - 5u - moves_sep);
+    }
+    case COY_OPCODE_CALL:
+    case COY_OPCODE_RETCALL:
+    {
+        if(nargs < 1) return false;
+        dinstr->extra = stbds_arrlenu(dcode->operands);
+        dinstr->nextra = nargs - 1u;
+        dinstr->b.index = stbds_arrlenu(dcode->calls);
+        // the result goes to our `dst` (or, for a `retcall`, to our caller's), which may be a GC root
+        dinstr->b.isptr = instr->op.code == COY_OPCODE_CALL ? coy_function_block_isptr_(block, dinstr->dst) : coy_function_returns_ref_(func);
+        struct coy_dcallsite_ site = {.function = NULL, .moves = stbds_arrlenu(dcode->moves)};
+        // a tail call passes its arguments the same way as a jump does (in-place, into the start of the frame)
+        if(instr->op.code == COY_OPCODE_RETCALL && !coy_function_decode_moves_(func, block, dcode, &instr[2], nargs - 1u))
+            return false;
+        site.nmoves = stbds_arrlenu(dcode->moves) - site.moves;
+        stbds_arrput(dcode->calls, site);
+        return coy_function_decode_operand_(func, block, instr[1], &dinstr->a)
+            && coy_function_decode_operands_(func, block, dcode, &instr[2], nargs - 1u);
+    }
+    case COY_OPCODE_RET:
+        if(nargs > 1) return false;
+        dinstr->nextra = nargs;
+        return !nargs || coy_function_decode_operand_(func, block, instr[1], &dinstr->a);
+    case COY_OPCODE__DUMPU32:
+        dinstr->extra = stbds_arrlenu(dcode->operands);
+        dinstr->nextra = nargs;
+        return coy_function_decode_operands_(func, block, dcode, &instr[1], nargs);
+    default:
+        return false;   //< invalid instruction
+    }
+}
+
+static void coy_dcode_free_(struct coy_dcode_* dcode)
+{
+    if(!dcode) return;
+    stbds_arrfree(dcode->instrs);
+    stbds_arrfree(dcode->operands);
+    stbds_arrfree(dcode->jumps);
+    stbds_arrfree(dcode->moves);
+    stbds_arrfree(dcode->calls);
+    coy_jit_free_(dcode->jit);
+    free(dcode);
+}
+bool coy_function_decode_(struct coy_function_* func)
+{
+    if(!COY_ENSURE(!(func->attrib & COY_FUNCTION_ATTRIB_NATIVE_), "misuse: cannot decode a `native` function"))
+        return false;
+    if(COY_ATOMIC_LOAD_ACQUIRE(&func->u.coy.dcode))
+        return true;    //< already decoded
+
+    uint32_t nblocks = stbds_arrlenu(func->u.coy.blocks);
+    uint32_t ninstrs = func->u.coy.ninstrs;
+    // first pass: find where each block starts in the decoded stream (so that we can resolve forward jumps)
+    uint32_t* blockpcs = NULL;
+    stbds_arrsetlen(blockpcs, nblocks);
+    uint32_t ndinstrs = 0;
+    for(uint32_t b = 0; b < nblocks; b++)
+    {
+        uint32_t coffset = func->u.coy.blocks[b].offset;
+        uint32_t noffset = b + 1 < nblocks ? func->u.coy.blocks[b+1].offset : ninstrs;
+        blockpcs[b] = ndinstrs;
+        for(uint32_t i = coffset; i < noffset; i += 1 + func->u.coy.instrs[i].op.nargs)
+            ++ndinstrs;
+    }
+
+    struct coy_dcode_* dcode = malloc(sizeof(struct coy_dcode_));
+    dcode->instrs = NULL;
+    dcode->operands = NULL;
+    dcode->jumps = NULL;
+    dcode->moves = NULL;
+    dcode->calls = NULL;
+    dcode->verified = false;
+    dcode->hotness = 0;
+    dcode->jit = NULL;
+    stbds_arrsetcap(dcode->instrs, ndinstrs);
+    // second pass: the actual decoding
+    bool ok = true;
+    for(uint32_t b = 0; ok && b < nblocks; b++)
+    {
+        const struct coy_function_block_* block = &func->u.coy.blocks[b];
+        uint32_t coffset = block->offset;
+        uint32_t noffset = b + 1 < nblocks ? func->u.coy.blocks[b+1].offset : ninstrs;
+        for(uint32_t i = coffset; ok && i < noffset; i += 1 + func->u.coy.instrs[i].op.nargs)
+        {
+            const union coy_instruction_* instr = &func->u.coy.instrs[i];
+            if(i + instr->op.nargs >= noffset)
+            {
+                ok = false;     //< arguments out of bounds
+                break;
+            }
+            struct coy_dinstr_ dinstr = {
+                .code = instr->op.code,
+                .flags = instr->op.flags,
+                .dst = block->nparams + (i - coffset),
+                .pc = i,
+            };
+            ok = coy_function_decode_instr_(func, block, dcode, blockpcs, instr, &dinstr);
+            stbds_arrput(dcode->instrs, dinstr);
+        }
+    }
+    stbds_arrfree(blockpcs);
+    if(!ok)
+    {
+        coy_dcode_free_(dcode);
+        return false;
+    }
+    COY_ASSERT(stbds_arrlenu(dcode->instrs) == ndinstrs);
+    // another context may have decoded the function at the same time; if it got there first, we use its copy
+    struct coy_dcode_* expected = NULL;
+    if(!COY_ATOMIC_CAS(&func->u.coy.dcode, &expected, dcode))
+        coy_dcode_free_(dcode);
+    return true;
+}
+void coy_function_free_dcode_(struct coy_function_* func)
+{
+    coy_dcode_free_(func->u.coy.dcode);
+    func->u.coy.dcode = NULL;
+}
+struct coy_dcode_* coy_function_get_dcode_(struct coy_function_* func)
+{
+    struct coy_dcode_* dcode = COY_ATOMIC_LOAD_ACQUIRE(&func->u.coy.dcode);
+    if(!dcode)
+    {
+        bool ok = coy_function_decode_(func);
+        COY_CHECK_MSG(ok, "invalid bytecode");
+        (void)ok;
+        dcode = COY_ATOMIC_LOAD_ACQUIRE(&func->u.coy.dcode);
+    }
+    return dcode;
+}
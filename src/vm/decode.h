@@ -0,0 +1,130 @@
+#ifndef COY_VM_DECODE_H_
+#define COY_VM_DECODE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct coy_function_;
+struct coy_jit_code_;
+union coy_register_;
+
+/*
+The decoded format is what the interpreter actually executes. It is produced once per function (after linking & verification),
+so that the hot loop never has to look at `union coy_instruction_` bitfields, constant indices, or block offsets.
+
+Each bytecode instruction maps to exactly one `coy_dinstr_`; variable-length argument lists (call arguments)
+are stored out-of-line in `operands`, and jump targets in `jumps` (with their block arguments in `moves`).
+*/
+
+// A decoded operand is either a register (relative to `fp`), or a pointer to a constant.
+struct coy_doperand_
+{
+    const union coy_register_* cptr;    //< pointer to constant, or NULL if this is a register
+    uint32_t index;                     //< register index, relative to `fp` (unused for constants)
+    uint32_t isptr: 1;                  //< is this a reference constant, or a pointer register (per its block's `ptrs`)?
+    uint32_t : 31;
+};
+/*
+Block arguments are passed via a sequence of moves into the target's parameters, ordered such that no source is overwritten
+before it is read (a parallel move). Only cycles (such as swapping two values) need a temporary: `SAVE` copies a register
+into it, and a later `RESTORE` copies it into the destination.
+*/
+enum coy_dmove_kind_
+{
+    COY_DMOVE_COPY_,    //< dst <= src
+    COY_DMOVE_SAVE_,    //< temp <= src
+    COY_DMOVE_RESTORE_, //< dst <= temp
+};
+struct coy_dmove_
+{
+    struct coy_doperand_ src;   //< source value (unused for `RESTORE`)
+    uint32_t dst;               //< destination register, relative to `fp` (unused for `SAVE`)
+    uint32_t kind;              //< `COY_DMOVE_*_`
+};
+// A decoded jump target, including the block arguments to pass.
+struct coy_djump_
+{
+    uint32_t block;     //< target block index
+    uint32_t pc;        //< index of the target block's first decoded instruction
+    uint32_t moves;     //< index of first move in `moves`
+    uint32_t nmoves;    //< number of moves (arguments that are already in place are omitted)
+};
+/*
+Each `call` and `retcall` has a call-site cache, filled on first execution. It records the callee that the call was last
+checked against (resolved, decoded, and passed the right number of arguments), so that the common case (calling the same
+function as last time) can skip those checks; everything else is read from the callee, which does not change once linked.
+Contexts of an env may run on separate threads, so `function` is the only part that changes after decoding, and it is
+published with a single (atomic) store; see `coy_op_callsite_`.
+A `retcall` into bytecode reuses the caller's frame, so its arguments are passed like block arguments (see `coy_dmove_`).
+*/
+struct coy_dcallsite_
+{
+    struct coy_function_* function;     //< cached callee, or NULL if the call has not executed yet
+    uint32_t moves;                     //< `retcall` only: index of first move (of the arguments into our frame) in `moves`
+    uint32_t nmoves;                    //< `retcall` only: number of moves
+};
+/*
+Quickened opcodes: arithmetic and `jmpc` instructions are rewritten into type-specific variants while decoding,
+so that the interpreter does not need to dispatch on `COY_OPFLG_TYPE_*` (and `COY_OPFLG_CMP_*`) every time they execute.
+They share the opcode space with `COY_OPCODE_*`, starting at a value that bytecode does not use.
+*/
+enum coy_dopcode_
+{
+    COY_DOPCODE_INVALID_ = 0x40,    //< unsupported type for operation (fails if executed)
+    COY_DOPCODE_ADD_32_,            //< add.i32, add.u32
+    COY_DOPCODE_ADD_32X2_,          //< add.i32x2, add.u32x2
+    COY_DOPCODE_SUB_32_,
+    COY_DOPCODE_SUB_32X2_,
+    COY_DOPCODE_MUL_I32_,
+    COY_DOPCODE_MUL_U32_,
+    COY_DOPCODE_MUL_I32X2_,
+    COY_DOPCODE_MUL_U32X2_,
+    COY_DOPCODE_DIV_I32_,
+    COY_DOPCODE_DIV_U32_,
+    COY_DOPCODE_DIV_I32X2_,
+    COY_DOPCODE_DIV_U32X2_,
+    COY_DOPCODE_REM_I32_,
+    COY_DOPCODE_REM_U32_,
+    COY_DOPCODE_REM_I32X2_,
+    COY_DOPCODE_REM_U32X2_,
+    COY_DOPCODE_JMPC_EQ_32_,        //< jmpc.eq.i32, jmpc.eq.u32
+    COY_DOPCODE_JMPC_NE_32_,
+    COY_DOPCODE_JMPC_LE_I32_,
+    COY_DOPCODE_JMPC_LT_I32_,
+    COY_DOPCODE_JMPC_LE_U32_,
+    COY_DOPCODE_JMPC_LT_U32_,
+    COY_DOPCODE_JMPC_EQ_32X2_,
+    COY_DOPCODE_JMPC_NE_32X2_,
+};
+
+struct coy_dinstr_
+{
+    uint8_t code;       //< opcode (`COY_OPCODE_*`, or a quickened `COY_DOPCODE_*`)
+    uint8_t flags;      //< opcode flags (`COY_OPFLG_*`)
+    uint16_t _reserved;
+    uint32_t dst;       //< destination register, relative to `fp`
+    struct coy_doperand_ a; //< first operand (or callee, for calls)
+    struct coy_doperand_ b; //< second operand (for calls, `b.index` is the call-site index in `calls`, and `b.isptr` whether the result must be a reference)
+    uint32_t extra;     //< opcode-specific: index of first jump target in `jumps`, or first argument in `operands`
+    uint32_t nextra;    //< opcode-specific: number of arguments in `operands`
+    uint32_t pc;        //< offset of the originating instruction in `instrs` (for debugging)
+};
+struct coy_dcode_
+{
+    struct coy_dinstr_* instrs;
+    struct coy_doperand_* operands;
+    struct coy_djump_* jumps;
+    struct coy_dmove_* moves;
+    struct coy_dcallsite_* calls;
+    bool verified;      //< set (atomically) by `coy_function_verify_`; allows the interpreter to skip register access checks
+    uint32_t hotness;   //< number of block entries so far (saturates at `COY_JIT_THRESHOLD_`, give or take concurrent entries)
+    struct coy_jit_code_* jit;  //< native code (see jit.h), or NULL if not compiled (yet); published with a compare-and-swap
+};
+
+// (contexts may decode the same function at the same time; all of them end up using the copy that was published first)
+bool coy_function_decode_(struct coy_function_* func);
+void coy_function_free_dcode_(struct coy_function_* func);
+// decodes the function if this hasn't been done yet
+struct coy_dcode_* coy_function_get_dcode_(struct coy_function_* func);
+
+#endif /* COY_VM_DECODE_H_ */
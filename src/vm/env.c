@@ -1,7 +1,7 @@
 #include "env.h"
 #include "context.h"
 #include "function.h"
-#include "../util/string.h"
+#include "image.h"
 #include "../util/debug.h"
 
 #include "stb_ds.h"
@@ -64,22 +64,41 @@ struct coy_module_* coy_module_create_(struct coy_env* env, const char* name, bo
         return NULL;
     if(validation == COY_MODULE_VALIDATION_RESERVED_ && !allow_reserved)
         return NULL;    //< error: module uses reserved package (this is handled outside of the `ensure` because a reserved name is not an *API* misuse)
-    if(stbds_shgetp_null(env->modules, name))
+    const struct coy_istring_* iname = coy_env_intern_(env, name);
+    if(coy_env_find_module_istr_(env, iname))
         return NULL;    //< error: module already exists
     struct coy_module_* module = malloc(sizeof(struct coy_module_));
     module->env = env;
-    module->name = coy_strdup_(name, -1);
+    module->name = iname;
     module->symbols = NULL;
-    stbds_shput(env->modules, module->name, module);
+    stbds_hmput(env->modules, module->name, module);
     return module;
 }
 
+void coy_module_destroy_(struct coy_module_* module)
+{
+    if(!module) return;
+    (void)stbds_hmdel(module->env->modules, module->name);
+    for(size_t s = 0; s < stbds_hmlenu(module->symbols); s++)
+    {
+        struct coy_module_symbol_* sym = &module->symbols[s].value;
+        if(sym->category == COY_MODULE_SYMCAT_FUNCTION_)
+            stbds_arrfree(sym->u.functions);
+    }
+    stbds_hmfree(module->symbols);
+    free(module);
+}
+
 void coy_module_inject_function_(struct coy_module_* module, const char* name, struct coy_function_* function)
+{
+    coy_module_inject_function_istr_(module, coy_env_intern_(module->env, name), function);
+}
+void coy_module_inject_function_istr_(struct coy_module_* module, const struct coy_istring_* name, struct coy_function_* function)
 {
 #if 0   // stb_ds bug
-    struct coy_module_symbol_entry_* entry = stbds_shgetp_null(module->symbols, name);
+    struct coy_module_symbol_entry_* entry = stbds_hmgetp_null(module->symbols, name);
 #else
-    ptrdiff_t entryidx = stbds_shgeti(module->symbols, name);
+    ptrdiff_t entryidx = stbds_hmgeti(module->symbols, name);
     struct coy_module_symbol_entry_* entry = entryidx >= 0 ? &module->symbols[entryidx] : NULL;
 #endif
     if(entry)
@@ -91,17 +110,17 @@ void coy_module_inject_function_(struct coy_module_* module, const char* name, s
     else
     {
         struct coy_module_symbol_ sym;
-        sym.name = coy_strdup_(name, -1);
+        sym.name = name;
         sym.category = COY_MODULE_SYMCAT_FUNCTION_;
         sym.u.functions = NULL;
         stbds_arrput(sym.u.functions, function);
-        stbds_shput(module->symbols, sym.name, sym);
+        stbds_hmput(module->symbols, sym.name, sym);
     }
 }
 bool coy_module_link_(struct coy_module_* module)
 {
     bool ok = true;
-    for(size_t s = 0; s < stbds_shlenu(module->symbols); s++)
+    for(size_t s = 0; s < stbds_hmlenu(module->symbols); s++)
     {
         const struct coy_module_symbol_* sym = &module->symbols[s].value;
         // we only link functions (skip others)
@@ -114,11 +133,17 @@ bool coy_module_link_(struct coy_module_* module)
     return ok;
 }
 struct coy_module_symbol_* coy_module_find_symbol_(struct coy_module_* module, const char* name)
+{
+    // (a name that was never interned cannot be a symbol)
+    const struct coy_istring_* iname = coy_strpool_find_(&module->env->strings, name, strlen(name));
+    return iname ? coy_module_find_symbol_istr_(module, iname) : NULL;
+}
+struct coy_module_symbol_* coy_module_find_symbol_istr_(struct coy_module_* module, const struct coy_istring_* name)
 {
 #if 0   // stb_ds bug
-    struct coy_module_symbol_entry_* entry = stbds_shgetp_null(module->symbols, name);
+    struct coy_module_symbol_entry_* entry = stbds_hmgetp_null(module->symbols, name);
 #else
-    ptrdiff_t entryidx = stbds_shgeti(module->symbols, name);
+    ptrdiff_t entryidx = stbds_hmgeti(module->symbols, name);
     struct coy_module_symbol_entry_* entry = entryidx >= 0 ? &module->symbols[entryidx] : NULL;
 #endif
     return entry ? &entry->value : NULL;
@@ -131,6 +156,10 @@ coy_env_t* coy_env_init(coy_env_t* env)
     env->contexts.next_id = 1;
     env->modules = NULL;
     env->typeinfos = NULL;
+    env->images = NULL;
+    env->stubs = NULL;
+    env->link_lazily = false;
+    coy_strpool_init_(&env->strings);
     return env;
 }
 void coy_env_deinit(coy_env_t* env)
@@ -138,16 +167,41 @@ void coy_env_deinit(coy_env_t* env)
     if(!env) return;
     while(stbds_arrlenu(env->contexts.ptr))
         coy_context_destroy(env->contexts.ptr[0]);
-    stbds_shfree(env->modules);
+    for(size_t i = 0; i < stbds_arrlenu(env->images); i++)
+        coy_image_free_(env->images[i]);
+    stbds_arrfree(env->images);
+    stbds_hmfree(env->modules);
+    for(size_t s = 0; s < stbds_hmlenu(env->stubs); s++)
+        free(env->stubs[s].value);
+    stbds_hmfree(env->stubs);
+    coy_strpool_deinit_(&env->strings);
 }
 
 struct coy_module_* coy_env_find_module_(coy_env_t* env, const char* name)
+{
+    const struct coy_istring_* iname = coy_strpool_find_(&env->strings, name, strlen(name));
+    return iname ? coy_env_find_module_istr_(env, iname) : NULL;
+}
+struct coy_module_* coy_env_find_module_istr_(coy_env_t* env, const struct coy_istring_* name)
 {
 #if 0   // stb_ds bug
-    struct coy_module_entry_* entry = stbds_shgetp_null(env->modules, name);
+    struct coy_module_entry_* entry = stbds_hmgetp_null(env->modules, name);
 #else
-    ptrdiff_t entryidx = stbds_shgeti(env->modules, name);
+    ptrdiff_t entryidx = stbds_hmgeti(env->modules, name);
     struct coy_module_entry_* entry = entryidx >= 0 ? &env->modules[entryidx] : NULL;
 #endif
     return entry ? entry->value : NULL;
 }
+const struct coy_istring_* coy_env_intern_(coy_env_t* env, const char* str)
+{
+    return coy_strpool_intern_(&env->strings, str, strlen(str));
+}
+struct coy_function_* coy_env_get_stub_(coy_env_t* env, const struct coy_istring_* symbol)
+{
+    ptrdiff_t entryidx = stbds_hmgeti(env->stubs, symbol);
+    if(entryidx >= 0)
+        return env->stubs[entryidx].value;
+    struct coy_function_* stub = coy_function_init_stub_(malloc(sizeof(struct coy_function_)), symbol);
+    stbds_hmput(env->stubs, symbol, stub);
+    return stub;
+}
@@ -5,11 +5,14 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "../util/strpool.h"
+
 struct coy_env;
 struct coy_context;
 struct coy_module_symbol_entry_;
 struct coy_module_entry_;
 struct coy_typeinfo_;
+struct coy_image_;
 
 // TODO: I really dislike how this essentially duplicates type info; but it's kind of necessary for function overloading. Taking ideas; the only idea I have is to make the whole thing a multiset, but only allow multiple values for functions.
 enum coy_module_symbol_category_
@@ -18,7 +21,7 @@ enum coy_module_symbol_category_
 };
 struct coy_module_symbol_
 {
-    char* name;
+    const struct coy_istring_* name;
     // static vs instance; immutable (e.g. function declarations) vs mutable (e.g. variables)
     enum coy_module_symbol_category_ category;
     union
@@ -33,24 +36,30 @@ struct coy_module_symbol_
         } variable;
     } u;
 };
+// (keyed by interned name, so lookups compare pointers)
 struct coy_module_symbol_entry_
 {
-    char* key;
+    const struct coy_istring_* key;
     struct coy_module_symbol_ value;
 };
 
 struct coy_module_
 {
     struct coy_env* env;
-    char* name;
+    const struct coy_istring_* name;
     // TODO: this should probably be shared with the compiler's symbol table?
     struct coy_module_symbol_entry_* symbols;
 };
 struct coy_module_entry_
 {
-    char* key;
+    const struct coy_istring_* key;
     struct coy_module_* value;
 };
+struct coy_function_stub_entry_
+{
+    const struct coy_istring_* key;
+    struct coy_function_* value;
+};
 struct coy_typeinfo_entry_
 {
     char* key;
@@ -58,10 +67,14 @@ struct coy_typeinfo_entry_
 };
 
 struct coy_module_* coy_module_create_(struct coy_env* env, const char* name, bool allow_reserved);
+// removes `module` from its env, and frees it (but not its functions)
+void coy_module_destroy_(struct coy_module_* module);
 
 void coy_module_inject_function_(struct coy_module_* module, const char* name, struct coy_function_* function);
+void coy_module_inject_function_istr_(struct coy_module_* module, const struct coy_istring_* name, struct coy_function_* function);
 bool coy_module_link_(struct coy_module_* module);
 struct coy_module_symbol_* coy_module_find_symbol_(struct coy_module_* module, const char* name);
+struct coy_module_symbol_* coy_module_find_symbol_istr_(struct coy_module_* module, const struct coy_istring_* name);
 
 // A VM is a shared context that stores immutable data such as code.
 typedef struct coy_env
@@ -74,13 +87,21 @@ typedef struct coy_env
         uint32_t next_id;
     } contexts;
     struct coy_module_entry_* modules;
+    struct coy_strpool_ strings;    //< interned names: of modules, of their symbols, and of symbol constants
     // these are interned
     struct coy_typeinfo_entry_* typeinfos;
+    struct coy_image_** images;     //< loaded module images (see image.h)
+    struct coy_function_stub_entry_* stubs;     //< symbol stubs, for lazy linking (one per symbol)
+    bool link_lazily;   //< should symbols be resolved on first call, rather than when linking? (see `coy_function_link_`)
 } coy_env_t;
 
 coy_env_t* coy_env_init(coy_env_t* env);
 void coy_env_deinit(coy_env_t* env);
 
 struct coy_module_* coy_env_find_module_(coy_env_t* env, const char* name);
+struct coy_module_* coy_env_find_module_istr_(coy_env_t* env, const struct coy_istring_* name);
+const struct coy_istring_* coy_env_intern_(coy_env_t* env, const char* str);
+// returns the (unresolved) stub function for `symbol`, creating it if necessary
+struct coy_function_* coy_env_get_stub_(coy_env_t* env, const struct coy_istring_* symbol);
 
 #endif /* COY_VM_ENV_H_ */
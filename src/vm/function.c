@@ -1,8 +1,12 @@
 #include "env.h"
 #include "function.h"
+#include "decode.h"
 #include "register.h"
+#include "../typeinfo.h"
 
+#include "../util/atomic.h"
 #include "../util/bitarray.h"
+#include "../util/memio.h"
 #include "../util/debug.h"
 #include "../bytecode.h"
 
@@ -19,142 +23,169 @@
 #define VERIFY_FAILED   abort()
 #endif
 
-struct coy_memio_
-{
-    const uint8_t* data;
-    size_t pos;
-    size_t len;
-    bool ok;
-};
-size_t coy_memio_read_at_(struct coy_memio_* memio, size_t pos, void* buf, size_t len)
-{
-    if(pos + len > memio->len)
-    {
-        memio->ok = false;
-        len = memio->len - pos;
-    }
-    memcpy(buf, &memio->data[pos], len);
-    return len;
-}
-size_t coy_memio_read_(struct coy_memio_* memio, void* buf, size_t len)
-{
-    size_t r = coy_memio_read_at_(memio, memio->pos, buf, len);
-    memio->pos += len;
-    return r;
-}
-uint32_t coy_memio_read32le_at_(struct coy_memio_* memio, size_t pos)
-{
-    uint32_t v;
-    COY_CHECK(!(pos & (sizeof(v) - 1))); // check alignment
-    if(pos + sizeof(v) > memio->len)
-    {
-        memio->ok = false;
-        return 0;
-    }
-    v = 0;
-    for(size_t i = 1; i <= sizeof(v); i++)
-        v = (v << 8) | (uint32_t)memio->data[pos+sizeof(v)-i];
-    return v;
-}
-uint32_t coy_memio_read32le_(struct coy_memio_* memio)
+// serialized constants are 16 bytes each (a value's low 8 bytes, then 8 reserved bytes)
+#define COY_FUNCTION_CONST_SIZE_    16u
+// can serialized instructions & constants be used in place (see `coy_function_init_mapped_`)?
+#if defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define COY_FUNCTION_MAPPABLE_  (sizeof(union coy_register_) == COY_FUNCTION_CONST_SIZE_)
+#else
+#define COY_FUNCTION_MAPPABLE_  0
+#endif
+
+// does `memio` have room for (at least) `count` items of `size` bytes each? (for rejecting bogus counts before allocating)
+static bool coy_function_can_read_(struct coy_memio_* memio, uint32_t count, size_t size)
 {
-    uint32_t v = coy_memio_read32le_at_(memio, memio->pos);
-    memio->pos += sizeof(v);
-    return v;
+    if(memio->pos <= memio->len && count <= (memio->len - memio->pos) / size)
+        return true;
+    memio->ok = false;
+    return false;
 }
-uint64_t coy_memio_read64le_at_(struct coy_memio_* memio, size_t pos)
+// symbols are interned straight from `memio` (so they are only copied if the env has not seen them yet)
+static const struct coy_istring_* coy_function_read_symbol_(struct coy_env* env, struct coy_memio_* memio, uint32_t pos, uint32_t len)
 {
-    uint64_t v;
-    COY_CHECK(!(pos & (sizeof(v) - 1))); // check alignment
-    if(pos + sizeof(v) > memio->len)
+    size_t start = (size_t)pos + sizeof(len);
+    if(start > memio->len || len > memio->len - start)
     {
         memio->ok = false;
-        return 0;
-    }
-    v = 0;
-    for(size_t i = 1; i <= sizeof(v); i++)
-        v = (v << 8) | (uint32_t)memio->data[pos+sizeof(v)-i];
-    return v;
-}
-uint64_t coy_memio_read64le_(struct coy_memio_* memio)
-{
-    uint64_t v = coy_memio_read64le_at_(memio, memio->pos);
-    memio->pos += sizeof(v);
-    return v;
-}
-
-// we'll eventually want to intern these, but for now ...
-static char* coy_function_read_symbol_(struct coy_function_* func, struct coy_memio_* memio, uint32_t pos, uint32_t len)
-{
-    char* sym = malloc(len + 1);
-    if(coy_memio_read_at_(memio, pos + sizeof(len), sym, len) != len)
-    {
-        free(sym);
         return NULL;
     }
-    sym[len] = 0;
-    return sym;
+    return coy_strpool_intern_(&env->strings, (const char*)&memio->data[start], len);
 }
-static bool coy_function_read_consts_(struct coy_function_* func, struct coy_memio_* memio)
+// `mapped` is the (writable) data behind `memio` if the constants can be used in place, or NULL
+static bool coy_function_read_consts_(struct coy_function_* func, struct coy_env* env, struct coy_memio_* memio, uint8_t* mapped)
 {
     uint32_t nsymbols = coy_memio_read32le_(memio);
     uint32_t nrefs = coy_memio_read32le_(memio);
     uint32_t nvals = coy_memio_read32le_(memio);
     /*uint32_t _reserved1 = */coy_memio_read32le_(memio);
     if(!memio->ok) return false;
+    if(nrefs) return false; //< TODO: loading reference constants
+    uint32_t nconsts = nsymbols + nvals;
+    if(nconsts < nsymbols || !coy_function_can_read_(memio, nsymbols, 8)) return false;
+    size_t symtable = memio->pos;
+    memio->pos += (size_t)nsymbols * 8;
+    if(!coy_function_can_read_(memio, nconsts, COY_FUNCTION_CONST_SIZE_)) return false;
     func->u.coy.consts.nsymbols = nsymbols;
     func->u.coy.consts.nrefs = nrefs;
-    func->u.coy.consts.data = NULL;
-    stbds_arrsetlen(func->u.coy.consts.data, nsymbols + nrefs + nvals);
-    for(size_t s = 0; s < nsymbols; s++)
+    func->u.coy.consts.count = nconsts;
+    if(mapped)
+        func->u.coy.consts.data = (union coy_register_*)(mapped + memio->pos);
+    else if(sizeof(union coy_register_) == COY_FUNCTION_CONST_SIZE_)
     {
-        uint32_t offset = coy_memio_read32le_(memio);
-        uint32_t length = coy_memio_read32le_(memio);
+        // (the reserved upper halves are zero in the data, and so end up zeroed here as well)
+        stbds_arrsetlen(func->u.coy.consts.data, nconsts);
+        if(!coy_memio_read64le_array_at_(memio, memio->pos, (uint64_t*)func->u.coy.consts.data, (size_t)nconsts * 2))
+            return false;
+    }
+    else
+    {
+        stbds_arrsetlen(func->u.coy.consts.data, nconsts);
+        for(uint32_t c = 0; c < nconsts; c++)
+        {
+            func->u.coy.consts.data[c].temp.u32x2[0] = 0;
+            func->u.coy.consts.data[c].temp.u32x2[1] = 0;
+            func->u.coy.consts.data[c].u64 = coy_memio_read64le_at_(memio, memio->pos + c * COY_FUNCTION_CONST_SIZE_);
+        }
+    }
+    memio->pos += (size_t)nconsts * COY_FUNCTION_CONST_SIZE_;
+    for(uint32_t s = 0; s < nsymbols; s++)
+    {
+        uint32_t offset = coy_memio_read32le_at_(memio, symtable + s * 8);
+        uint32_t length = coy_memio_read32le_at_(memio, symtable + s * 8 + 4);
         if(!memio->ok) return false;
-        func->u.coy.consts.data[s].ptr = coy_function_read_symbol_(func, memio, offset, length);
+        func->u.coy.consts.data[s].ptr = (void*)coy_function_read_symbol_(env, memio, offset, length);
     }
     if(!memio->ok) return false;
-    for(size_t r = nsymbols; r < nsymbols + nrefs; r++)
-        COY_TODO("loading reference constants");
-    if(!memio->ok) return false;
-    for(size_t v = nsymbols + nrefs; v < nsymbols + nrefs + nvals; v++)
-        func->u.coy.consts.data[v].u64 = coy_memio_read64le_(memio);
-    if(!memio->ok) return false;
     return true;
 }
 static bool coy_function_read_blocks_(struct coy_function_* func, struct coy_memio_* memio)
 {
     uint32_t nblocks = coy_memio_read32le_(memio);
-    if(!memio->ok) return false;
-    func->u.coy.blocks = NULL;
+    if(!memio->ok || !coy_function_can_read_(memio, nblocks, 3 * sizeof(uint32_t))) return false;
     stbds_arrsetlen(func->u.coy.blocks, nblocks);
+    for(uint32_t b = 0; b < nblocks; b++)
+        func->u.coy.blocks[b].ptrs = NULL;
     for(uint32_t b = 0; b < nblocks; b++)
     {
         struct coy_function_block_* block = &func->u.coy.blocks[b];
         block->offset = coy_memio_read32le_(memio);
         block->nparams = coy_memio_read32le_(memio);
         uint32_t nptrs = coy_memio_read32le_(memio);
-        if(!memio->ok) return false;
-        block->ptrs = NULL;
+        if(!memio->ok || !coy_function_can_read_(memio, nptrs, sizeof(uint32_t))) return false;
         stbds_arrsetlen(block->ptrs, nptrs);
-        for(uint32_t p = 0; p < nptrs; p++)
-            block->ptrs[p] = coy_memio_read32le_(memio);
-        if(!memio->ok) return false;
+        if(!coy_memio_read32le_array_(memio, block->ptrs, nptrs)) return false;
     }
     if(!memio->ok) return false;
     return true;
 }
-static bool coy_function_read_instrs_(struct coy_function_* func, struct coy_memio_* memio)
+static bool coy_function_read_instrs_(struct coy_function_* func, struct coy_memio_* memio, uint8_t* mapped)
 {
     uint32_t ninstrs = coy_memio_read32le_(memio);
-    if(!memio->ok) return false;
-    func->u.coy.instrs = NULL;
+    if(!memio->ok || !coy_function_can_read_(memio, ninstrs, sizeof(uint32_t))) return false;
+    func->u.coy.ninstrs = ninstrs;
+    if(mapped)
+    {
+        func->u.coy.instrs = (union coy_instruction_*)(mapped + memio->pos);
+        memio->pos += (size_t)ninstrs * sizeof(uint32_t);
+        return true;
+    }
     stbds_arrsetlen(func->u.coy.instrs, ninstrs);
+    // TODO: parse this correctly (because the bitfield might have a different order!)
+    return coy_memio_read32le_array_(memio, (uint32_t*)func->u.coy.instrs, ninstrs);
+}
+
+static void coy_function_write_consts_(const struct coy_function_* func, uint8_t** data)
+{
+    const struct coy_function_constants_* consts = &func->u.coy.consts;
+    coy_memio_write32le_(data, consts->nsymbols);
+    coy_memio_write32le_(data, consts->nrefs);
+    coy_memio_write32le_(data, consts->count - consts->nsymbols - consts->nrefs);
+    coy_memio_write32le_(data, 0);
+    // symbols are written at the very end (see `coy_function_write_symbols_`), so their offsets are filled in later
+    for(uint32_t s = 0; s < consts->nsymbols; s++)
+    {
+        coy_memio_write32le_(data, 0);
+        coy_memio_write32le_(data, ((const struct coy_istring_*)consts->data[s].ptr)->len);
+    }
+    // (symbol slots are left zero; they are filled in when loading)
+    for(uint32_t c = 0; c < consts->count; c++)
+    {
+        coy_memio_write64le_(data, c < consts->nsymbols ? 0 : consts->data[c].u64);
+        coy_memio_write64le_(data, 0);
+    }
+}
+static void coy_function_write_blocks_(const struct coy_function_* func, uint8_t** data)
+{
+    uint32_t nblocks = stbds_arrlenu(func->u.coy.blocks);
+    coy_memio_write32le_(data, nblocks);
+    for(uint32_t b = 0; b < nblocks; b++)
+    {
+        const struct coy_function_block_* block = &func->u.coy.blocks[b];
+        coy_memio_write32le_(data, block->offset);
+        coy_memio_write32le_(data, block->nparams);
+        coy_memio_write32le_(data, stbds_arrlenu(block->ptrs));
+        for(size_t p = 0; p < stbds_arrlenu(block->ptrs); p++)
+            coy_memio_write32le_(data, block->ptrs[p]);
+    }
+}
+static void coy_function_write_instrs_(const struct coy_function_* func, uint8_t** data)
+{
+    uint32_t ninstrs = func->u.coy.ninstrs;
+    coy_memio_write32le_(data, ninstrs);
     for(uint32_t i = 0; i < ninstrs; i++)
-        // TODO: parse this correctly (because the bitfield might have a different order!)
-        func->u.coy.instrs[i].raw = coy_memio_read32le_(memio);
-    if(!memio->ok) return false;
-    return true;
+        coy_memio_write32le_(data, func->u.coy.instrs[i].raw);
+}
+static void coy_function_write_symbols_(const struct coy_function_* func, uint8_t** data, size_t base)
+{
+    for(uint32_t s = 0; s < func->u.coy.consts.nsymbols; s++)
+    {
+        const struct coy_istring_* sym = func->u.coy.consts.data[s].ptr;
+        coy_memio_align_(data, sizeof(uint32_t));
+        // (the symbol table follows the 16-byte constants header)
+        coy_memio_patch32le_(*data, base + 16 + s * 8, stbds_arrlenu(*data) - base);
+        coy_memio_write32le_(data, sym->len);
+        coy_memio_write_(data, sym->str, sym->len);
+    }
 }
 static void coy_function_compute_maxslots_(struct coy_function_* func)
 {
@@ -163,7 +194,7 @@ static void coy_function_compute_maxslots_(struct coy_function_* func)
     for(uint32_t b = 0; b < nblocks; b++)
     {
         uint32_t coffset = func->u.coy.blocks[b+0].offset;
-        uint32_t noffset = b + 1 < nblocks ? func->u.coy.blocks[b+1].offset : stbds_arrlenu(func->u.coy.instrs);
+        uint32_t noffset = b + 1 < nblocks ? func->u.coy.blocks[b+1].offset : func->u.coy.ninstrs;
         uint32_t cslots = func->u.coy.blocks[b+0].nparams + (noffset - coffset);
         if(maxslots < cslots)
             maxslots = cslots;
@@ -181,8 +212,11 @@ static void coy_function_compute_maxslots_(struct coy_function_* func)
     } while(0)
 #define COY_VERIFY_(test, ...)  do { if(!(test)) COY_VERIFY_FAIL_(__VA_ARGS__); } while(0)
 #define COY_VERIFY_ARGIDX_(A)   COY_VERIFY_((A) < block->nparams + i, "argument tries to read from a future value %u", (A))
-#define COY_VERIFY_REGVAL_(I)   COY_VERIFY_(!coy_bitarray_get(&isptr, block->nparams + (I)), "register %u: expected value type, found reference", (I))
-#define COY_VERIFY_REGREF_(I)   COY_VERIFY_(coy_bitarray_get(&isptr, block->nparams + (I)), "register %u: expected reference type, found value", (I))
+// (`isptr` is indexed by register, i.e. relative to `fp`; the result of instruction `i` is register `nparams + i`)
+#define COY_VERIFY_REGVAL_(R)   COY_VERIFY_(!coy_bitarray_get(&isptr, (R)), "register %u: expected value type, found reference", (R))
+#define COY_VERIFY_REGREF_(R)   COY_VERIFY_(coy_bitarray_get(&isptr, (R)), "register %u: expected reference type, found value", (R))
+#define COY_VERIFY_RESVAL_(I)   COY_VERIFY_REGVAL_(block->nparams + (I))
+#define COY_VERIFY_RESREF_(I)   COY_VERIFY_REGREF_(block->nparams + (I))
 #define COY_VERIFY_ARGIDXA_(A)   COY_VERIFY_ARGIDX_(instr[1+(A)].arg.index)
 #define COY_VERIFY_REGVALA_(A)  \
     do {                        \
@@ -212,13 +246,13 @@ static bool coy_function_verify_jmp_block_(struct coy_function_* func, const str
     const struct coy_function_block_* jmpblock = &func->u.coy.blocks[jmpb];
     COY_VERIFY_(anum == jmpblock->nparams, "invalid number of arguments for target block");
     coy_bitarray_clear(&jmpisptr);
-    // populate `jmpisptr` for check
-    for(size_t p = 0; p < stbds_arrlenu(block[0].ptrs); p++)
+    // populate `jmpisptr` for check (the GC relies on the target's parameters being typed correctly)
+    for(size_t p = 0; p < stbds_arrlenu(jmpblock->ptrs); p++)
     {
         // we only check the parameters
-        if(block[0].ptrs[p] >= jmpblock->nparams)
+        if(jmpblock->ptrs[p] >= jmpblock->nparams)
             continue;
-        coy_bitarray_set(&jmpisptr, block[0].ptrs[p], true);
+        coy_bitarray_set(&jmpisptr, jmpblock->ptrs[p], true);
     }
     // ... now check that argument types match
     for(uint32_t a = 0; a < anum; a++)
@@ -272,19 +306,52 @@ static bool coy_function_verify_jmpc_(struct coy_function_* func, const struct c
     if(!coy_function_verify_jmp_block_(func, block, instr, i, isptr, jmpisptr, jmpb_f, jmpargsep, instr->op.nargs)) return false;
     return true;
 }
+// only checks that register arguments are in range (the interpreter relies on this for unchecked register access)
+static bool coy_function_verify_argidx_(struct coy_function_* func, const struct coy_function_block_* block, const union coy_instruction_* instr, uint32_t i)
+{
+    for(uint32_t a = 0; a < instr->op.nargs; a++)
+        if(!instr[1+a].arg.isconst)
+            COY_VERIFY_ARGIDXA_(a);
+    return true;
+}
+// returns the callee of a call if it is known statically (a linked symbol constant, other than a stub), or NULL otherwise
+static const struct coy_function_* coy_function_verify_callee_(const struct coy_function_* func, const union coy_instruction_* instr)
+{
+    union coy_instruction_ callee = instr[1];
+    if(!callee.arg.isconst || func->u.coy.consts.nsymbols <= callee.arg.index)
+        return NULL;
+    const struct coy_function_* target = func->u.coy.consts.data[callee.arg.index].ptr;
+    return target && !(target->attrib & COY_FUNCTION_ATTRIB_STUB_) ? target : NULL;
+}
 static bool coy_function_verify_call_(struct coy_function_* func, const struct coy_function_block_* block, const union coy_instruction_* instr, uint32_t i, coy_bitarray_t isptr, coy_bitarray_t jmpisptr)
 {
-    //COY_TODO("verify call");
+    if(!coy_function_verify_argidx_(func, block, instr, i)) return false;
+    // the GC trusts the block's `ptrs` for our result, so it has to match the callee's return type; for callees that are
+    // not known here, the interpreter checks this the first time that the call goes to them (see `coy_op_callsite_`)
+    const struct coy_function_* callee = coy_function_verify_callee_(func, instr);
+    if(callee && coy_function_returns_ref_(callee))
+        COY_VERIFY_RESREF_(i);
+    else if(callee)
+        COY_VERIFY_RESVAL_(i);
     return true;
 }
 static bool coy_function_verify_retcall_(struct coy_function_* func, const struct coy_function_block_* block, const union coy_instruction_* instr, uint32_t i, coy_bitarray_t isptr, coy_bitarray_t jmpisptr)
 {
-    //COY_TODO("verify retcall");
+    if(!coy_function_verify_argidx_(func, block, instr, i)) return false;
+    // (the callee's result goes to our caller, so it has to be of the same kind as ours; see `coy_function_verify_call_`)
+    const struct coy_function_* callee = coy_function_verify_callee_(func, instr);
+    COY_VERIFY_(!callee || coy_function_returns_ref_(callee) == coy_function_returns_ref_(func), "retcall: callee's return type does not match the caller's");
     return true;
 }
 static bool coy_function_verify_ret_(struct coy_function_* func, const struct coy_function_block_* block, const union coy_instruction_* instr, uint32_t i, coy_bitarray_t isptr, coy_bitarray_t jmpisptr)
 {
-    // TODO: use typeinfo to verify that arg is correct (0 args for void, 1 val for val func, 1 ref for ref func)
+    // TODO: use typeinfo to verify the number of results (0 args for void, 1 for anything else)
+    if(!coy_function_verify_argidx_(func, block, instr, i)) return false;
+    // (the caller's result register is a GC root if we return a reference; see `coy_function_verify_call_`)
+    if(instr->op.nargs && coy_function_returns_ref_(func))
+        COY_VERIFY_REGREFA_(0);
+    else if(instr->op.nargs)
+        COY_VERIFY_REGVALA_(0);
     return true;
 }
 
@@ -328,7 +395,7 @@ static bool coy_function_coy_verify_(struct coy_function_* func)
     COY_VERIFY_(func->u.coy.is_linked || !func->u.coy.consts.nsymbols, "function must be linked before use");
 
     uint32_t nblocks = stbds_arrlenu(func->u.coy.blocks);
-    uint32_t ninstrs = stbds_arrlenu(func->u.coy.instrs);
+    uint32_t ninstrs = func->u.coy.ninstrs;
     coy_bitarray_t isptr;
     coy_bitarray_init(&isptr);
     coy_bitarray_setlen(&isptr, func->u.coy.maxslots);
@@ -359,7 +426,7 @@ static bool coy_function_coy_verify_(struct coy_function_* func)
 
         coy_bitarray_clear(&isptr);
         for(size_t p = 0; p < stbds_arrlenu(block->ptrs); p++)
-            coy_bitarray_set(&isptr, block->nparams + block->ptrs[p], true);
+            coy_bitarray_set(&isptr, block->ptrs[p], true);
 
         const union coy_instruction_* instrs = &func->u.coy.instrs[block->offset];
         for(uint32_t i = 0; i < length; i += 1 + instrs[i].op.nargs)
@@ -373,8 +440,8 @@ static bool coy_function_coy_verify_(struct coy_function_* func)
                 COY_VERIFY_(opinfo->islast, "function block ends with invalid instruction");
             }
             if(!opinfo->verify(func, block, instr, i, isptr, jmpisptr)) return false;
-            if(opinfo->iref > 0) COY_VERIFY_REGREF_(i);
-            else if(opinfo->iref == 0) COY_VERIFY_REGVAL_(i);
+            if(opinfo->iref > 0) COY_VERIFY_RESREF_(i);
+            else if(opinfo->iref == 0) COY_VERIFY_RESVAL_(i);
             //else {} // we don't verify for iref<0 ("don't care" value)
         }
     }
@@ -395,19 +462,27 @@ struct coy_function_* coy_function_init_empty_(struct coy_function_* func, const
     {
         func->u.coy.consts.nrefs = 0;
         func->u.coy.consts.nsymbols = 0;
+        func->u.coy.consts.count = 0;
         func->u.coy.consts.data = NULL;
         func->u.coy.blocks = NULL;
         func->u.coy.instrs = NULL;
+        func->u.coy.ninstrs = 0;
+        func->u.coy.dcode = NULL;
         func->u.coy.maxslots = 0;
         func->u.coy.is_linked = false;
+        func->u.coy.is_mapped = false;
     }
     return func;
 }
-struct coy_function_* coy_function_init_data_(struct coy_function_* func, const struct coy_typeinfo_* type, uint32_t attrib, const void* data, size_t datalen)
+static struct coy_function_* coy_function_init_data_impl_(struct coy_function_* func, struct coy_env* env, const struct coy_typeinfo_* type, uint32_t attrib, const void* data, size_t datalen, uint8_t* mapped)
 {
     if(!coy_function_init_empty_(func, type, attrib)) return NULL;
     if(!COY_ENSURE(!(attrib & COY_FUNCTION_ATTRIB_NATIVE_), "misuse: cannot create a Coyote function with a `native` attribute"))
         return NULL;
+    // the in-place data must be suitably aligned for the constants; if it is not, fall back to copying
+    if(mapped && (!COY_FUNCTION_MAPPABLE_ || (uintptr_t)mapped % sizeof(uint64_t)))
+        mapped = NULL;
+    func->u.coy.is_mapped = mapped != NULL;
 
     struct coy_memio_ memio = {
         .data = data,
@@ -415,12 +490,53 @@ struct coy_function_* coy_function_init_data_(struct coy_function_* func, const
         .len = datalen,
         .ok = true,
     };
-    if(!coy_function_read_consts_(func, &memio)) COY_TODO("free memory on error");
-    if(!coy_function_read_blocks_(func, &memio)) COY_TODO("free memory on error");
-    if(!coy_function_read_instrs_(func, &memio)) COY_TODO("free memory on error");
+    if(!coy_function_read_consts_(func, env, &memio, mapped)
+    || !coy_function_read_blocks_(func, &memio)
+    || !coy_function_read_instrs_(func, &memio, mapped))
+        goto error;
     coy_function_compute_maxslots_(func);
-    if(!coy_function_coy_verify_(func)) COY_TODO("free memory on error");
     return func;
+error:
+    coy_function_deinit_(func);
+    return NULL;
+}
+struct coy_function_* coy_function_init_data_(struct coy_function_* func, struct coy_env* env, const struct coy_typeinfo_* type, uint32_t attrib, const void* data, size_t datalen)
+{
+    return coy_function_init_data_impl_(func, env, type, attrib, data, datalen, NULL);
+}
+struct coy_function_* coy_function_init_mapped_(struct coy_function_* func, struct coy_env* env, const struct coy_typeinfo_* type, uint32_t attrib, void* data, size_t datalen)
+{
+    return coy_function_init_data_impl_(func, env, type, attrib, data, datalen, data);
+}
+bool coy_function_write_data_(const struct coy_function_* func, uint8_t** data)
+{
+    if(!COY_ENSURE(!(func->attrib & COY_FUNCTION_ATTRIB_NATIVE_), "misuse: cannot serialize a `native` function"))
+        return false;
+    if(!COY_ENSURE(!func->u.coy.is_linked, "misuse: cannot serialize a function after it has been linked"))
+        return false;
+    if(func->u.coy.consts.nrefs)
+        return false;   //< TODO: saving reference constants
+    size_t base = stbds_arrlenu(*data);
+    coy_function_write_consts_(func, data);
+    coy_function_write_blocks_(func, data);
+    coy_function_write_instrs_(func, data);
+    coy_function_write_symbols_(func, data, base);
+    return true;
+}
+void coy_function_deinit_(struct coy_function_* func)
+{
+    if(!func || func->attrib & COY_FUNCTION_ATTRIB_NATIVE_)
+        return;
+    coy_function_free_dcode_(func);
+    if(!func->u.coy.is_mapped)
+    {
+        stbds_arrfree(func->u.coy.consts.data);
+        stbds_arrfree(func->u.coy.instrs);
+    }
+    for(size_t b = 0; b < stbds_arrlenu(func->u.coy.blocks); b++)
+        stbds_arrfree(func->u.coy.blocks[b].ptrs);
+    stbds_arrfree(func->u.coy.blocks);
+    coy_function_init_empty_(func, func->type, func->attrib);
 }
 struct coy_function_* coy_function_init_native_(struct coy_function_* func, const struct coy_typeinfo_* type, uint32_t attrib, coy_c_function_t* handler, void* udata)
 {
@@ -440,6 +556,27 @@ void coy_function_coy_compute_maxslots_(struct coy_function_* func)
         return;
     coy_function_compute_maxslots_(func);
 }
+bool coy_function_returns_ref_(const struct coy_function_* func)
+{
+    const struct coy_typeinfo_* type = func->type;
+    if(!type || type->category != COY_TYPEINFO_CAT_FUNCTION_ || !type->u.function.rtype)
+        return false;
+    switch(type->u.function.rtype->category)
+    {
+    case COY_TYPEINFO_CAT_ARRAY_:
+    case COY_TYPEINFO_CAT_FUNCTION_:
+        return true;
+    default:
+        return false;
+    }
+}
+bool coy_function_block_isptr_(const struct coy_function_block_* block, uint32_t reg)
+{
+    for(size_t p = 0; p < stbds_arrlenu(block->ptrs); p++)
+        if(block->ptrs[p] == reg)
+            return true;
+    return false;
+}
 bool coy_function_verify_(struct coy_function_* func)
 {
     COY_VERIFY_(func->type, "function must have a type");
@@ -448,8 +585,36 @@ bool coy_function_verify_(struct coy_function_* func)
         COY_VERIFY_(func->u.nat.handler, "native function is missing a handler");
         return true;
     }
-    else
-        return coy_function_coy_verify_(func);
+    if(!coy_function_coy_verify_(func))
+        return false;
+    // verified functions get decoded eagerly, so that the first call does not have to pay for it
+    if(!coy_function_decode_(func))
+        return false;
+    // (contexts that are already running the function may still see it as unverified, which only means checked execution)
+    COY_ATOMIC_STORE_RELEASE(&func->u.coy.dcode->verified, true);
+    return true;
+}
+// looks up "<module>;<member>" (both halves must have been interned already, if they name anything at all)
+static struct coy_function_* coy_function_resolve_symbol_(struct coy_env* env, const struct coy_istring_* fullsym)
+{
+    const char* module_end = memchr(fullsym->str, ';', fullsym->len);
+    if(!COY_ENSURE(module_end, "symbols must have format <module>;<member>, found `%s` instead", fullsym->str))
+        return NULL;
+    size_t module_len = module_end - fullsym->str;
+    const struct coy_istring_* module_name = coy_strpool_find_(&env->strings, fullsym->str, module_len);
+    struct coy_module_* symmod = module_name ? coy_env_find_module_istr_(env, module_name) : NULL;
+    if(!COY_ENSURE(symmod, "symbol %s not found (module does not exist)", fullsym->str))
+        return NULL;
+    const struct coy_istring_* member_name = coy_strpool_find_(&env->strings, module_end + 1, fullsym->len - module_len - 1u);
+    struct coy_module_symbol_* sym = member_name ? coy_module_find_symbol_istr_(symmod, member_name) : NULL;
+    if(!COY_ENSURE(sym, "symbol %s not found (symbol does not exist in module)", fullsym->str))
+        return NULL;
+    if(sym->category != COY_MODULE_SYMCAT_FUNCTION_)
+        COY_TODO("linking non-functions");
+    COY_ASSERT(stbds_arrlenu(sym->u.functions));
+    if(stbds_arrlenu(sym->u.functions) > 1)
+        COY_TODO("linking with function overloading");
+    return sym->u.functions[0];
 }
 bool coy_function_link_(struct coy_function_* func, struct coy_module_* module)
 {
@@ -457,40 +622,44 @@ bool coy_function_link_(struct coy_function_* func, struct coy_module_* module)
         return true;    //< linking always succeeds for native functions
     if(func->u.coy.is_linked)
         return true;    //< function was already linked; we'll consider that a success (TODO: relink?)
-    char* buf = NULL;
+    // (resolved symbols are only written once all of them have been, so that a failed link can be retried)
+    struct coy_function_** targets = NULL;
+    stbds_arrsetlen(targets, func->u.coy.consts.nsymbols);
     for(size_t c = 0; c < func->u.coy.consts.nsymbols; c++)
     {
-        const char* fullsym = func->u.coy.consts.data[c].ptr;
-        const char* module_end = strchr(fullsym, ';');
-        if(!COY_ENSURE(module_end, "symbols must have format <module>;<member>, found `%s` instead", fullsym))
+        const struct coy_istring_* fullsym = func->u.coy.consts.data[c].ptr;
+        targets[c] = module->env->link_lazily ? coy_env_get_stub_(module->env, fullsym) : coy_function_resolve_symbol_(module->env, fullsym);
+        if(!targets[c])
         {
-            stbds_arrfree(buf);
+            stbds_arrfree(targets);
             return false;
         }
-        stbds_arrsetlen(buf, module_end - fullsym + 1);
-        memcpy(buf, fullsym, module_end - fullsym);
-        buf[module_end - fullsym] = 0;
-
-        struct coy_module_* symmod = coy_env_find_module_(module->env, buf);
-        if(!COY_ENSURE(symmod, "symbol %s not found (module does not exist)", fullsym))
-        {
-            stbds_arrfree(buf);
-            return false;
-        }
-        struct coy_module_symbol_* sym = coy_module_find_symbol_(symmod, module_end + 1);
-        if(!COY_ENSURE(sym, "symbol %s not found (symbol does not exist in module)", fullsym))
-        {
-            stbds_arrfree(buf);
-            return false;
-        }
-        if(sym->category != COY_MODULE_SYMCAT_FUNCTION_)
-            COY_TODO("linking non-functions");
-        COY_ASSERT(stbds_arrlenu(sym->u.functions));
-        if(stbds_arrlenu(sym->u.functions) > 1)
-            COY_TODO("linking with function overloading");
-        func->u.coy.consts.data[c].ptr = sym->u.functions[0];
     }
-    stbds_arrfree(buf);
+    for(size_t c = 0; c < func->u.coy.consts.nsymbols; c++)
+        func->u.coy.consts.data[c].ptr = targets[c];
+    stbds_arrfree(targets);
     func->u.coy.is_linked = true;
     return true;
 }
+struct coy_function_* coy_function_init_stub_(struct coy_function_* func, const struct coy_istring_* symbol)
+{
+    if(!func) return NULL;
+    func->type = NULL;  //< (not known until resolved)
+    func->u.stub.symbol = symbol;
+    func->u.stub.target = NULL;
+    func->attrib = COY_FUNCTION_ATTRIB_STUB_;
+    return func;
+}
+struct coy_function_* coy_function_resolve_stub_(struct coy_env* env, struct coy_function_* stub)
+{
+    COY_ASSERT(stub->attrib & COY_FUNCTION_ATTRIB_STUB_);
+    // (shared by all constants with the same symbol, so each one is only looked up once; contexts on other threads may
+    // resolve it at the same time, which is harmless, since they get the same target)
+    struct coy_function_* target = COY_ATOMIC_LOAD_ACQUIRE(&stub->u.stub.target);
+    if(!target)
+    {
+        target = coy_function_resolve_symbol_(env, stub->u.stub.symbol);
+        COY_ATOMIC_STORE_RELEASE(&stub->u.stub.target, target);
+    }
+    return target;
+}
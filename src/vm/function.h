@@ -6,9 +6,14 @@
 #include <stdbool.h>
 
 #define COY_FUNCTION_ATTRIB_NATIVE_ UINT32_C(0x00000001)
+// an unresolved symbol, which lazily linked functions call through (see `coy_function_link_`); never called itself
+#define COY_FUNCTION_ATTRIB_STUB_   UINT32_C(0x00000002)
 
+struct coy_env;
 struct coy_context;
 struct coy_module_;
+struct coy_istring_;
+struct coy_dcode_;
 
 typedef int32_t coy_c_function_t(struct coy_context* ctx, void* udata);
 
@@ -37,10 +42,11 @@ union coy_instruction_
 // Order *within* a group of constants is arbitrary.
 struct coy_function_constants_
 {
-    uint32_t nsymbols;  //< how many constants are symbols?
+    uint32_t nsymbols;  //< how many constants are symbols? (interned `struct coy_istring_*` "<module>;<member>" names, until linked)
     uint32_t nrefs;     //< how many constants are references?
     // (remaining constants are simple values)
-    union coy_register_* data;  //< constants themselves
+    uint32_t count;     //< how many constants are there in total?
+    union coy_register_* data;  //< constants themselves (an `stb_ds` array, unless the function `is_mapped`)
 };
 
 // this will eventually replace coy_function_
@@ -48,7 +54,7 @@ struct coy_function_block_
 {
     uint32_t offset;    //< offset to start of block (entry block must start at 0!)
     uint32_t nparams;   //< number of parameters
-    uint32_t* ptrs;     //< which registers are pointers?
+    uint32_t* ptrs;     //< which registers are pointers? (parameters, and results of the block's instructions; this is also the GC's stack map)
 };
 struct coy_function_
 {
@@ -59,9 +65,12 @@ struct coy_function_
         {
             struct coy_function_constants_ consts;
             struct coy_function_block_* blocks;
-            union coy_instruction_* instrs;
-            uint32_t maxslots: 31;  //< max number of stack slots used, in any block
+            union coy_instruction_* instrs;     //< (an `stb_ds` array, unless the function `is_mapped`)
+            uint32_t ninstrs;
+            struct coy_dcode_* dcode;   //< pre-decoded instructions (see `decode.h`); NULL if not yet decoded (published with a compare-and-swap)
+            uint32_t maxslots: 30;  //< max number of stack slots used, in any block
             uint32_t is_linked: 1;  //< was the function already linked?
+            uint32_t is_mapped: 1;  //< do `instrs` and `consts.data` point into a (mapped) module image, rather than being owned?
         } coy;
         struct
         {
@@ -69,17 +78,45 @@ struct coy_function_
             // user data (we had the space in the union, so might as well)
             void* udata;
         } nat;
+        struct
+        {
+            const struct coy_istring_* symbol;  //< "<module>;<member>"
+            struct coy_function_* target;       //< the function that `symbol` resolved to, or NULL if not yet resolved
+        } stub;
     } u;
     uint32_t attrib;
 };
 
-// NOTE: `data` is assumed to be uint64_t-aligned
+// NOTE: `data` is assumed to be uint64_t-aligned; like built functions, these need to be linked and verified before use
 struct coy_function_* coy_function_init_empty_(struct coy_function_* func, const struct coy_typeinfo_* type, uint32_t attrib);
-struct coy_function_* coy_function_init_data_(struct coy_function_* func, const struct coy_typeinfo_* type, uint32_t attrib, const void* data, size_t datalen);
+// symbol constants are interned in `env` (as are those of built functions; see `coy_function_builder_init_`)
+struct coy_function_* coy_function_init_data_(struct coy_function_* func, struct coy_env* env, const struct coy_typeinfo_* type, uint32_t attrib, const void* data, size_t datalen);
+/*
+Like `coy_function_init_data_`, but instructions and constants are used in place where the host's layout matches (so `data`
+must outlive the function); only the symbol slots are written to (when loading, and again when linking), so for a private
+writable mapping, only the pages that contain them get copied.
+*/
+struct coy_function_* coy_function_init_mapped_(struct coy_function_* func, struct coy_env* env, const struct coy_typeinfo_* type, uint32_t attrib, void* data, size_t datalen);
 struct coy_function_* coy_function_init_native_(struct coy_function_* func, const struct coy_typeinfo_* type, uint32_t attrib, coy_c_function_t* handler, void* udata);
+// appends `func` to `data` (an `stb_ds` array), in the format read by `coy_function_init_data_`; the function must not have been linked yet
+bool coy_function_write_data_(const struct coy_function_* func, uint8_t** data);
+// frees the function's code (but not its symbol constants, which it does not own)
+void coy_function_deinit_(struct coy_function_* func);
 
 void coy_function_coy_compute_maxslots_(struct coy_function_* func);
+// does `func` return a reference (per its type)? false if that is not known, so that unknown results never become GC roots
+bool coy_function_returns_ref_(const struct coy_function_* func);
+// does register `reg` of `block` hold a pointer?
+bool coy_function_block_isptr_(const struct coy_function_block_* block, uint32_t reg);
 bool coy_function_verify_(struct coy_function_* func);
+/*
+Resolves the function's symbol constants. If the env links lazily (`coy_env_t.link_lazily`), they are only replaced by stubs
+here, which `call`/`retcall` resolve (and patch back into the constant) the first time they go through them; otherwise,
+they are resolved right away.
+*/
 bool coy_function_link_(struct coy_function_* func, struct coy_module_* module);
+struct coy_function_* coy_function_init_stub_(struct coy_function_* func, const struct coy_istring_* symbol);
+// returns the function that `stub` stands for, resolving it if this is the first time; NULL if it does not exist
+struct coy_function_* coy_function_resolve_stub_(struct coy_env* env, struct coy_function_* stub);
 
 #endif /* COY_VM_FUNCTION_H_ */
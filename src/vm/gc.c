@@ -1,91 +1,834 @@
+// needed for `clock_gettime` (we compile with `-std=c99`)
+#define _DEFAULT_SOURCE
 #include "gc.h"
+#include "context.h"
 #include "../typeinfo.h"
 #include "../util/debug.h"
 
 #include "stb_ds.h"
 #include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
 #include <limits.h>
 #include <inttypes.h>
+#include <time.h>
+#if COY_GC_PARALLEL_
+#include <pthread.h>
+#endif
+
+#define COY_GC_LARGE_CLASS_     UINT32_MAX
+#define COY_GC_BITS_PER_WORD_   (sizeof(size_t) * CHAR_BIT)
+// enough bits for a page of the smallest size class
+#define COY_GC_BITMAP_WORDS_    (COY_GC_PAGE_SIZE_ / 32u / COY_GC_BITS_PER_WORD_)
+// number of objects that `coy_gc_step_` scans between looking at the clock
+#define COY_GC_STEP_BATCH_      256u
+// number of times that `coy_gc_step_` rescans the roots within its budget, before it completes marking regardless
+#define COY_GC_MAX_RESCANS_     8u
 
 struct coy_gcobj_
 {
     const struct coy_typeinfo_* typeinfo;           // type information
-    size_t index : sizeof(size_t) * CHAR_BIT - 2;   //< index in set
-    size_t set : 2;                                 //< active set (2==thread root, 3==common root)
+    struct coy_gcpage_* page;                       //< page that the object lives in
 };
-struct coy_gc_* coy_gc_init_(struct coy_gc_* gc)
+struct coy_gcpage_
 {
-    if(!gc) return NULL;
-    for(size_t i = 0; i < sizeof(gc->sets) / sizeof(*gc->sets); i++)
-        gc->sets[i] = NULL;
-    gc->curset = 0;
-    return gc;
+    struct coy_gcpage_* next;
+    size_t cellsize;        //< size of each cell (including the object header)
+    uint32_t sclass;        //< size class, or `COY_GC_LARGE_CLASS_` for a large object's page
+    uint32_t ncells;
+    bool young;             //< were any cells allocated since the last collection?
+    size_t alloc[COY_GC_BITMAP_WORDS_];     //< which cells are allocated
+    size_t marks[COY_GC_BITMAP_WORDS_];     //< which cells are marked
+    size_t old[COY_GC_BITMAP_WORDS_];       //< which cells have survived a collection
+    size_t remembered[COY_GC_BITMAP_WORDS_];    //< which (old) cells are in the remembered set
+};
+#define COY_GC_PAGE_HEADER_SIZE_    ((sizeof(struct coy_gcpage_) + 15u) & ~(size_t)15u)
+#define COY_GC_PAGE_CELLS_(page)    ((char*)(page) + COY_GC_PAGE_HEADER_SIZE_)
+// a free cell links to the next free cell, and remembers its page (which a header is written from once allocated)
+struct coy_gcfree_
+{
+    struct coy_gcfree_* next;
+    struct coy_gcpage_* page;
+};
+// maps type information to its entry in `coy_gc_stats::types` (see `coy_gc_get_stats_`)
+struct coy_gc_type_index_
+{
+    const struct coy_typeinfo_* key;
+    size_t value;
+};
+// cell sizes (including the object header), in bytes; multiples of 16, to keep objects aligned
+static const uint32_t coy_gc_class_sizes_[COY_GC_NUM_CLASSES_] = {
+    32, 48, 64, 80, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048,
+};
+
+// monotonic wall-clock time, in nanoseconds (a pause is what the mutator waits for, however many threads do the work)
+static uint64_t coy_gc_now_ns_(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#else
+    return (uint64_t)clock() * 1000000000u / CLOCKS_PER_SEC;    //< (processor time, where there is no monotonic clock)
+#endif
 }
-void coy_gc_deinit_(struct coy_gc_* gc)
+static inline size_t coy_gc_cell_index_(const struct coy_gcobj_* obj)
 {
-    if(!gc) return;
-    // run all destructors
-    for(size_t s = 0; s < sizeof(gc->sets) / sizeof(*gc->sets); s++)
+    return ((const char*)obj - COY_GC_PAGE_CELLS_(obj->page)) / obj->page->cellsize;
+}
+static inline bool coy_gc_getbit_(const size_t* bitmap, size_t i)
+{
+    return !!(bitmap[i / COY_GC_BITS_PER_WORD_] & ((size_t)1 << (i % COY_GC_BITS_PER_WORD_)));
+}
+static inline void coy_gc_setbit_(size_t* bitmap, size_t i)
+{
+    bitmap[i / COY_GC_BITS_PER_WORD_] |= (size_t)1 << (i % COY_GC_BITS_PER_WORD_);
+}
+// sets a mark bit, returning whether it was set already (atomically, while marking in parallel)
+static inline bool coy_gc_testsetmark_(const struct coy_gc_* gc, size_t* bitmap, size_t i)
+{
+    size_t* word = &bitmap[i / COY_GC_BITS_PER_WORD_];
+    size_t mask = (size_t)1 << (i % COY_GC_BITS_PER_WORD_);
+#if COY_GC_PARALLEL_
+    if(gc->markers)
+        return !!(__atomic_fetch_or(word, mask, __ATOMIC_RELAXED) & mask);
+#endif
+    bool wasset = !!(*word & mask);
+    *word |= mask;
+    return wasset;
+}
+static inline uint32_t coy_gc_popcount_(size_t bits)
+{
+    uint32_t n = 0;
+    for(; bits; bits &= bits - 1u)
+        n++;
+    return n;
+}
+static inline void coy_gc_clearbit_(size_t* bitmap, size_t i)
+{
+    bitmap[i / COY_GC_BITS_PER_WORD_] &= ~((size_t)1 << (i % COY_GC_BITS_PER_WORD_));
+}
+
+// returns the smallest size class that fits `nbytes`, or `COY_GC_LARGE_CLASS_` if none does
+static uint32_t coy_gc_size_class_(size_t nbytes)
+{
+    for(uint32_t c = 0; c < COY_GC_NUM_CLASSES_; c++)
+        if(nbytes <= coy_gc_class_sizes_[c])
+            return c;
+    return COY_GC_LARGE_CLASS_;
+}
+static struct coy_gcpage_* coy_gc_new_page_(size_t cellsize, uint32_t sclass, uint32_t ncells)
+{
+    struct coy_gcpage_* page = malloc(COY_GC_PAGE_HEADER_SIZE_ + cellsize * ncells);
+    if(!page)
+        return NULL;
+    page->next = NULL;
+    page->cellsize = cellsize;
+    page->sclass = sclass;
+    page->ncells = ncells;
+    page->young = true;
+    memset(page->alloc, 0, sizeof(page->alloc));
+    memset(page->marks, 0, sizeof(page->marks));
+    memset(page->old, 0, sizeof(page->old));
+    memset(page->remembered, 0, sizeof(page->remembered));
+    return page;
+}
+static inline void coy_gc_push_free_cell_(struct coy_gc_* gc, struct coy_gcpage_* page, void* ptr)
+{
+    struct coy_gcfree_* cell = ptr;
+    cell->next = gc->freelists[page->sclass];
+    cell->page = page;
+    gc->freelists[page->sclass] = cell;
+}
+// puts the free cells of `page` onto the free list of its size class (in reverse, so that they get handed out in address order)
+static void coy_gc_free_page_cells_(struct coy_gc_* gc, struct coy_gcpage_* page, const size_t* cells_bitmap, bool cells_set)
+{
+    char* cells = COY_GC_PAGE_CELLS_(page);
+    for(uint32_t i = page->ncells; i-- > 0;)
     {
-        for(size_t i = 0; i < stbds_arrlenu(gc->sets[s]); i++)
+        if(coy_gc_getbit_(cells_bitmap, i) != cells_set)
+            continue;
+        coy_gc_push_free_cell_(gc, page, cells + i * page->cellsize);
+    }
+}
+static struct coy_gcobj_* coy_gc_alloc_cell_(struct coy_gc_* gc, uint32_t sclass, size_t nbytes)
+{
+    struct coy_gcpage_* page;
+    struct coy_gcobj_* obj;
+    if(sclass == COY_GC_LARGE_CLASS_)
+    {
+        page = coy_gc_new_page_(nbytes, sclass, 1);
+        if(!page)
+            return NULL;
+        page->next = gc->large;
+        gc->large = page;
+        obj = (struct coy_gcobj_*)COY_GC_PAGE_CELLS_(page);
+    }
+    else if(gc->bump[sclass] && gc->nbumped[sclass] < gc->bump[sclass]->ncells)
+    {
+        // fast path: bump allocation from a fresh page
+        page = gc->bump[sclass];
+        obj = (struct coy_gcobj_*)(COY_GC_PAGE_CELLS_(page) + gc->nbumped[sclass]++ * page->cellsize);
+    }
+    else if(gc->freelists[sclass])
+    {
+        struct coy_gcfree_* cell = gc->freelists[sclass];
+        gc->freelists[sclass] = cell->next;
+        page = cell->page;
+        obj = (struct coy_gcobj_*)cell;
+    }
+    else
+    {
+        size_t cellsize = coy_gc_class_sizes_[sclass];
+        page = coy_gc_new_page_(cellsize, sclass, (COY_GC_PAGE_SIZE_ - COY_GC_PAGE_HEADER_SIZE_) / cellsize);
+        if(!page)
+            return NULL;
+        page->next = gc->pages;
+        gc->pages = page;
+        gc->bump[sclass] = page;
+        gc->nbumped[sclass] = 1;
+        obj = (struct coy_gcobj_*)COY_GC_PAGE_CELLS_(page);
+    }
+    obj->page = page;
+    page->young = true;
+    coy_gc_setbit_(page->alloc, coy_gc_cell_index_(obj));
+    return obj;
+}
+// which cells of word `w` of `page` survive the current collection?
+static inline size_t coy_gc_survivors_(const struct coy_gc_* gc, const struct coy_gcpage_* page, size_t w)
+{
+    // in a minor collection, old objects are not marked, but they are live
+    return gc->minor ? page->alloc[w] & (page->marks[w] | page->old[w]) : page->alloc[w] & page->marks[w];
+}
+// calls `cb_dtor` (or `cb_free`, if `isfree`) on every allocated but unmarked object of `page`
+static void coy_gc_sweep_page_callbacks_(struct coy_gc_* gc, struct coy_gcpage_* page, bool isfree)
+{
+    if(gc->minor && !page->young)
+        return; //< (nothing to collect)
+    char* cells = COY_GC_PAGE_CELLS_(page);
+    for(size_t w = 0; w < (page->ncells + COY_GC_BITS_PER_WORD_ - 1) / COY_GC_BITS_PER_WORD_; w++)
+    {
+        size_t garbage = page->alloc[w] & ~coy_gc_survivors_(gc, page, w);
+        for(size_t b = 0; garbage; b++, garbage >>= 1)
         {
-            struct coy_gcobj_* obj = gc->sets[s][i];
-            if(obj->typeinfo->cb_dtor)
-                obj->typeinfo->cb_dtor(gc, obj + 1);
+            if(!(garbage & 1))
+                continue;
+            struct coy_gcobj_* obj = (struct coy_gcobj_*)(cells + (w * COY_GC_BITS_PER_WORD_ + b) * page->cellsize);
+            coy_gc_dtor_function_* cb = isfree ? obj->typeinfo->cb_free : obj->typeinfo->cb_dtor;
+            if(cb)
+                cb(gc, obj + 1);
         }
     }
-    // now free memory
-    for(size_t s = 0; s < sizeof(gc->sets) / sizeof(*gc->sets); s++)
+}
+// runs the callbacks for unmarked objects (destructors first, since they may still look at other garbage)
+static void coy_gc_sweep_callbacks_(struct coy_gc_* gc)
+{
+    for(int isfree = 0; isfree < 2; isfree++)
+    {
+        for(struct coy_gcpage_* page = gc->pages; page; page = page->next)
+            coy_gc_sweep_page_callbacks_(gc, page, isfree);
+        for(struct coy_gcpage_* page = gc->large; page; page = page->next)
+            coy_gc_sweep_page_callbacks_(gc, page, isfree);
+    }
+}
+// releases the unmarked cells of `page` (into `freed`), clears its mark bits, and makes the survivors old; returns whether the page ended up empty
+static bool coy_gc_sweep_page_bits_(struct coy_gc_* gc, struct coy_gcpage_* page, size_t* freed)
+{
+    bool empty = true;
+    size_t nfreed = 0;
+    for(size_t w = 0; w < COY_GC_BITMAP_WORDS_; w++)
     {
-        for(size_t i = 0; i < stbds_arrlenu(gc->sets[s]); i++)
+        size_t survivors = coy_gc_survivors_(gc, page, w);
+        freed[w] = page->alloc[w] & ~survivors;
+        nfreed += coy_gc_popcount_(freed[w]);
+        page->alloc[w] = survivors;
+        page->old[w] = survivors;
+        page->marks[w] = 0;
+        empty &= !survivors;
+    }
+    gc->counters.nbytes_live -= nfreed * page->cellsize;
+    page->young = false;
+    return empty;
+}
+/*
+Releases unmarked objects, clears the mark bits, and makes the survivors old, all at once; major collections are swept
+page by page instead (see `coy_gc_sweep_`), so apart from minor ones this only releases everything on deinitialization.
+A minor collection puts the freed cells onto the free lists directly; otherwise, pages that end up empty are released.
+*/
+static void coy_gc_sweep_pages_(struct coy_gc_* gc, struct coy_gcpage_** list)
+{
+    while(*list)
+    {
+        struct coy_gcpage_* page = *list;
+        if(gc->minor && !page->young)
+        {
+            list = &page->next;
+            continue;
+        }
+        size_t freed[COY_GC_BITMAP_WORDS_];
+        if(coy_gc_sweep_page_bits_(gc, page, freed) && !gc->minor)
+        {
+            *list = page->next;
+            free(page);
+            continue;
+        }
+        if(gc->minor && page->sclass != COY_GC_LARGE_CLASS_)
+            coy_gc_free_page_cells_(gc, page, freed, true);
+        list = &page->next;
+    }
+}
+/*
+Sweeps a major collection, one page at a time, until `deadline` (if `budgeted`; at least one page is done either way);
+returns whether any pages are left. Destructors run for all garbage before anything is released, since they may still
+look at other garbage; then each page is released if it ended up empty, or its free cells go to the free lists.
+*/
+static bool coy_gc_sweep_(struct coy_gc_* gc, bool budgeted, uint64_t deadline)
+{
+    while(gc->sweeping)
+    {
+        if(gc->sweep_dtors)
+        {
+            struct coy_gcpage_* page = gc->sweep_cursor;
+            coy_gc_sweep_page_callbacks_(gc, page, false);
+            gc->sweep_cursor = page->next || page->sclass == COY_GC_LARGE_CLASS_ ? page->next : gc->unswept_large;
+            gc->sweep_dtors = !!gc->sweep_cursor;
+        }
+        else
         {
-            struct coy_gcobj_* obj = gc->sets[s][i];
-            if(obj->typeinfo->cb_free)
-                obj->typeinfo->cb_free(gc, obj + 1);
+            bool large = !gc->unswept;
+            struct coy_gcpage_** from = large ? &gc->unswept_large : &gc->unswept;
+            struct coy_gcpage_* page = *from;
+            *from = page->next;
+            coy_gc_sweep_page_callbacks_(gc, page, true);
+            size_t freed[COY_GC_BITMAP_WORDS_];
+            if(coy_gc_sweep_page_bits_(gc, page, freed))
+                free(page);
+            else
+            {
+                struct coy_gcpage_** list = large ? &gc->large : &gc->pages;
+                page->next = *list;
+                *list = page;
+                if(!large)
+                    coy_gc_free_page_cells_(gc, page, page->alloc, false);
+            }
+            gc->sweeping = gc->unswept || gc->unswept_large;
         }
-        stbds_arrfree(gc->sets[s]);
+        if(budgeted && coy_gc_now_ns_() >= deadline)
+            break;
     }
+    return gc->sweeping;
+}
+struct coy_gc_* coy_gc_init_(struct coy_gc_* gc)
+{
+    if(!gc) return NULL;
+    gc->roots = NULL;
+    gc->markstack = NULL;
+    gc->remembered = NULL;
+    gc->pages = NULL;
+    gc->large = NULL;
+    for(size_t c = 0; c < COY_GC_NUM_CLASSES_; c++)
+    {
+        gc->freelists[c] = NULL;
+        gc->bump[c] = NULL;
+        gc->nbumped[c] = 0;
+    }
+    gc->nallocated = 0;
+    gc->nminor = 0;
+    gc->minor = false;
+    gc->marking = false;
+    gc->nrescans = 0;
+    gc->sweeping = false;
+    gc->sweep_dtors = false;
+    gc->unswept = NULL;
+    gc->unswept_large = NULL;
+    gc->sweep_cursor = NULL;
+    gc->nmarkers = 1;
+    gc->markers = NULL;
+    gc->threshold = COY_GC_DEFAULT_THRESHOLD_;
+    gc->cb_roots = NULL;
+    gc->udata = NULL;
+    memset(&gc->counters, 0, sizeof(gc->counters));
+    gc->counters.created = coy_gc_now_ns_();
+    return gc;
+}
+void coy_gc_deinit_(struct coy_gc_* gc)
+{
+    if(!gc) return;
+    // nothing is marked outside of a collection (the marks of an unfinished incremental one are dropped), so this runs all destructors, and then frees everything
+    if(gc->marking)
+    {
+        for(struct coy_gcpage_* page = gc->pages; page; page = page->next)
+            memset(page->marks, 0, sizeof(page->marks));
+        for(struct coy_gcpage_* page = gc->large; page; page = page->next)
+            memset(page->marks, 0, sizeof(page->marks));
+        gc->marking = false;
+    }
+    coy_gc_sweep_(gc, false, 0);
+    coy_gc_sweep_callbacks_(gc);
+    coy_gc_sweep_pages_(gc, &gc->pages);
+    coy_gc_sweep_pages_(gc, &gc->large);
+    COY_ASSERT(!gc->pages && !gc->large);
+    stbds_arrfree(gc->roots);
+    stbds_arrfree(gc->markstack);
+    stbds_arrfree(gc->remembered);
 }
 
 void* coy_gc_malloc_(struct coy_gc_* gc, size_t size, const struct coy_typeinfo_* typeinfo)
 {
-    char* gcobj = malloc(sizeof(struct coy_gcobj_) + size);
+    if(gc->nallocated >= gc->threshold)
+    {
+        if(gc->nminor < COY_GC_MINORS_PER_MAJOR_)
+            coy_gc_collect_minor_(gc);
+        else
+            coy_gc_collect_(gc);
+    }
+    size_t nbytes = sizeof(struct coy_gcobj_) + size;
+    uint32_t sclass = coy_gc_size_class_(nbytes);
+    struct coy_gcobj_* gcobj = coy_gc_alloc_cell_(gc, sclass, nbytes);
     if(!COY_ENSURE(gcobj, "failed to allocate %" PRIu64 " bytes", (uint64_t)size))
         return NULL;
-    struct coy_gcobj_** putset = gc->sets[!gc->curset];
-    struct coy_gcobj_ g = {
-        .typeinfo = typeinfo,
-        .index = stbds_arrlenu(putset),
-        .set = !gc->curset,  //< the object begins its life as unmarked
-    };
-    memcpy(gcobj, &g, sizeof(g));
-    stbds_arrput(putset, (struct coy_gcobj_*)gcobj);
-    gc->sets[!gc->curset] = putset;
-    return gcobj + sizeof(g);
+    gc->nallocated += gcobj->page->cellsize;
+    gc->counters.nbytes_allocated += gcobj->page->cellsize;
+    gc->counters.nobjects_allocated++;
+    gc->counters.nbytes_live += gcobj->page->cellsize;
+    if(gc->counters.nbytes_peak < gc->counters.nbytes_live)
+        gc->counters.nbytes_peak = gc->counters.nbytes_live;
+    // new objects start out unmarked, unless they are allocated in the middle of an incremental collection (then they are black)
+    gcobj->typeinfo = typeinfo;
+    if(gc->marking)
+        coy_gc_setbit_(gcobj->page->marks, coy_gc_cell_index_(gcobj));
+    return gcobj + 1;
 }
 
 void coy_gc_mark_(struct coy_gc_* gc, void* ptr)
 {
     if(!ptr) return;    // nothing to mark
-    struct coy_gcobj_* gcobj = (struct coy_gcobj_*)((char*)ptr - sizeof(struct coy_gcobj_));
-    if(gcobj->set >= 2) return; // it's a root or common (means: always marked)
-    if(gcobj->set == gc->curset) return;    // already marked
-    gcobj->set = gc->curset;
+    struct coy_gcobj_* gcobj = (struct coy_gcobj_*)ptr - 1;
+    size_t index = coy_gc_cell_index_(gcobj);
+    if(gc->minor && coy_gc_getbit_(gcobj->page->old, index)) return;    // old objects are live (and not traced) in a minor collection
+    if(coy_gc_testsetmark_(gc, gcobj->page->marks, index)) return;      // already marked
+
+    // children of this object are marked by `coy_gc_drain_` (objects without any do not need to go through the stack)
+    if(gcobj->typeinfo->cb_mark) stbds_arrput(gc->markstack, ptr);
+}
+void coy_gc_mark_dirty_(struct coy_gc_* gc, void* ptr)
+{
+    if(!ptr) return;
+    struct coy_gcobj_* gcobj = (struct coy_gcobj_*)ptr - 1;
+    size_t index = coy_gc_cell_index_(gcobj);
+    // (old objects must not be marked in a minor collection, since the marks of old pages are not cleared by it)
+    if(!gc->minor || !coy_gc_getbit_(gcobj->page->old, index))
+        coy_gc_testsetmark_(gc, gcobj->page->marks, index);
+    if(gcobj->typeinfo->cb_mark) stbds_arrput(gc->markstack, ptr);
+}
+void coy_gc_write_barrier_(struct coy_gc_* gc, void* ptr)
+{
+    struct coy_gcobj_* gcobj = (struct coy_gcobj_*)ptr - 1;
+    size_t index = coy_gc_cell_index_(gcobj);
+    // while marking incrementally, a black (or grey) object may not point to a white one; so it becomes grey (again)
+    if(gc->marking && coy_gc_getbit_(gcobj->page->marks, index) && gcobj->typeinfo->cb_mark)
+        stbds_arrput(gc->markstack, ptr);
+    // young objects get marked anyways; old ones only need to be remembered once (while sweeping, the marked objects on
+    // pages that were not swept yet are about to become old)
+    bool old = coy_gc_getbit_(gcobj->page->old, index) || (gc->sweeping && coy_gc_getbit_(gcobj->page->marks, index));
+    if(!old || coy_gc_getbit_(gcobj->page->remembered, index))
+        return;
+    coy_gc_setbit_(gcobj->page->remembered, index);
+    stbds_arrput(gc->remembered, ptr);
+}
+#if COY_GC_PARALLEL_
+// number of objects that a marker that ran out of work takes from the shared pool at once
+#define COY_GC_TAKE_CHUNK_      64u
+struct coy_gcmarkers_
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;    //< signalled when work is shared, or once marking is done
+    void** pool;            //< grey objects that were shared by a marker
+    size_t npool;           //< length of `pool` (also read without the lock)
+    uint32_t nmarkers;
+    uint32_t nidle;         //< markers that are waiting for work (also read without the lock)
+    bool done;
+};
+struct coy_gcmarker_
+{
+    struct coy_gc_ gc;      //< copy of the collector with a mark stack of its own (this is what `cb_mark` gets)
+    pthread_t thread;
+};
+// moves half of the marker's grey objects into the pool
+static void coy_gc_marker_share_(struct coy_gc_* gc)
+{
+    struct coy_gcmarkers_* markers = gc->markers;
+    size_t len = stbds_arrlenu(gc->markstack);
+    pthread_mutex_lock(&markers->mutex);
+    for(size_t i = len / 2; i < len; i++)
+        stbds_arrput(markers->pool, gc->markstack[i]);
+    __atomic_store_n(&markers->npool, stbds_arrlenu(markers->pool), __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&markers->cond);
+    pthread_mutex_unlock(&markers->mutex);
+    stbds_arrsetlen(gc->markstack, len / 2);
+}
+// takes grey objects from the pool, waiting until there are some; returns false once all markers ran out of work
+static bool coy_gc_marker_take_(struct coy_gc_* gc)
+{
+    struct coy_gcmarkers_* markers = gc->markers;
+    bool found = false;
+    pthread_mutex_lock(&markers->mutex);
+    for(;;)
+    {
+        size_t len = stbds_arrlenu(markers->pool);
+        if(len)
+        {
+            size_t n = len < COY_GC_TAKE_CHUNK_ ? len : COY_GC_TAKE_CHUNK_;
+            for(size_t i = len - n; i < len; i++)
+                stbds_arrput(gc->markstack, markers->pool[i]);
+            stbds_arrsetlen(markers->pool, len - n);
+            __atomic_store_n(&markers->npool, len - n, __ATOMIC_RELAXED);
+            found = true;
+            break;
+        }
+        if(markers->done)
+            break;
+        // (the last marker to go idle knows that nobody is left to share anything)
+        if(__atomic_add_fetch(&markers->nidle, 1, __ATOMIC_RELAXED) == markers->nmarkers)
+        {
+            markers->done = true;
+            pthread_cond_broadcast(&markers->cond);
+            break;
+        }
+        pthread_cond_wait(&markers->cond, &markers->mutex);
+        __atomic_sub_fetch(&markers->nidle, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&markers->mutex);
+    return found;
+}
+static void* coy_gc_marker_main_(void* udata)
+{
+    struct coy_gc_* gc = &((struct coy_gcmarker_*)udata)->gc;
+    struct coy_gcmarkers_* markers = gc->markers;
+    while(coy_gc_marker_take_(gc))
+    {
+        while(stbds_arrlenu(gc->markstack))
+        {
+            void* ptr = stbds_arrpop(gc->markstack);
+            const struct coy_gcobj_* gcobj = (const struct coy_gcobj_*)ptr - 1;
+            gcobj->typeinfo->cb_mark(gc, ptr);
+            if(stbds_arrlenu(gc->markstack) >= 2
+            && __atomic_load_n(&markers->nidle, __ATOMIC_RELAXED)
+            && !__atomic_load_n(&markers->npool, __ATOMIC_RELAXED))
+                coy_gc_marker_share_(gc);
+        }
+    }
+    return NULL;
+}
+// returns false if marking could not be parallelized (the caller should then mark by itself)
+static bool coy_gc_drain_parallel_(struct coy_gc_* gc)
+{
+    struct coy_gcmarker_* workers = malloc(gc->nmarkers * sizeof(struct coy_gcmarker_));
+    if(!workers)
+        return false;
+    struct coy_gcmarkers_ markers;
+    pthread_mutex_init(&markers.mutex, NULL);
+    pthread_cond_init(&markers.cond, NULL);
+    // all markers (including the collecting thread) start out by taking from the roots' grey objects
+    markers.pool = gc->markstack;
+    markers.npool = stbds_arrlenu(markers.pool);
+    markers.nmarkers = gc->nmarkers;
+    markers.nidle = 0;
+    markers.done = false;
+    gc->markstack = NULL;
 
-    // we do a move from uset ("unmarked set") to mset ("marked set")
-    struct coy_gcobj_** mset = gc->sets[gc->curset];
-    struct coy_gcobj_** uset = gc->sets[!gc->curset];
-    // remove from `uset` by assigning last item to current (& shortening array by 1)
-    stbds_arrdelswap(uset, gcobj->index);
-    if(stbds_arrlenu(uset)) uset[gcobj->index]->index = gcobj->index;
-    // insert into `mset` by appending at end
-    gcobj->index = stbds_arrlenu(mset);
-    stbds_arrput(mset, gcobj);
-    // stbds may have changed the ptrs
-    gc->sets[gc->curset] = mset;
-    gc->sets[!gc->curset] = uset;
+    uint32_t nstarted = 1;
+    for(uint32_t i = 0; i < gc->nmarkers; i++)
+    {
+        workers[i].gc = *gc;
+        workers[i].gc.markers = &markers;
+    }
+    for(; nstarted < gc->nmarkers; nstarted++)
+        if(pthread_create(&workers[nstarted].thread, NULL, coy_gc_marker_main_, &workers[nstarted]))
+            break;
+    if(nstarted < gc->nmarkers)
+    {
+        // (we could not start all threads; the ones that did start must not wait for the others)
+        pthread_mutex_lock(&markers.mutex);
+        markers.nmarkers = nstarted;
+        pthread_mutex_unlock(&markers.mutex);
+    }
+    coy_gc_marker_main_(&workers[0]);
+    for(uint32_t i = 1; i < nstarted; i++)
+        pthread_join(workers[i].thread, NULL);
+    for(uint32_t i = 0; i < gc->nmarkers; i++)
+        stbds_arrfree(workers[i].gc.markstack);
+    free(workers);
 
-    // recurse, to mark children of this object
-    if(gcobj->typeinfo->cb_mark) gcobj->typeinfo->cb_mark(gc, ptr);
+    gc->markstack = markers.pool;   //< (empty, but keeps its memory)
+    pthread_cond_destroy(&markers.cond);
+    pthread_mutex_destroy(&markers.mutex);
+    return true;
+}
+#endif
+// marks everything reachable from the mark stack
+static void coy_gc_drain_(struct coy_gc_* gc)
+{
+#if COY_GC_PARALLEL_
+    if(gc->nmarkers > 1 && stbds_arrlenu(gc->markstack) && coy_gc_drain_parallel_(gc))
+        return;
+#endif
+    while(stbds_arrlenu(gc->markstack))
+    {
+        void* ptr = stbds_arrpop(gc->markstack);
+        const struct coy_gcobj_* gcobj = (const struct coy_gcobj_*)ptr - 1;
+        gcobj->typeinfo->cb_mark(gc, ptr);
+    }
+}
+
+static void coy_gc_mark_roots_(struct coy_gc_* gc)
+{
+    for(size_t i = 0; i < stbds_arrlenu(gc->roots); i++)
+        coy_gc_mark_dirty_(gc, gc->roots[i]);
+    if(gc->cb_roots)
+        gc->cb_roots(gc, gc->udata);
+}
+// starts a collection, by marking the roots (their children are left on the mark stack)
+static void coy_gc_begin_(struct coy_gc_* gc, bool minor)
+{
+    gc->minor = minor;
+    // bump regions are given up (survivors make their pages fragmented), so their remaining cells go to the free lists
+    for(size_t c = 0; c < COY_GC_NUM_CLASSES_; c++)
+    {
+        struct coy_gcpage_* page = gc->bump[c];
+        if(!page) continue;
+        char* cells = COY_GC_PAGE_CELLS_(page);
+        for(uint32_t i = page->ncells; i-- > gc->nbumped[c];)
+            coy_gc_push_free_cell_(gc, page, cells + i * page->cellsize);
+        gc->bump[c] = NULL;
+    }
+    coy_gc_mark_roots_(gc);
+    // old objects that were written to may point to young ones
+    if(minor)
+        for(size_t i = 0; i < stbds_arrlenu(gc->remembered); i++)
+            coy_gc_mark_dirty_(gc, gc->remembered[i]);
+}
+/*
+Ends marking; a minor collection is swept right away, while the pages of a major one are set aside for `coy_gc_sweep_`.
+Its free lists are rebuilt from the pages as they are swept (so that they never hold cells of a released page), which
+also gives up the bump regions; allocations until then come from fresh pages.
+*/
+static void coy_gc_end_marking_(struct coy_gc_* gc)
+{
+    // everything is old now, so the remembered set starts out empty
+    for(size_t i = 0; i < stbds_arrlenu(gc->remembered); i++)
+    {
+        struct coy_gcobj_* gcobj = (struct coy_gcobj_*)gc->remembered[i] - 1;
+        coy_gc_clearbit_(gcobj->page->remembered, coy_gc_cell_index_(gcobj));
+    }
+    stbds_arrsetlen(gc->remembered, 0);
+    if(gc->minor)
+    {
+        // sweep: whatever is left unmarked and young is garbage
+        coy_gc_sweep_callbacks_(gc);
+        coy_gc_sweep_pages_(gc, &gc->pages);
+        coy_gc_sweep_pages_(gc, &gc->large);
+        gc->counters.nminor++;
+    }
+    else
+    {
+        for(size_t c = 0; c < COY_GC_NUM_CLASSES_; c++)
+        {
+            gc->freelists[c] = NULL;
+            gc->bump[c] = NULL;
+        }
+        gc->unswept = gc->pages;
+        gc->unswept_large = gc->large;
+        gc->pages = NULL;
+        gc->large = NULL;
+        gc->sweep_cursor = gc->unswept ? gc->unswept : gc->unswept_large;
+        gc->sweeping = gc->sweep_dtors = !!gc->sweep_cursor;
+        gc->counters.nmajor++;
+    }
+    gc->nminor = gc->minor ? gc->nminor + 1u : 0u;
+    gc->nallocated = 0;
+    gc->minor = false;
+    gc->marking = false;
+}
+// finishes marking
+static void coy_gc_finish_marking_(struct coy_gc_* gc)
+{
+    // stack segments and native slots are written to without a barrier, so an incremental collection needs to scan them again
+    if(gc->marking)
+        coy_gc_mark_roots_(gc);
+    coy_gc_drain_(gc);
+    coy_gc_end_marking_(gc);
+}
+/*
+Scans grey objects in batches until `deadline`, returning whether marking is complete. Once there are none left, the
+roots are scanned again (see `coy_gc_finish_marking_`); marking is complete when what that turns up is scanned within
+the same step. After `COY_GC_MAX_RESCANS_` attempts, that is done regardless of the budget, so that marking ends even
+if the mutator keeps greying objects faster than a step gets to scan them.
+*/
+static bool coy_gc_mark_step_(struct coy_gc_* gc, uint64_t deadline)
+{
+    bool rescanned = false;
+    for(;;)
+    {
+        while(stbds_arrlenu(gc->markstack))
+        {
+            for(uint32_t n = 0; n < COY_GC_STEP_BATCH_ && stbds_arrlenu(gc->markstack); n++)
+            {
+                void* ptr = stbds_arrpop(gc->markstack);
+                const struct coy_gcobj_* gcobj = (const struct coy_gcobj_*)ptr - 1;
+                gcobj->typeinfo->cb_mark(gc, ptr);
+            }
+            if(stbds_arrlenu(gc->markstack) && coy_gc_now_ns_() >= deadline && (!rescanned || gc->nrescans < COY_GC_MAX_RESCANS_))
+                return false;
+        }
+        if(rescanned)
+            break;
+        coy_gc_mark_roots_(gc);
+        gc->nrescans++;
+        rescanned = true;
+    }
+    coy_gc_end_marking_(gc);
+    return true;
+}
+// accounts for a pause (a collection, or an incremental step) that started at `start`
+static void coy_gc_end_pause_(struct coy_gc_* gc, uint64_t start)
+{
+    uint64_t pause = coy_gc_now_ns_() - start;
+    gc->counters.pause_total += pause;
+    if(gc->counters.pause_max < pause)
+        gc->counters.pause_max = pause;
+}
+static void coy_gc_collect_generation_(struct coy_gc_* gc, bool minor)
+{
+    uint64_t start = coy_gc_now_ns_();
+    // an incremental collection is already underway (and it is a major one); just complete it
+    if(!gc->sweeping)
+    {
+        if(!gc->marking)
+            coy_gc_begin_(gc, minor);
+        coy_gc_finish_marking_(gc);
+    }
+    coy_gc_sweep_(gc, false, 0);
+    coy_gc_end_pause_(gc, start);
+}
+void coy_gc_collect_(struct coy_gc_* gc)
+{
+    coy_gc_collect_generation_(gc, false);
+}
+void coy_gc_collect_minor_(struct coy_gc_* gc)
+{
+    coy_gc_collect_generation_(gc, true);
+}
+bool coy_gc_step_(struct coy_gc_* gc, uint32_t budget_us)
+{
+    uint64_t start = coy_gc_now_ns_();
+    uint64_t deadline = start + (uint64_t)budget_us * 1000u;
+    if(!gc->marking && !gc->sweeping)
+    {
+        if(!gc->nallocated)
+            return false;   //< (nothing to collect)
+        coy_gc_begin_(gc, false);
+        gc->marking = true;
+        gc->nrescans = 0;
+    }
+    if(gc->marking && !coy_gc_mark_step_(gc, deadline))
+    {
+        coy_gc_end_pause_(gc, start);
+        return true;
+    }
+    bool sweeping = coy_gc_sweep_(gc, true, deadline);
+    coy_gc_end_pause_(gc, start);
+    return sweeping;
+}
+
+void coy_gc_add_root_(struct coy_gc_* gc, void* ptr)
+{
+    stbds_arrput(gc->roots, ptr);
+}
+void coy_gc_remove_root_(struct coy_gc_* gc, void* ptr)
+{
+    for(size_t i = 0; i < stbds_arrlenu(gc->roots); i++)
+        if(gc->roots[i] == ptr)
+        {
+            stbds_arrdelswap(gc->roots, i);
+            return;
+        }
+    COY_ASSERT_MSG(false, "misuse: removing an object that is not a root");
+}
+
+// adds the allocated objects of `page` to the per-type breakdown (`index` maps type information to entries of `stats->types`)
+static void coy_gc_page_type_stats_(const struct coy_gcpage_* page, struct coy_gc_stats* stats, struct coy_gc_type_index_** index)
+{
+    const char* cells = COY_GC_PAGE_CELLS_(page);
+    for(uint32_t i = 0; i < page->ncells; i++)
+    {
+        if(!coy_gc_getbit_(page->alloc, i))
+            continue;
+        const struct coy_gcobj_* obj = (const struct coy_gcobj_*)(cells + i * page->cellsize);
+        ptrdiff_t t = stbds_hmgeti(*index, obj->typeinfo);
+        if(t < 0)
+        {
+            const struct coy_typeinfo_* ti = obj->typeinfo;
+            struct coy_gc_type_stats tstats = {
+                .repr = ti->repr ? ti->repr : ti->category == COY_TYPEINFO_CAT_INTERNAL_ ? ti->u.internal_name : "<?>",
+                .nobjects = 0,
+                .nbytes = 0,
+            };
+            stbds_hmput(*index, obj->typeinfo, stbds_arrlenu(stats->types));
+            stbds_arrput(stats->types, tstats);
+            t = stbds_hmgeti(*index, obj->typeinfo);
+        }
+        struct coy_gc_type_stats* tstats = &stats->types[(*index)[t].value];
+        tstats->nobjects++;
+        tstats->nbytes += page->cellsize;
+        stats->nobjects_live++;
+    }
+}
+static int coy_gc_type_stats_cmp_(const void* a, const void* b)
+{
+    const struct coy_gc_type_stats* ta = a;
+    const struct coy_gc_type_stats* tb = b;
+    return ta->nbytes < tb->nbytes ? 1 : ta->nbytes > tb->nbytes ? -1 : 0;
+}
+void coy_gc_get_stats_(struct coy_gc_* gc, struct coy_gc_stats* stats)
+{
+    const struct coy_gccounters_* counters = &gc->counters;
+    stats->nobjects_live = 0;
+    stats->nbytes_live = counters->nbytes_live;
+    stats->nbytes_peak = counters->nbytes_peak;
+    stats->nbytes_heap = 0;
+    stats->nbytes_allocated = counters->nbytes_allocated;
+    stats->nobjects_allocated = counters->nobjects_allocated;
+    uint64_t elapsed = coy_gc_now_ns_() - counters->created;
+    stats->alloc_rate = elapsed > 0 ? (double)counters->nbytes_allocated * 1e9 / elapsed : 0.0;
+    stats->ncollections_minor = counters->nminor;
+    stats->ncollections_major = counters->nmajor;
+    stats->gc_time_us = counters->pause_total / 1000u;
+    stats->max_pause_us = counters->pause_max / 1000u;
+
+    stats->types = NULL;
+    struct coy_gc_type_index_* index = NULL;
+    const struct coy_gcpage_* lists[] = {gc->pages, gc->large, gc->unswept, gc->unswept_large};
+    for(size_t l = 0; l < sizeof(lists) / sizeof(*lists); l++)
+        for(const struct coy_gcpage_* page = lists[l]; page; page = page->next)
+        {
+            stats->nbytes_heap += COY_GC_PAGE_HEADER_SIZE_ + page->cellsize * page->ncells;
+            coy_gc_page_type_stats_(page, stats, &index);
+        }
+    stbds_hmfree(index);
+    stats->ntypes = stbds_arrlenu(stats->types);
+    if(stats->ntypes)
+        qsort(stats->types, stats->ntypes, sizeof(struct coy_gc_type_stats), coy_gc_type_stats_cmp_);
+}
+bool coy_gc_stats(coy_context_t* ctx, struct coy_gc_stats* stats)
+{
+    if(!COY_ENSURE(stats, "misuse: `stats` must not be NULL"))
+        return false;
+    coy_gc_get_stats_(&ctx->gc, stats);
+    return true;
+}
+void coy_gc_stats_free(struct coy_gc_stats* stats)
+{
+    stbds_arrfree(stats->types);
+    stats->ntypes = 0;
 }
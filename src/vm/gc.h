@@ -3,24 +3,159 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 // Information for the garbage collector. This will be optimized at some point, but for now, let's do the easy thing.
+struct coy_gc_;
 struct coy_gcobj_;
 struct coy_typeinfo_;
 
-#define COY_GC_SET_ROOT_    2
-#define COY_GC_SET_COMMON_  3
+#ifndef COY_GC_DEFAULT_THRESHOLD_
+// number of bytes allocated (since the last collection) that triggers a new collection
+#define COY_GC_DEFAULT_THRESHOLD_   ((size_t)1 << 20)
+#endif
+
+// marks roots that are not GC objects themselves (e.g. the owning context's stack)
+typedef void coy_gc_roots_function_(struct coy_gc_* gc, void* udata);
+
+/*
+Small objects are allocated from pages of fixed-size cells (one size class per page); fresh pages are handed out with a bump
+pointer, and cells freed by the sweep via a free list per size class. Objects that do not fit into the largest class get
+a page of their own.
+
+Each page has a bitmap of allocated cells, and one of marked cells; marking an object only sets its bit, and sweeping
+walks the bitmaps page by page. Mark bits are only set during a collection.
+
+Collection is generational, without moving objects: everything that survives a collection becomes old (the page's `old`
+bitmap). A minor collection only marks young objects (anything allocated since the last collection), treating old
+objects as live; old objects that had pointers stored into them are found via the remembered set (see
+`coy_gc_write_barrier_`). Every `COY_GC_MINORS_PER_MAJOR_`th collection is a major (full) one.
+
+A major collection can also be run incrementally (see `coy_gc_step_`), with tri-colour marking: white objects are
+unmarked, grey ones are marked and on the mark stack, and black ones are marked and scanned. The write barrier turns a
+marked object grey again, and objects allocated while marking start out black. Roots (including the stack segments,
+which the interpreter writes to without a barrier) are scanned again once the grey objects run out. Major collections
+are then swept page by page, which an incremental one spreads across steps as well; pages are set aside until swept.
+
+Marking that is not incremental can be split across `nmarkers` threads (where supported, see `COY_GC_PARALLEL_`). Each
+marker drains a mark stack of its own, sharing half of it whenever another marker runs out of work; mark bits are then
+set atomically, so that every object is scanned only once.
+*/
+#define COY_GC_PAGE_SIZE_       ((size_t)64 << 10)
+#define COY_GC_NUM_CLASSES_     14
+#ifndef COY_GC_MINORS_PER_MAJOR_
+#define COY_GC_MINORS_PER_MAJOR_    8
+#endif
+#ifndef COY_GC_PARALLEL_
+#if defined(__unix__) && defined(__GNUC__)
+#define COY_GC_PARALLEL_    1
+#else
+#define COY_GC_PARALLEL_    0
+#endif
+#endif
+struct coy_gcpage_;
+struct coy_gcmarkers_;
+struct coy_context;
+
+// running totals behind `coy_gc_stats`; the allocator and collector only ever add to these, so they are always kept
+struct coy_gccounters_
+{
+    uint64_t nbytes_allocated;      //< bytes allocated in total (cell sizes, so including headers and rounding)
+    uint64_t nobjects_allocated;    //< objects allocated in total
+    size_t nbytes_live;             //< bytes in allocated cells (survivors of the last collection, and anything allocated since)
+    size_t nbytes_peak;             //< highest `nbytes_live` so far
+    uint32_t nminor;                //< number of minor collections
+    uint32_t nmajor;                //< number of major collections (including incremental ones)
+    uint64_t created;               //< (monotonic) time when the GC was initialized, in nanoseconds
+    uint64_t pause_total;           //< time spent in collections (and incremental steps), in nanoseconds
+    uint64_t pause_max;             //< longest single collection (or incremental step), in nanoseconds
+};
+
 struct coy_gc_
 {
-    struct coy_gcobj_** sets[3];
-    uint8_t curset : 1;
-    uint8_t : 7;
+    void** roots;                                   //< objects that are always live (see `coy_gc_add_root_`)
+    struct coy_gcpage_* pages;                      //< all pages of small objects, in a linked list
+    struct coy_gcpage_* large;                      //< all pages of large objects (one object each)
+    void* freelists[COY_GC_NUM_CLASSES_];           //< free cells, per size class (linked through their first word)
+    struct coy_gcpage_* bump[COY_GC_NUM_CLASSES_];  //< fresh page that cells are being bump-allocated from, per size class
+    uint32_t nbumped[COY_GC_NUM_CLASSES_];          //< number of cells of `bump` handed out so far
+    void** markstack;   //< marked objects whose children still need to be marked (kept between collections, to reuse memory)
+    void** remembered;  //< old objects that may point to young ones (since the last collection)
+    size_t nallocated;  //< bytes allocated since the last collection
+    size_t threshold;   //< collect once `nallocated` reaches this (tunable; `SIZE_MAX` disables automatic collection)
+    uint32_t nminor;    //< number of minor collections since the last major one
+    bool minor;         //< is the current collection a minor one?
+    bool marking;       //< is an incremental collection marking?
+    uint32_t nrescans;  //< number of times that the roots were scanned again, in the current incremental collection
+    bool sweeping;      //< is a major collection being swept? (only ever left unfinished by `coy_gc_step_`)
+    bool sweep_dtors;   //< are the destructors still being run (for `sweep_cursor` onwards)?
+    struct coy_gcpage_* unswept;        //< pages of small objects that have yet to be swept
+    struct coy_gcpage_* unswept_large;  //< pages of large objects that have yet to be swept
+    struct coy_gcpage_* sweep_cursor;   //< next page (of `unswept`, then `unswept_large`) to run destructors for
+    uint32_t nmarkers;  //< number of threads to mark with (tunable; 1 marks on the collecting thread only)
+    struct coy_gcmarkers_* markers;     //< state shared between markers, while marking in parallel (see `coy_gc_drain_`)
+    coy_gc_roots_function_* cb_roots;
+    void* udata;        //< passed to `cb_roots`
+    struct coy_gccounters_ counters;
 };
 
 struct coy_gc_* coy_gc_init_(struct coy_gc_* gc);
 void coy_gc_deinit_(struct coy_gc_* gc);
 
+// may run a collection first (see `threshold`), so any GC pointers that are not reachable from the roots become invalid
 void* coy_gc_malloc_(struct coy_gc_* gc, size_t size, const struct coy_typeinfo_* typeinfo);
+// marks `ptr`; its children get marked later (so `cb_mark` callbacks do not recurse)
 void coy_gc_mark_(struct coy_gc_* gc, void* ptr);
+// like `coy_gc_mark_`, but always marks the children of `ptr`; for objects that are written to without a write barrier (such as stack segments)
+void coy_gc_mark_dirty_(struct coy_gc_* gc, void* ptr);
+// must be called after storing a GC pointer into (the object) `ptr`, unless `ptr` is always marked with `coy_gc_mark_dirty_`
+void coy_gc_write_barrier_(struct coy_gc_* gc, void* ptr);
+// runs a full mark & sweep cycle
+void coy_gc_collect_(struct coy_gc_* gc);
+// only collects young objects
+void coy_gc_collect_minor_(struct coy_gc_* gc);
+/*
+Does up to `budget_us` microseconds (of wall-clock time) of incremental marking or sweeping, starting a new major
+collection if none is in progress (and anything was allocated since the last one); returns whether the collection is
+still in progress. Steps go over budget by at most a batch of grey objects, a rescan of the roots, or a page of the sweep
+(and marking is completed regardless once rescans have repeatedly failed to fit the budget).
+Any other collection that is triggered in the meantime completes the incremental one instead.
+*/
+bool coy_gc_step_(struct coy_gc_* gc, uint32_t budget_us);
+// keeps `ptr` (and everything reachable from it) alive until it is removed again
+void coy_gc_add_root_(struct coy_gc_* gc, void* ptr);
+void coy_gc_remove_root_(struct coy_gc_* gc, void* ptr);
+
+struct coy_gc_type_stats
+{
+    const char* repr;       //< the type's canonical representation (for internal types, their name)
+    size_t nobjects;
+    size_t nbytes;          //< (cell sizes, like in `coy_gc_stats`)
+};
+/*
+Heap statistics of a context. "Live" objects are those that are allocated, so anything that has become garbage since the
+last collection is included; collect first for exact numbers. Times are wall-clock time (like `coy_gc_step_` budgets).
+*/
+struct coy_gc_stats
+{
+    size_t nobjects_live;
+    size_t nbytes_live;         //< bytes in allocated cells (including object headers and size class rounding)
+    size_t nbytes_peak;         //< highest `nbytes_live` so far
+    size_t nbytes_heap;         //< bytes of all pages (including free cells and page headers)
+    uint64_t nbytes_allocated;  //< bytes allocated since the context was created
+    uint64_t nobjects_allocated;
+    double alloc_rate;          //< bytes allocated per second (since the context was created)
+    uint32_t ncollections_minor;
+    uint32_t ncollections_major;
+    uint64_t gc_time_us;        //< time spent collecting, in total
+    uint64_t max_pause_us;      //< longest single collection (or incremental step)
+    struct coy_gc_type_stats* types;    //< per-type breakdown of live objects, by decreasing `nbytes`
+    size_t ntypes;
+};
+
+void coy_gc_get_stats_(struct coy_gc_* gc, struct coy_gc_stats* stats);
+// fills in `stats` (which must be freed with `coy_gc_stats_free`); the per-type breakdown walks the heap, everything else is O(1)
+bool coy_gc_stats(struct coy_context* ctx, struct coy_gc_stats* stats);
+void coy_gc_stats_free(struct coy_gc_stats* stats);
 
 #endif /* COY_VM_GC_H_ */
@@ -0,0 +1,491 @@
+#include "image.h"
+#include "env.h"
+#include "function.h"
+#include "decode.h"
+#include "register.h"
+#include "../typeinfo.h"
+#include "../util/memio.h"
+#include "../util/debug.h"
+
+#include "stb_ds.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef COY_IMAGE_MMAP_
+#if defined(__unix__)
+#define COY_IMAGE_MMAP_ 1
+#else
+#define COY_IMAGE_MMAP_ 0
+#endif
+#endif
+
+#if COY_IMAGE_MMAP_
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define COY_IMAGE_SECTION_SIZE_     16u
+#define COY_IMAGE_FUNCTION_SIZE_    16u
+#define COY_IMAGE_SYMBOL_SIZE_      8u
+#define COY_IMAGE_NUM_KINDS_        (COY_IMAGE_SECTION_SYMBOLS_ + 1u)
+
+void coy_image_free_(struct coy_image_* image)
+{
+    if(!image) return;
+    for(size_t f = 0; f < image->nfunctions; f++)
+        coy_function_deinit_(&image->functions[f]);
+    free(image->functions);
+#if COY_IMAGE_MMAP_
+    // (the functions were deinitialized above, so nothing points into the mapping anymore)
+    if(image->mapping)
+        munmap(image->mapping, image->mapping_len);
+#endif
+    free(image);
+}
+
+/* ========== writing ========== */
+
+struct coy_image_string_entry_
+{
+    const struct coy_istring_* key;
+    uint32_t value;     //< offset into `strings`
+};
+struct coy_image_type_entry_
+{
+    const struct coy_typeinfo_* key;
+    uint32_t value;     //< type index
+};
+struct coy_image_writer_
+{
+    uint8_t* strings;
+    struct coy_image_string_entry_* stroffsets;
+    uint8_t* types;
+    uint32_t ntypes;
+    struct coy_image_type_entry_* typeindices;
+    const struct coy_function_** functions;
+    uint8_t* code;
+    uint8_t* symbols;
+};
+
+static uint32_t coy_image_write_string_(struct coy_image_writer_* w, const struct coy_istring_* str)
+{
+    ptrdiff_t entryidx = stbds_hmgeti(w->stroffsets, str);
+    if(entryidx >= 0)
+        return w->stroffsets[entryidx].value;
+    uint32_t offset = stbds_arrlenu(w->strings);
+    coy_memio_write_(&w->strings, str->str, str->len + 1u);
+    stbds_hmput(w->stroffsets, str, offset);
+    return offset;
+}
+// writes `ti` (and, before it, any types that it refers to), and returns its index in `index`
+static bool coy_image_write_type_(struct coy_image_writer_* w, const struct coy_typeinfo_* ti, uint32_t* index)
+{
+    ptrdiff_t entryidx = stbds_hmgeti(w->typeindices, ti);
+    if(entryidx >= 0)
+    {
+        *index = w->typeindices[entryidx].value;
+        return true;
+    }
+    uint32_t* words = NULL;
+    uint32_t sub;
+    bool ok = true;
+    switch(ti->category)
+    {
+    case COY_TYPEINFO_CAT_NORETURN_:
+        break;
+    case COY_TYPEINFO_CAT_INTEGER_:
+        stbds_arrput(words, ti->u.integer.width);
+        stbds_arrput(words, ti->u.integer.is_signed);
+        break;
+    case COY_TYPEINFO_CAT_TENSOR_:
+        ok = coy_image_write_type_(w, ti->u.tensor.basetype, &sub);
+        stbds_arrput(words, sub);
+        stbds_arrput(words, ti->u.tensor.ndims);
+        for(uint32_t d = 0; d < ti->u.tensor.ndims; d++)
+            stbds_arrput(words, ti->u.tensor.sizes[d]);
+        break;
+    case COY_TYPEINFO_CAT_ARRAY_:
+        ok = coy_image_write_type_(w, ti->u.array.basetype, &sub);
+        stbds_arrput(words, sub);
+        stbds_arrput(words, ti->u.array.ndims);
+        break;
+    case COY_TYPEINFO_CAT_FUNCTION_:
+        ok = coy_image_write_type_(w, ti->u.function.rtype, &sub);
+        stbds_arrput(words, sub);
+        stbds_arrput(words, ti->u.function.nparams);
+        for(size_t p = 0; ok && p < ti->u.function.nparams; p++)
+        {
+            ok = coy_image_write_type_(w, ti->u.function.ptypes[p], &sub);
+            stbds_arrput(words, sub);
+        }
+        break;
+    default:
+        ok = false; //< TODO: (there are no constructors for these yet)
+        break;
+    }
+    if(ok)
+    {
+        coy_memio_write32le_(&w->types, ti->category);
+        coy_memio_write32le_(&w->types, stbds_arrlenu(words));
+        for(size_t i = 0; i < stbds_arrlenu(words); i++)
+            coy_memio_write32le_(&w->types, words[i]);
+        *index = w->ntypes++;
+        stbds_hmput(w->typeindices, ti, *index);
+    }
+    stbds_arrfree(words);
+    return ok;
+}
+static uint32_t coy_image_add_function_(struct coy_image_writer_* w, const struct coy_function_* func)
+{
+    for(uint32_t f = 0; f < stbds_arrlenu(w->functions); f++)
+        if(w->functions[f] == func)
+            return f;
+    stbds_arrput(w->functions, func);
+    return stbds_arrlenu(w->functions) - 1u;
+}
+static bool coy_image_write_functions_(struct coy_image_writer_* w, uint8_t** records)
+{
+    for(size_t f = 0; f < stbds_arrlenu(w->functions); f++)
+    {
+        const struct coy_function_* func = w->functions[f];
+        uint32_t type;
+        if(!coy_image_write_type_(w, func->type, &type))
+            return false;
+        coy_memio_align_(&w->code, 8);
+        uint32_t offset = stbds_arrlenu(w->code);
+        if(!coy_function_write_data_(func, &w->code))
+            return false;
+        coy_memio_write32le_(records, type);
+        coy_memio_write32le_(records, func->attrib);
+        coy_memio_write32le_(records, offset);
+        coy_memio_write32le_(records, stbds_arrlenu(w->code) - offset);
+    }
+    return true;
+}
+static void coy_image_write_section_(uint8_t** image, size_t table, uint32_t kind, uint32_t count, const uint8_t* data)
+{
+    coy_memio_align_(image, 8);
+    size_t offset = stbds_arrlenu(*image);
+    coy_memio_patch32le_(*image, table + 0, kind);
+    coy_memio_patch32le_(*image, table + 4, count);
+    coy_memio_patch32le_(*image, table + 8, offset);
+    coy_memio_patch32le_(*image, table + 12, stbds_arrlenu(data));
+    coy_memio_write_(image, data, stbds_arrlenu(data));
+}
+bool coy_module_write_image_(struct coy_module_* module, uint8_t** image)
+{
+    struct coy_image_writer_ w = {0};
+    uint8_t* functions = NULL;
+    uint32_t name = coy_image_write_string_(&w, module->name);
+    bool ok = true;
+    for(size_t s = 0; ok && s < stbds_hmlenu(module->symbols); s++)
+    {
+        struct coy_module_symbol_* sym = &module->symbols[s].value;
+        if(sym->category != COY_MODULE_SYMCAT_FUNCTION_ || stbds_arrlenu(sym->u.functions) != 1)
+        {
+            ok = false; //< TODO: saving non-functions & function overloads
+            break;
+        }
+        coy_memio_write32le_(&w.symbols, coy_image_write_string_(&w, sym->name));
+        coy_memio_write32le_(&w.symbols, coy_image_add_function_(&w, sym->u.functions[0]));
+    }
+    ok = ok && coy_image_write_functions_(&w, &functions);
+    if(ok)
+    {
+        size_t start = stbds_arrlenu(*image);
+        COY_ASSERT(!(start & 7));
+        const uint32_t nsections = COY_IMAGE_SECTION_SYMBOLS_;
+        coy_memio_write_(image, COY_IMAGE_MAGIC_, 8);
+        coy_memio_write32le_(image, COY_IMAGE_VERSION_);
+        coy_memio_write32le_(image, nsections);
+        coy_memio_write32le_(image, name);
+        coy_memio_write32le_(image, 0);
+        size_t table = stbds_arrlenu(*image);
+        stbds_arrsetlen(*image, table + nsections * COY_IMAGE_SECTION_SIZE_);
+        coy_image_write_section_(image, table + 0 * COY_IMAGE_SECTION_SIZE_, COY_IMAGE_SECTION_STRINGS_, 0, w.strings);
+        coy_image_write_section_(image, table + 1 * COY_IMAGE_SECTION_SIZE_, COY_IMAGE_SECTION_TYPES_, w.ntypes, w.types);
+        coy_image_write_section_(image, table + 2 * COY_IMAGE_SECTION_SIZE_, COY_IMAGE_SECTION_FUNCTIONS_, stbds_arrlenu(w.functions), functions);
+        coy_image_write_section_(image, table + 3 * COY_IMAGE_SECTION_SIZE_, COY_IMAGE_SECTION_CODE_, 0, w.code);
+        coy_image_write_section_(image, table + 4 * COY_IMAGE_SECTION_SIZE_, COY_IMAGE_SECTION_SYMBOLS_, stbds_hmlenu(module->symbols), w.symbols);
+        // (offsets are from the start of the image)
+        for(uint32_t s = 0; s < nsections; s++)
+        {
+            size_t at = table + s * COY_IMAGE_SECTION_SIZE_ + 8;
+            struct coy_memio_ memio = {.data = *image, .pos = at, .len = stbds_arrlenu(*image), .ok = true};
+            coy_memio_patch32le_(*image, at, coy_memio_read32le_(&memio) - start);
+        }
+    }
+    stbds_arrfree(w.strings);
+    stbds_hmfree(w.stroffsets);
+    stbds_arrfree(w.types);
+    stbds_hmfree(w.typeindices);
+    stbds_arrfree(w.functions);
+    stbds_arrfree(w.code);
+    stbds_arrfree(w.symbols);
+    stbds_arrfree(functions);
+    return ok;
+}
+bool coy_module_save_image_(struct coy_module_* module, const char* path)
+{
+    uint8_t* image = NULL;
+    bool ok = coy_module_write_image_(module, &image);
+    if(ok)
+    {
+        FILE* file = fopen(path, "wb");
+        ok = file != NULL;
+        if(ok)
+        {
+            ok = fwrite(image, 1, stbds_arrlenu(image), file) == stbds_arrlenu(image);
+            ok = !fclose(file) && ok;
+        }
+    }
+    stbds_arrfree(image);
+    return ok;
+}
+
+/* ========== loading ========== */
+
+struct coy_image_section_
+{
+    const uint8_t* data;
+    uint32_t count;
+    uint32_t size;
+};
+// returns the string at `offset` into the `STRINGS` section, or NULL if there is none
+static const char* coy_image_get_string_(const struct coy_image_section_* strings, uint32_t offset)
+{
+    if(offset >= strings->size || !memchr(strings->data + offset, 0, strings->size - offset))
+        return NULL;
+    return (const char*)strings->data + offset;
+}
+static bool coy_image_read_types_(struct coy_env* env, const struct coy_image_section_* section, const struct coy_typeinfo_*** types)
+{
+    struct coy_memio_ memio = {.data = section->data, .pos = 0, .len = section->size, .ok = true};
+    uint32_t* words = NULL;
+    const struct coy_typeinfo_** ptypes = NULL;
+    bool ok = true;
+    for(uint32_t t = 0; ok && t < section->count; t++)
+    {
+        uint32_t category = coy_memio_read32le_(&memio);
+        uint32_t nwords = coy_memio_read32le_(&memio);
+        if(!memio.ok || nwords > (memio.len - memio.pos) / sizeof(uint32_t))
+        {
+            ok = false;
+            break;
+        }
+        stbds_arrsetlen(words, nwords);
+        for(uint32_t i = 0; i < nwords; i++)
+            words[i] = coy_memio_read32le_(&memio);
+        // (types can only refer to earlier ones)
+        for(uint32_t i = 0; i < nwords; i++)
+        {
+            bool isref = (category == COY_TYPEINFO_CAT_FUNCTION_ && i != 1) || ((category == COY_TYPEINFO_CAT_TENSOR_ || category == COY_TYPEINFO_CAT_ARRAY_) && i == 0);
+            if(isref && words[i] >= t)
+                ok = false;
+        }
+        const struct coy_typeinfo_* ti = NULL;
+        switch(ok ? category : UINT32_MAX)
+        {
+        case COY_TYPEINFO_CAT_NORETURN_:
+            if(nwords == 0)
+                ti = coy_typeinfo_noreturn_(env);
+            break;
+        case COY_TYPEINFO_CAT_INTEGER_:
+            if(nwords == 2 && (words[0] == 8 || words[0] == 16 || words[0] == 32 || words[0] == 64) && words[1] <= 1)
+                ti = coy_typeinfo_integer_(env, words[0], words[1]);
+            break;
+        case COY_TYPEINFO_CAT_TENSOR_:
+            if(nwords >= 2 && words[1] && nwords - 2 == words[1] && (*types)[words[0]]->category == COY_TYPEINFO_CAT_INTEGER_)
+                ti = coy_typeinfo_tensor_(env, (*types)[words[0]], &words[2], words[1]);
+            break;
+        case COY_TYPEINFO_CAT_ARRAY_:
+            if(nwords == 2 && words[1])
+                ti = coy_typeinfo_array_(env, (*types)[words[0]], words[1]);
+            break;
+        case COY_TYPEINFO_CAT_FUNCTION_:
+            if(nwords >= 2 && nwords - 2 == words[1])
+            {
+                stbds_arrsetlen(ptypes, words[1]);
+                for(uint32_t p = 0; p < words[1]; p++)
+                    ptypes[p] = (*types)[words[2 + p]];
+                ti = coy_typeinfo_function_(env, (*types)[words[0]], ptypes, words[1]);
+            }
+            break;
+        default:
+            break;
+        }
+        ok = ti != NULL;
+        stbds_arrput(*types, ti);
+    }
+    stbds_arrfree(words);
+    stbds_arrfree(ptypes);
+    return ok;
+}
+// if `inplace`, the function code is used directly from `code` (which must then be writable, for linking)
+static bool coy_image_read_functions_(struct coy_env* env, struct coy_image_* image, const struct coy_image_section_* section, const struct coy_image_section_* code, const struct coy_typeinfo_** types, bool inplace)
+{
+    if(section->count > section->size / COY_IMAGE_FUNCTION_SIZE_)
+        return false;
+    image->functions = malloc(section->count * sizeof(struct coy_function_));
+    if(section->count && !image->functions)
+        return false;
+    struct coy_memio_ memio = {.data = section->data, .pos = 0, .len = section->size, .ok = true};
+    for(uint32_t f = 0; f < section->count; f++)
+    {
+        uint32_t type = coy_memio_read32le_(&memio);
+        uint32_t attrib = coy_memio_read32le_(&memio);
+        uint32_t offset = coy_memio_read32le_(&memio);
+        uint32_t size = coy_memio_read32le_(&memio);
+        if(type >= stbds_arrlenu(types) || types[type]->category != COY_TYPEINFO_CAT_FUNCTION_)
+            return false;
+        if(attrib & COY_FUNCTION_ATTRIB_NATIVE_)
+            return false;
+        if((offset & 7) || offset > code->size || size > code->size - offset)
+            return false;
+        struct coy_function_* func = &image->functions[f];
+        struct coy_function_* ok = inplace
+            ? coy_function_init_mapped_(func, env, types[type], attrib, (uint8_t*)code->data + offset, size)
+            : coy_function_init_data_(func, env, types[type], attrib, code->data + offset, size);
+        if(!ok)
+            return false;
+        ++image->nfunctions;
+    }
+    return true;
+}
+// if `mapping` is given, it is the (writable) memory of `data`; the image takes ownership of it on success
+static struct coy_module_* coy_env_load_image_impl_(struct coy_env* env, const void* data, size_t len, void* mapping)
+{
+    if(!COY_ENSURE(!((uintptr_t)data & 7), "misuse: image data must be 8-byte aligned"))
+        return NULL;
+    struct coy_memio_ memio = {.data = data, .pos = 0, .len = len, .ok = true};
+    char magic[8];
+    coy_memio_read_(&memio, magic, sizeof(magic));
+    uint32_t version = coy_memio_read32le_(&memio);
+    uint32_t nsections = coy_memio_read32le_(&memio);
+    uint32_t name = coy_memio_read32le_(&memio);
+    /*uint32_t _reserved = */coy_memio_read32le_(&memio);
+    if(!memio.ok || memcmp(magic, COY_IMAGE_MAGIC_, sizeof(magic)) || version != COY_IMAGE_VERSION_)
+        return NULL;
+
+    struct coy_image_section_ sections[COY_IMAGE_NUM_KINDS_] = {{0}};
+    for(uint32_t s = 0; s < nsections; s++)
+    {
+        uint32_t kind = coy_memio_read32le_(&memio);
+        uint32_t count = coy_memio_read32le_(&memio);
+        uint32_t offset = coy_memio_read32le_(&memio);
+        uint32_t size = coy_memio_read32le_(&memio);
+        if(!memio.ok || (offset & 7) || offset > len || size > len - offset)
+            return NULL;
+        if(kind >= COY_IMAGE_NUM_KINDS_ || !kind)
+            continue;   //< (unknown section)
+        if(sections[kind].data)
+            return NULL;    //< duplicate section
+        sections[kind].data = (const uint8_t*)data + offset;
+        sections[kind].count = count;
+        sections[kind].size = size;
+    }
+    const struct coy_image_section_* strings = &sections[COY_IMAGE_SECTION_STRINGS_];
+    const char* module_name = coy_image_get_string_(strings, name);
+    if(!module_name || coy_env_find_module_(env, module_name))
+        return NULL;
+
+    struct coy_image_* image = calloc(1, sizeof(struct coy_image_));
+    const struct coy_typeinfo_** types = NULL;
+    const struct coy_istring_** symnames = NULL;
+    struct coy_image_string_entry_* symset = NULL;
+    struct coy_module_* module = NULL;
+    if(!image
+    || !coy_image_read_types_(env, &sections[COY_IMAGE_SECTION_TYPES_], &types)
+    || !coy_image_read_functions_(env, image, &sections[COY_IMAGE_SECTION_FUNCTIONS_], &sections[COY_IMAGE_SECTION_CODE_], types, mapping != NULL))
+        goto done;
+
+    // symbols are checked before the module gets created, so that a bad image does not leave a half-filled module behind
+    const struct coy_image_section_* symbols = &sections[COY_IMAGE_SECTION_SYMBOLS_];
+    if(symbols->count > symbols->size / COY_IMAGE_SYMBOL_SIZE_)
+        goto done;
+    memio = (struct coy_memio_){.data = symbols->data, .pos = 0, .len = symbols->size, .ok = true};
+    for(uint32_t s = 0; s < symbols->count; s++)
+    {
+        const char* symname = coy_image_get_string_(strings, coy_memio_read32le_(&memio));
+        uint32_t function = coy_memio_read32le_(&memio);
+        if(!symname || function >= image->nfunctions)
+            goto done;
+        const struct coy_istring_* isymname = coy_env_intern_(env, symname);
+        if(stbds_hmgeti(symset, isymname) >= 0)
+            goto done;
+        stbds_hmput(symset, isymname, function);
+        stbds_arrput(symnames, isymname);
+    }
+    module = coy_module_create_(env, module_name, false);
+    if(!module)
+        goto done;
+    for(size_t s = 0; s < stbds_arrlenu(symnames); s++)
+        coy_module_inject_function_istr_(module, symnames[s], &image->functions[stbds_hmget(symset, symnames[s])]);
+    // (functions can only be verified once they are linked)
+    bool ok = coy_module_link_(module);
+    for(size_t f = 0; ok && f < image->nfunctions; f++)
+        ok = coy_function_verify_(&image->functions[f]);
+    if(!ok)
+    {
+        coy_module_destroy_(module);
+        module = NULL;
+        goto done;
+    }
+    image->module = module;
+    image->mapping = mapping;
+    image->mapping_len = mapping ? len : 0;
+    stbds_arrput(env->images, image);
+    image = NULL;
+done:
+    coy_image_free_(image);
+    stbds_arrfree(types);
+    stbds_arrfree(symnames);
+    stbds_hmfree(symset);
+    return module;
+}
+struct coy_module_* coy_env_load_image_data_(struct coy_env* env, const void* data, size_t len)
+{
+    return coy_env_load_image_impl_(env, data, len, NULL);
+}
+
+struct coy_module_* coy_env_load_image(struct coy_env* env, const char* path)
+{
+#if COY_IMAGE_MMAP_
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return NULL;
+    struct stat st;
+    if(fstat(fd, &st) || !st.st_size)
+    {
+        close(fd);
+        return NULL;
+    }
+    size_t len = st.st_size;
+    // (private & writable, so that the linker's writes into symbol slots only copy the pages that they touch)
+    void* data = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED)
+        return NULL;
+    struct coy_module_* module = coy_env_load_image_impl_(env, data, len, data);
+    if(!module)
+        munmap(data, len);
+    return module;
+#else
+    FILE* file = fopen(path, "rb");
+    if(!file)
+        return NULL;
+    uint8_t* data = NULL;
+    uint8_t buf[4096];
+    size_t nread;
+    while((nread = fread(buf, 1, sizeof(buf), file)))
+        coy_memio_write_(&data, buf, nread);
+    fclose(file);
+    // (`stb_ds` arrays are sufficiently aligned)
+    struct coy_module_* module = coy_env_load_image_data_(env, data, stbds_arrlenu(data));
+    stbds_arrfree(data);
+    return module;
+#endif
+}
@@ -0,0 +1,71 @@
+#ifndef COY_VM_IMAGE_H_
+#define COY_VM_IMAGE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct coy_env;
+struct coy_module_;
+struct coy_function_;
+
+/*
+Module images: a whole module (its functions, their types, and its symbols) in a single file, which is loaded with one
+`mmap` (where available) and without going anywhere near the compiler.
+
+All integers are little-endian; offsets are from the start of the image, and every section starts 8-byte aligned.
+
+    header:     char magic[8] ("COYIMAGE"), u32 version, u32 nsections, u32 name, u32 _reserved
+    sections:   nsections * {u32 kind, u32 count, u32 offset, u32 size}
+
+Sections of unknown kinds are skipped (so that new ones can be added without changing the version):
+- STRINGS: NUL-terminated strings, referred to by their offset into the section (the header's `name` is the module name)
+- TYPES: `count` records of {u32 category (`COY_TYPEINFO_CAT_*_`), u32 nwords, u32 words[nwords]}, where types refer
+  to earlier ones by index:
+    - INTEGER: width, is_signed
+    - TENSOR: basetype, ndims, sizes[ndims]
+    - ARRAY: basetype, ndims
+    - FUNCTION: rtype, nparams, ptypes[nparams]
+- FUNCTIONS: `count` records of {u32 type, u32 attrib, u32 offset, u32 size}, where `offset` is into `CODE`
+- CODE: function bodies, in the format of `coy_function_init_data_` (each one 8-byte aligned, so that their constants
+  and instructions can be used in place)
+- SYMBOLS: `count` records of {u32 name, u32 function}
+
+Loaded modules are linked right away (so any modules that they refer to must have been loaded before, unless the env
+links lazily), and verified.
+When loaded from a file, the image stays mapped for as long as the env lives, and the functions' instructions & constants
+point straight into it (see `coy_function_init_mapped_`).
+*/
+#define COY_IMAGE_MAGIC_        "COYIMAGE"
+#define COY_IMAGE_VERSION_      UINT32_C(2)
+
+enum coy_image_section_kind_
+{
+    COY_IMAGE_SECTION_STRINGS_ = 1,
+    COY_IMAGE_SECTION_TYPES_,
+    COY_IMAGE_SECTION_FUNCTIONS_,
+    COY_IMAGE_SECTION_CODE_,
+    COY_IMAGE_SECTION_SYMBOLS_,
+};
+
+// a loaded image; these are owned by the env (and freed by `coy_env_deinit`)
+struct coy_image_
+{
+    struct coy_module_* module;
+    struct coy_function_* functions;    //< the module's functions
+    size_t nfunctions;
+    void* mapping;      //< the image file, if `functions` use it in place (NULL otherwise)
+    size_t mapping_len;
+};
+void coy_image_free_(struct coy_image_* image);
+
+// appends an image of `module` to `image` (an `stb_ds` array); the module's functions must not have been linked yet
+bool coy_module_write_image_(struct coy_module_* module, uint8_t** image);
+bool coy_module_save_image_(struct coy_module_* module, const char* path);
+
+// loads an image from memory (`data` must be 8-byte aligned; it is not referenced after this returns)
+struct coy_module_* coy_env_load_image_data_(struct coy_env* env, const void* data, size_t len);
+// maps the image file at `path`, and loads it into `env`; returns NULL on error (including if the module already exists)
+struct coy_module_* coy_env_load_image(struct coy_env* env, const char* path);
+
+#endif /* COY_VM_IMAGE_H_ */
@@ -0,0 +1,402 @@
+// needed for `MAP_ANONYMOUS` (we compile with `-std=c99`)
+#define _DEFAULT_SOURCE
+#include "jit.h"
+#include "decode.h"
+#include "function.h"
+#include "stack.h"
+#include "register.h"
+
+#include "../bytecode.h"
+#include "../util/atomic.h"
+#include "../util/debug.h"
+
+#include "stb_ds.h"
+#include <string.h>
+#include <stdbool.h>
+
+#if COY_JIT_
+#include <sys/mman.h>
+
+struct coy_jit_code_
+{
+    void* base;
+    size_t size;
+    uint32_t* entries;  //< native offset of each decoded instruction
+    uint32_t* blocks;   //< block index of each decoded instruction
+};
+
+// regs: `seg->regs.data + fp`; entry: where to start
+// returns the `pc` of the instruction that needs the interpreter
+typedef uint32_t coy_jit_entry_fn_(union coy_register_* regs, const void* entry);
+
+enum coy_jit_reg_
+{
+    COY_JIT_RAX_ = 0, COY_JIT_RCX_ = 1, COY_JIT_RDX_ = 2, COY_JIT_RBX_ = 3,
+    COY_JIT_RSI_ = 6, COY_JIT_RDI_ = 7, COY_JIT_R8_ = 8, COY_JIT_R9_ = 9,
+};
+/*
+Register usage within generated code:
+    rbx: `regs` (register $0 of the frame)
+    rax, rcx, rdx: scratch
+    r8, r9: the parallel move temporary
+(registers carry no pointer bits; the GC uses the blocks' stack maps instead)
+*/
+#define COY_JIT_REGS_   COY_JIT_RBX_
+
+// x86 condition codes (for `jcc`); flipping the lowest bit negates the condition
+enum coy_jit_cc_
+{
+    COY_JIT_CC_B_ = 0x2,
+    COY_JIT_CC_E_ = 0x4,
+    COY_JIT_CC_NE_ = 0x5,
+    COY_JIT_CC_BE_ = 0x6,
+    COY_JIT_CC_L_ = 0xC,
+    COY_JIT_CC_LE_ = 0xE,
+};
+
+struct coy_jit_fixup_
+{
+    uint32_t at;    //< offset of rel32
+    uint32_t pc;    //< target instruction
+};
+struct coy_jit_builder_
+{
+    uint8_t* code;
+    struct coy_jit_fixup_* fixups;
+    uint32_t epilogue;
+};
+
+static void coy_jit_emit8_(struct coy_jit_builder_* b, uint8_t v)
+{
+    stbds_arrput(b->code, v);
+}
+static void coy_jit_emit32_(struct coy_jit_builder_* b, uint32_t v)
+{
+    for(int i = 0; i < 4; i++)
+        coy_jit_emit8_(b, (uint8_t)(v >> i * 8));
+}
+static void coy_jit_emit64_(struct coy_jit_builder_* b, uint64_t v)
+{
+    coy_jit_emit32_(b, (uint32_t)v);
+    coy_jit_emit32_(b, (uint32_t)(v >> 32));
+}
+static uint32_t coy_jit_here_(struct coy_jit_builder_* b)
+{
+    return stbds_arrlenu(b->code);
+}
+// patches a rel32 at `at` to point to `target`
+static void coy_jit_patch_(struct coy_jit_builder_* b, uint32_t at, uint32_t target)
+{
+    uint32_t rel = target - (at + 4);
+    for(int i = 0; i < 4; i++)
+        b->code[at + i] = (uint8_t)(rel >> i * 8);
+}
+
+static void coy_jit_rex_(struct coy_jit_builder_* b, bool w, uint8_t reg, uint8_t base)
+{
+    uint8_t rex = 0x40 | (w ? 0x08 : 0) | (reg & 8 ? 0x04 : 0) | (base & 8 ? 0x01 : 0);
+    if(rex != 0x40)
+        coy_jit_emit8_(b, rex);
+}
+// <op> reg, [base + disp]
+static void coy_jit_op_mem_(struct coy_jit_builder_* b, bool w, uint8_t op0F, uint8_t op, uint8_t reg, uint8_t base, int32_t disp)
+{
+    coy_jit_rex_(b, w, reg, base);
+    if(op0F) coy_jit_emit8_(b, 0x0F);
+    coy_jit_emit8_(b, op);
+    coy_jit_emit8_(b, 0x80 | (reg & 7) << 3 | (base & 7));
+    if((base & 7) == 4)     //< rsp & r12 need a SIB byte
+        coy_jit_emit8_(b, 0x24);
+    coy_jit_emit32_(b, (uint32_t)disp);
+}
+// <op> rm, reg (both registers)
+static void coy_jit_op_rr_(struct coy_jit_builder_* b, bool w, uint8_t op0F, uint8_t op, uint8_t reg, uint8_t rm)
+{
+    coy_jit_rex_(b, w, reg, rm);
+    if(op0F) coy_jit_emit8_(b, 0x0F);
+    coy_jit_emit8_(b, op);
+    coy_jit_emit8_(b, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+static void coy_jit_mov_imm32_(struct coy_jit_builder_* b, uint8_t reg, uint32_t v)
+{
+    coy_jit_rex_(b, false, 0, reg);
+    coy_jit_emit8_(b, 0xB8 + (reg & 7));
+    coy_jit_emit32_(b, v);
+}
+static void coy_jit_mov_imm64_(struct coy_jit_builder_* b, uint8_t reg, uint64_t v)
+{
+    coy_jit_rex_(b, true, 0, reg);
+    coy_jit_emit8_(b, 0xB8 + (reg & 7));
+    coy_jit_emit64_(b, v);
+}
+// jmp/jcc to a later label; returns the offset to patch
+static uint32_t coy_jit_jmp_(struct coy_jit_builder_* b)
+{
+    coy_jit_emit8_(b, 0xE9);
+    uint32_t at = coy_jit_here_(b);
+    coy_jit_emit32_(b, 0);
+    return at;
+}
+static uint32_t coy_jit_jcc_(struct coy_jit_builder_* b, uint8_t cc)
+{
+    coy_jit_emit8_(b, 0x0F);
+    coy_jit_emit8_(b, 0x80 | cc);
+    uint32_t at = coy_jit_here_(b);
+    coy_jit_emit32_(b, 0);
+    return at;
+}
+// jmp to a decoded instruction
+static void coy_jit_jmp_pc_(struct coy_jit_builder_* b, uint32_t pc)
+{
+    struct coy_jit_fixup_ fixup = {.at = coy_jit_jmp_(b), .pc = pc};
+    stbds_arrput(b->fixups, fixup);
+}
+// hand instruction `pc` over to the interpreter
+static void coy_jit_exit_(struct coy_jit_builder_* b, uint32_t pc)
+{
+    coy_jit_mov_imm32_(b, COY_JIT_RAX_, pc);
+    coy_jit_patch_(b, coy_jit_jmp_(b), b->epilogue);
+}
+
+static int32_t coy_jit_disp_(uint32_t index, uint32_t offset)
+{
+    return (int32_t)(index * sizeof(union coy_register_) + offset);
+}
+// loads 32 bits at `offset` within an operand
+static void coy_jit_load32_(struct coy_jit_builder_* b, uint8_t reg, const struct coy_doperand_* op, uint32_t offset)
+{
+    if(op->cptr)
+    {
+        uint32_t v;
+        memcpy(&v, (const char*)op->cptr + offset, sizeof(v));
+        coy_jit_mov_imm32_(b, reg, v);
+    }
+    else
+        coy_jit_op_mem_(b, false, 0, 0x8B, reg, COY_JIT_REGS_, coy_jit_disp_(op->index, offset));
+}
+// loads 64 bits at `offset` within an operand
+static void coy_jit_load64_(struct coy_jit_builder_* b, uint8_t reg, const struct coy_doperand_* op, uint32_t offset)
+{
+    if(op->cptr)
+    {
+        uint64_t v;
+        memcpy(&v, (const char*)op->cptr + offset, sizeof(v));
+        coy_jit_mov_imm64_(b, reg, v);
+    }
+    else
+        coy_jit_op_mem_(b, true, 0, 0x8B, reg, COY_JIT_REGS_, coy_jit_disp_(op->index, offset));
+}
+static void coy_jit_store32_(struct coy_jit_builder_* b, uint32_t index, uint32_t offset, uint8_t reg)
+{
+    coy_jit_op_mem_(b, false, 0, 0x89, reg, COY_JIT_REGS_, coy_jit_disp_(index, offset));
+}
+
+// loads a whole register (value into `lo`/`hi`)
+static void coy_jit_load_reg_(struct coy_jit_builder_* b, uint8_t lo, uint8_t hi, const struct coy_doperand_* op)
+{
+    if(op->cptr)
+    {
+        // we load these through a pointer, because symbols might be (re)linked
+        coy_jit_mov_imm64_(b, COY_JIT_RAX_, (uint64_t)(uintptr_t)op->cptr);
+        coy_jit_op_mem_(b, true, 0, 0x8B, lo, COY_JIT_RAX_, 0);
+        coy_jit_op_mem_(b, true, 0, 0x8B, hi, COY_JIT_RAX_, 8);
+    }
+    else
+    {
+        coy_jit_op_mem_(b, true, 0, 0x8B, lo, COY_JIT_REGS_, coy_jit_disp_(op->index, 0));
+        coy_jit_op_mem_(b, true, 0, 0x8B, hi, COY_JIT_REGS_, coy_jit_disp_(op->index, 8));
+    }
+}
+static void coy_jit_store_reg_(struct coy_jit_builder_* b, uint32_t index, uint8_t lo, uint8_t hi)
+{
+    coy_jit_op_mem_(b, true, 0, 0x89, lo, COY_JIT_REGS_, coy_jit_disp_(index, 0));
+    coy_jit_op_mem_(b, true, 0, 0x89, hi, COY_JIT_REGS_, coy_jit_disp_(index, 8));
+}
+static void coy_jit_jump_(struct coy_jit_builder_* b, const struct coy_dcode_* dcode, const struct coy_djump_* jump)
+{
+    for(uint32_t i = 0; i < jump->nmoves; i++)
+    {
+        const struct coy_dmove_* move = &dcode->moves[jump->moves + i];
+        switch(move->kind)
+        {
+        case COY_DMOVE_COPY_:
+            coy_jit_load_reg_(b, COY_JIT_RCX_, COY_JIT_RDX_, &move->src);
+            coy_jit_store_reg_(b, move->dst, COY_JIT_RCX_, COY_JIT_RDX_);
+            break;
+        case COY_DMOVE_SAVE_:
+            coy_jit_load_reg_(b, COY_JIT_R8_, COY_JIT_R9_, &move->src);
+            break;
+        case COY_DMOVE_RESTORE_:
+            coy_jit_store_reg_(b, move->dst, COY_JIT_R8_, COY_JIT_R9_);
+            break;
+        default:
+            COY_UNREACHABLE();
+        }
+    }
+    coy_jit_jmp_pc_(b, jump->pc);
+}
+
+// `op` is the x86 opcode of the `<op> r/m32, r32` form (add: 0x01, sub: 0x29), or 0 for `imul`
+static void coy_jit_arith_(struct coy_jit_builder_* b, const struct coy_dinstr_* dinstr, uint8_t op, uint32_t offset, uint32_t nlanes)
+{
+    for(uint32_t l = 0; l < nlanes; l++)
+    {
+        coy_jit_load32_(b, COY_JIT_RAX_, &dinstr->a, offset + l * 4);
+        coy_jit_load32_(b, COY_JIT_RCX_, &dinstr->b, offset + l * 4);
+        if(op)
+            coy_jit_op_rr_(b, false, 0, op, COY_JIT_RCX_, COY_JIT_RAX_);
+        else
+            coy_jit_op_rr_(b, false, 1, 0xAF, COY_JIT_RAX_, COY_JIT_RCX_);
+        coy_jit_store32_(b, dinstr->dst, offset + l * 4, COY_JIT_RAX_);
+    }
+}
+// unsigned division & remainder; division by 0 is left to the interpreter
+static void coy_jit_divrem_u32_(struct coy_jit_builder_* b, const struct coy_dinstr_* dinstr, uint32_t pc, bool rem)
+{
+    coy_jit_load32_(b, COY_JIT_RAX_, &dinstr->a, 0);
+    coy_jit_load32_(b, COY_JIT_RCX_, &dinstr->b, 0);
+    coy_jit_op_rr_(b, false, 0, 0x85, COY_JIT_RCX_, COY_JIT_RCX_);     //< test ecx, ecx
+    uint32_t jnz = coy_jit_jcc_(b, COY_JIT_CC_NE_);
+    coy_jit_exit_(b, pc);
+    coy_jit_patch_(b, jnz, coy_jit_here_(b));
+    coy_jit_op_rr_(b, false, 0, 0x31, COY_JIT_RDX_, COY_JIT_RDX_);     //< xor edx, edx
+    coy_jit_op_rr_(b, false, 0, 0xF7, 6, COY_JIT_RCX_);                //< div ecx
+    coy_jit_store32_(b, dinstr->dst, 0, rem ? COY_JIT_RDX_ : COY_JIT_RAX_);
+}
+static void coy_jit_jmpc_(struct coy_jit_builder_* b, const struct coy_dcode_* dcode, const struct coy_dinstr_* dinstr, uint8_t cc, bool x2)
+{
+    if(x2)
+    {
+        coy_jit_load64_(b, COY_JIT_RAX_, &dinstr->a, 8);
+        coy_jit_load64_(b, COY_JIT_RCX_, &dinstr->b, 8);
+    }
+    else
+    {
+        coy_jit_load32_(b, COY_JIT_RAX_, &dinstr->a, 0);
+        coy_jit_load32_(b, COY_JIT_RCX_, &dinstr->b, 0);
+    }
+    coy_jit_op_rr_(b, x2, 0, 0x39, COY_JIT_RCX_, COY_JIT_RAX_);        //< cmp eax, ecx
+    uint32_t jfalse = coy_jit_jcc_(b, cc ^ 1);
+    coy_jit_jump_(b, dcode, &dcode->jumps[dinstr->extra + 0]);
+    coy_jit_patch_(b, jfalse, coy_jit_here_(b));
+    coy_jit_jump_(b, dcode, &dcode->jumps[dinstr->extra + 1]);
+}
+
+struct coy_jit_code_* coy_jit_compile_(struct coy_function_* func)
+{
+    if(func->attrib & COY_FUNCTION_ATTRIB_NATIVE_)
+        return NULL;
+    const struct coy_dcode_* dcode = COY_ATOMIC_LOAD_ACQUIRE(&func->u.coy.dcode);
+    if(!dcode || !COY_ATOMIC_LOAD_RELAXED(&dcode->verified))
+        return NULL;
+
+    struct coy_jit_builder_ b = {NULL, NULL, 0};
+    // prologue: save callee-saved registers & jump to the entry point
+    coy_jit_emit8_(&b, 0x53);                                       //< push rbx
+    coy_jit_op_rr_(&b, true, 0, 0x89, COY_JIT_RDI_, COY_JIT_REGS_); //< mov rbx, rdi
+    coy_jit_emit8_(&b, 0xFF); coy_jit_emit8_(&b, 0xE6);             //< jmp rsi
+    // epilogue (`eax` has been set by the exit)
+    b.epilogue = coy_jit_here_(&b);
+    coy_jit_emit8_(&b, 0x5B);                                       //< pop rbx
+    coy_jit_emit8_(&b, 0xC3);                                       //< ret
+
+    uint32_t ninstrs = stbds_arrlenu(dcode->instrs);
+    struct coy_jit_code_* code = malloc(sizeof(struct coy_jit_code_));
+    code->entries = NULL;
+    code->blocks = NULL;
+    stbds_arrsetlen(code->entries, ninstrs);
+    stbds_arrsetlen(code->blocks, ninstrs);
+    uint32_t block = 0;
+    for(uint32_t pc = 0; pc < ninstrs; pc++)
+    {
+        const struct coy_dinstr_* dinstr = &dcode->instrs[pc];
+        while(block + 1 < stbds_arrlenu(func->u.coy.blocks) && func->u.coy.blocks[block + 1].offset <= dinstr->pc)
+            ++block;
+        code->entries[pc] = coy_jit_here_(&b);
+        code->blocks[pc] = block;
+        switch(dinstr->code)
+        {
+        case COY_DOPCODE_ADD_32_:       coy_jit_arith_(&b, dinstr, 0x01, 0, 1); break;
+        case COY_DOPCODE_ADD_32X2_:     coy_jit_arith_(&b, dinstr, 0x01, 8, 2); break;
+        case COY_DOPCODE_SUB_32_:       coy_jit_arith_(&b, dinstr, 0x29, 0, 1); break;
+        case COY_DOPCODE_SUB_32X2_:     coy_jit_arith_(&b, dinstr, 0x29, 8, 2); break;
+        // the low 32 bits of the product are the same for signed & unsigned
+        case COY_DOPCODE_MUL_I32_:
+        case COY_DOPCODE_MUL_U32_:      coy_jit_arith_(&b, dinstr, 0, 0, 1); break;
+        case COY_DOPCODE_MUL_I32X2_:    coy_jit_arith_(&b, dinstr, 0, 0, 2); break;    //< (see `coy_op_handle_mul_i32x2_`)
+        case COY_DOPCODE_MUL_U32X2_:    coy_jit_arith_(&b, dinstr, 0, 8, 2); break;
+        case COY_DOPCODE_DIV_U32_:      coy_jit_divrem_u32_(&b, dinstr, pc, false); break;
+        case COY_DOPCODE_REM_U32_:      coy_jit_divrem_u32_(&b, dinstr, pc, true); break;
+        case COY_OPCODE_JMP:            coy_jit_jump_(&b, dcode, &dcode->jumps[dinstr->extra]); break;
+        case COY_DOPCODE_JMPC_EQ_32_:   coy_jit_jmpc_(&b, dcode, dinstr, COY_JIT_CC_E_, false); break;
+        case COY_DOPCODE_JMPC_NE_32_:   coy_jit_jmpc_(&b, dcode, dinstr, COY_JIT_CC_NE_, false); break;
+        case COY_DOPCODE_JMPC_LE_I32_:  coy_jit_jmpc_(&b, dcode, dinstr, COY_JIT_CC_LE_, false); break;
+        case COY_DOPCODE_JMPC_LT_I32_:  coy_jit_jmpc_(&b, dcode, dinstr, COY_JIT_CC_L_, false); break;
+        case COY_DOPCODE_JMPC_LE_U32_:  coy_jit_jmpc_(&b, dcode, dinstr, COY_JIT_CC_BE_, false); break;
+        case COY_DOPCODE_JMPC_LT_U32_:  coy_jit_jmpc_(&b, dcode, dinstr, COY_JIT_CC_B_, false); break;
+        case COY_DOPCODE_JMPC_EQ_32X2_: coy_jit_jmpc_(&b, dcode, dinstr, COY_JIT_CC_E_, true); break;
+        case COY_DOPCODE_JMPC_NE_32X2_: coy_jit_jmpc_(&b, dcode, dinstr, COY_JIT_CC_NE_, true); break;
+        // calls & returns manipulate frames, which is the interpreter's job;
+        // the rest (signed division, debugging instructions, invalid instructions) is not worth compiling
+        default:
+            coy_jit_exit_(&b, pc);
+            break;
+        }
+    }
+    for(size_t f = 0; f < stbds_arrlenu(b.fixups); f++)
+        coy_jit_patch_(&b, b.fixups[f].at, code->entries[b.fixups[f].pc]);
+    stbds_arrfree(b.fixups);
+
+    code->size = stbds_arrlenu(b.code);
+    code->base = mmap(NULL, code->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(code->base == MAP_FAILED)
+    {
+        stbds_arrfree(b.code);
+        code->base = NULL;
+        coy_jit_free_(code);
+        return NULL;
+    }
+    memcpy(code->base, b.code, code->size);
+    stbds_arrfree(b.code);
+    if(mprotect(code->base, code->size, PROT_READ | PROT_EXEC))
+    {
+        coy_jit_free_(code);
+        return NULL;
+    }
+    return code;
+}
+void coy_jit_free_(struct coy_jit_code_* code)
+{
+    if(!code) return;
+    if(code->base)
+        munmap(code->base, code->size);
+    stbds_arrfree(code->entries);
+    stbds_arrfree(code->blocks);
+    free(code);
+}
+void coy_jit_run_(const struct coy_jit_code_* code, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame)
+{
+    coy_jit_entry_fn_* fn;
+    // (ISO C does not allow casting between data & function pointers)
+    memcpy(&fn, &code->base, sizeof(fn));
+    uint32_t pc = fn(seg->regs.data + frame->fp, (const uint8_t*)code->base + code->entries[frame->pc]);
+    frame->pc = pc;
+    frame->block = code->blocks[pc];
+}
+
+#else /* !COY_JIT_ */
+
+struct coy_jit_code_* coy_jit_compile_(struct coy_function_* func)
+{
+    return NULL;
+}
+void coy_jit_free_(struct coy_jit_code_* code)
+{
+    COY_ASSERT(!code);
+}
+void coy_jit_run_(const struct coy_jit_code_* code, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame)
+{
+    COY_UNREACHABLE();
+}
+
+#endif /* COY_JIT_ */
@@ -0,0 +1,41 @@
+#ifndef COY_VM_JIT_H_
+#define COY_VM_JIT_H_
+
+#include <stdint.h>
+
+/*
+A baseline "template" JIT: each decoded instruction is translated into a fixed sequence of x86-64 code, with registers
+living in the stack segment's slots (exactly where the interpreter keeps them). This means that we can switch between
+the interpreter and native code at any instruction boundary, which keeps the JIT small:
+- arithmetic, `jmp` and `jmpc` are executed natively (including block argument moves)
+- `call`, `retcall`, `ret` and anything unsupported exit back into the interpreter, which executes the instruction and then
+  re-enters native code at the next block (or, after a call, once the callee returns)
+
+Only verified functions are compiled (the generated code does not check register indices), and only once they are hot.
+*/
+
+#ifndef COY_JIT_
+#if defined(__x86_64__) && defined(__unix__)
+#define COY_JIT_    1
+#else
+#define COY_JIT_    0
+#endif
+#endif
+
+#ifndef COY_JIT_THRESHOLD_
+// number of block entries (in the interpreter) before a function gets compiled
+#define COY_JIT_THRESHOLD_  100
+#endif
+
+struct coy_function_;
+struct coy_stack_segment_;
+struct coy_stack_frame_;
+struct coy_jit_code_;
+
+// compiles an already-decoded, verified function; returns NULL if this is not possible (including if the JIT is disabled)
+struct coy_jit_code_* coy_jit_compile_(struct coy_function_* func);
+void coy_jit_free_(struct coy_jit_code_* code);
+// runs `frame` from its current `pc`, until an instruction that needs the interpreter; updates `frame->pc` and `frame->block`
+void coy_jit_run_(const struct coy_jit_code_* code, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame);
+
+#endif /* COY_VM_JIT_H_ */
@@ -6,6 +6,8 @@
 #include "stb_ds.h"
 #include <limits.h>
 
+#define COY_SLOTS_CHUNK_SIZE_   1024
+
 struct coy_slots_* coy_slots_init_(struct coy_slots_* slots, size_t initsize)
 {
     if(!slots) return NULL;
@@ -21,12 +23,16 @@ void coy_slots_deinit_(struct coy_slots_* slots)
     coy_bitarray_deinit(&slots->pregs);
     stbds_arrfree(slots->regs);
 }
-void coy_slots_gc_mark_(struct coy_slots_* slots, struct coy_gc_* gc)
+void coy_slots_gc_mark_(struct coy_slots_* slots, struct coy_gc_* gc, size_t n)
 {
+    COY_ASSERT(n <= coy_slots_getlen_(slots));
     // mark all pointer registers
-    for(size_t i = 0; i < coy_bitarray_getlen_elems(&slots->pregs); i++)
+    for(size_t i = 0; i < (n + COY_BITARRAY_BITS_PER_ELEMENT - 1) / COY_BITARRAY_BITS_PER_ELEMENT; i++)
     {
         size_t pregs = coy_bitarray_get_elem(&slots->pregs, i);
+        // ignore anything past the end (it may be a stale pointer)
+        if((i + 1) * COY_BITARRAY_BITS_PER_ELEMENT > n)
+            pregs &= ((size_t)1 << (n & (COY_BITARRAY_BITS_PER_ELEMENT - 1))) - 1;
         if(!pregs)  // no pointers in this page
             continue;
         // this could be optimized further at some point (especially if CPU has a find-nonzero-bit instruction!
@@ -101,3 +107,30 @@ void coy_slots_copy_(struct coy_slots_* dst, size_t d, struct coy_slots_* src, s
     union coy_register_ reg = coy_slots_get_(src, s, &isptr);
     coy_slots_set_(dst, d, reg, isptr);
 }
+
+struct coy_regs_* coy_regs_init_(struct coy_regs_* regs, size_t initsize)
+{
+    if(!regs) return NULL;
+    regs->data = NULL;
+    stbds_arrsetcap(regs->data, initsize);
+    return regs;
+}
+void coy_regs_deinit_(struct coy_regs_* regs)
+{
+    if(!regs) return;
+    stbds_arrfree(regs->data);
+}
+void coy_regs_reserve_(struct coy_regs_* regs, size_t nlen)
+{
+    if(nlen <= stbds_arrlenu(regs->data))
+        return;
+    nlen = (nlen + COY_SLOTS_CHUNK_SIZE_ - 1) / COY_SLOTS_CHUNK_SIZE_ * COY_SLOTS_CHUNK_SIZE_;
+    // grow geometrically, so that deep recursion does not reallocate on every chunk
+    if(nlen < 2 * stbds_arrlenu(regs->data))
+        nlen = 2 * stbds_arrlenu(regs->data);
+    stbds_arrsetlen(regs->data, nlen);
+}
+size_t coy_regs_getlen_(const struct coy_regs_* regs)
+{
+    return stbds_arrlenu(regs->data);
+}
@@ -13,7 +13,8 @@ struct coy_slots_
 
 struct coy_slots_* coy_slots_init_(struct coy_slots_* slots, size_t initsize);
 void coy_slots_deinit_(struct coy_slots_* slots);
-void coy_slots_gc_mark_(struct coy_slots_* slots, struct coy_gc_* gc);
+// marks pointers in the first `n` slots
+void coy_slots_gc_mark_(struct coy_slots_* slots, struct coy_gc_* gc, size_t n);
 
 void coy_slots_setlen_(struct coy_slots_* slots, size_t nlen);
 size_t coy_slots_getlen_(struct coy_slots_* slots);
@@ -30,4 +31,16 @@ void coy_slots_setptr_(struct coy_slots_* slots, size_t i, void* ptr);
 
 void coy_slots_copy_(struct coy_slots_* dst, size_t d, struct coy_slots_* src, size_t s);
 
+// registers without pointer bits, for stack segments (whose pointers are found via the frames' stack maps instead)
+struct coy_regs_
+{
+    union coy_register_* data;
+};
+
+struct coy_regs_* coy_regs_init_(struct coy_regs_* regs, size_t initsize);
+void coy_regs_deinit_(struct coy_regs_* regs);
+// makes room for at least `nlen` registers; never shrinks, and grows in large chunks (so that repeated calls are cheap)
+void coy_regs_reserve_(struct coy_regs_* regs, size_t nlen);
+size_t coy_regs_getlen_(const struct coy_regs_* regs);
+
 #endif /* COY_VM_SLOTS_H_ */
@@ -3,23 +3,45 @@
 #include "../typeinfo.h"
 #include "context.h"
 #include "register.h"
+#include "function.h"
+#include "decode.h"
+#include "../util/debug.h"
 
 #include "stb_ds.h"
 #include <limits.h>
 
 #define COY_STACK_INITIAL_REG_SIZE_      2048
 #define COY_STACK_INITIAL_FRAME_SIZE_    16
+// maximum number of retired segments that a context keeps for reuse
+#define COY_STACK_MAX_SPARE_SEGMENTS_    4
 
 static void coy_mark_stack_segment_(struct coy_gc_* gc, void* ptr)
 {
     struct coy_stack_segment_* seg = ptr;
-    coy_slots_gc_mark_(&seg->slots, gc);
+    // registers carry no pointer bits; each frame's block `ptrs` is its stack map
+    size_t nframes = stbds_arrlenu(seg->frames);
+    for(size_t f = 0; f < nframes; f++)
+    {
+        const struct coy_stack_frame_* frame = &seg->frames[f];
+        if(frame->function->attrib & COY_FUNCTION_ATTRIB_NATIVE_)
+            continue;
+        const struct coy_function_block_* block = &frame->function->u.coy.blocks[frame->block];
+        // only registers before the current instruction's `dst` have been written in this block ...
+        uint32_t limit = frame->function->u.coy.dcode->instrs[frame->pc].dst;
+        // ... and the callee's frame starts at the pending call's `dst` (which is not written until it returns)
+        if(f + 1 < nframes && seg->frames[f + 1].fp - frame->fp < limit)
+            limit = seg->frames[f + 1].fp - frame->fp;
+        for(size_t p = 0; p < stbds_arrlenu(block->ptrs); p++)
+            if(block->ptrs[p] < limit)
+                coy_gc_mark_(gc, seg->regs.data[frame->fp + block->ptrs[p]].ptr);
+    }
+    coy_gc_mark_dirty_(gc, seg->parent);
 }
 static void coy_dtor_stack_segment_(struct coy_gc_* gc, void* ptr)
 {
     // TODO: Add an assertion to ensure that this is not in thread->top.
     struct coy_stack_segment_* seg = ptr;
-    coy_slots_deinit_(&seg->slots);
+    coy_regs_deinit_(&seg->regs);
     stbds_arrfree(seg->frames);
 }
 static const struct coy_typeinfo_ coy_ti_stack_segment_ = {
@@ -30,14 +52,30 @@ static const struct coy_typeinfo_ coy_ti_stack_segment_ = {
 };
 struct coy_stack_segment_* coy_stack_segment_create_(struct coy_context* ctx)
 {
+    if(stbds_arrlenu(ctx->spare_segments))
+    {
+        // (registers and frames keep their capacity; `coy_stack_segment_retire_` already reset the rest)
+        struct coy_stack_segment_* seg = stbds_arrpop(ctx->spare_segments);
+        seg->parent = ctx->top;
+        return seg;
+    }
     struct coy_stack_segment_* seg = coy_gc_malloc_(&ctx->gc, sizeof(struct coy_stack_segment_), &coy_ti_stack_segment_);
     seg->parent = ctx->top;
-    coy_slots_init_(&seg->slots, COY_STACK_INITIAL_REG_SIZE_);
+    coy_regs_init_(&seg->regs, COY_STACK_INITIAL_REG_SIZE_);
     seg->frames = NULL;
     stbds_arrsetcap(seg->frames, COY_STACK_INITIAL_FRAME_SIZE_);
     return seg;
 }
 
+void coy_stack_segment_retire_(struct coy_context* ctx, struct coy_stack_segment_* seg)
+{
+    COY_ASSERT(!stbds_arrlenu(seg->frames));
+    if(stbds_arrlenu(ctx->spare_segments) >= COY_STACK_MAX_SPARE_SEGMENTS_)
+        return; //< (left to the GC)
+    // nothing in a spare segment may keep other objects alive
+    seg->parent = NULL;
+    stbds_arrput(ctx->spare_segments, seg);
+}
 struct coy_stack_frame_* coy_stack_segment_get_top_frame_(struct coy_stack_segment_* seg)
 {
     size_t nframes = stbds_arrlenu(seg->frames);
@@ -11,16 +11,13 @@ struct coy_context;
 struct coy_stack_frame_
 {
     // "frame pointer"; points to location on stack of register $0;
-    // all reads are offset by `fp`
+    // all reads and writes are offset by `fp`
     uint32_t fp;
-    // "base pointer", or `fp+nparams`; points to location on stack of first instruction's result;
-    // all writes are offset by `bp`
-    uint32_t bp;
     // "block index"; which block are we in?
     uint32_t block: 31;
     // "return_native" frames return into native code
     uint32_t return_native: 1;
-    // "program counter"
+    // "program counter"; index of the current (or, once it has executed, next) decoded instruction
     uint32_t pc;
     struct coy_function_* function;
 };
@@ -28,13 +25,16 @@ struct coy_stack_frame_
 struct coy_stack_segment_
 {
     struct coy_stack_segment_* parent;
-    struct coy_slots_ slots;
+    struct coy_regs_ regs;
     // TODO: frames could eventually be merged into `regs`, with a clever use of the stack
     // (but this is easier for debugging)
     struct coy_stack_frame_* frames;
 };
 
+// reuses a segment retired by `coy_stack_segment_retire_` if there is one, and allocates a new one otherwise
 struct coy_stack_segment_* coy_stack_segment_create_(struct coy_context* ctx);
+// hands a segment whose frames have all been popped back to `ctx` for reuse (the segment must not be referenced anymore)
+void coy_stack_segment_retire_(struct coy_context* ctx, struct coy_stack_segment_* seg);
 struct coy_stack_frame_* coy_stack_segment_get_top_frame_(struct coy_stack_segment_* seg);
 
 #endif /* COY_VM_STACK_H_ */
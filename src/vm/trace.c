@@ -0,0 +1,169 @@
+#include "trace.h"
+#include "context.h"
+
+#include "../bytecode.h"
+#include "../util/debug.h"
+
+#include <stdlib.h>
+#include <inttypes.h>
+
+void coy_trace_init_(struct coy_trace_* trace)
+{
+    trace->records = NULL;
+    trace->mask = 0;
+    trace->head = 0;
+}
+void coy_trace_deinit_(struct coy_trace_* trace)
+{
+    free(trace->records);
+    coy_trace_init_(trace);
+}
+
+// (`mask` is SIZE_MAX for records that are not in a ring buffer)
+static void coy_trace_decode_instr_(const struct coy_trace_record_* records, size_t mask, uint64_t* r, uint64_t end, FILE* file)
+{
+    // we print the original instruction, since that's what the user would recognize
+    const struct coy_trace_record_* record = &records[*r & mask];
+    const char* name = coy_instruction_opcode_names_[record->code];
+    if(!name) name = "<?>";
+    fprintf(file, "\t$%" PRIu32 " = %s", record->value.u32, name);
+    for(size_t i = 1; *r + 1 < end && records[(*r + 1) & mask].kind == COY_TRACE_OPERAND_; i++, ++*r)
+    {
+        const struct coy_trace_record_* arg = &records[(*r + 1) & mask];
+        const bool is_block = record->code == COY_OPCODE_JMPC && (i == 3 || i == 4);
+        const bool is_imm = record->code == COY_OPCODE_JMPC && (i == 5);
+        fprintf(file, " %s%s%" PRIu32, arg->isptr ? "c" : "", is_block ? ".block" : is_imm ? "" : "$", arg->index);
+    }
+    fprintf(file, "\n");
+}
+static void coy_trace_decode_value_(const char* prefix, const struct coy_trace_record_* record, FILE* file)
+{
+    if(record->isptr)
+        fprintf(file, "%s%p", prefix, record->value.ptr);
+    else
+        fprintf(file, "%s%" PRIu32, prefix, record->value.u32);
+}
+// decodes records `start` to `end` (exclusive); returns false if there are invalid records (which are skipped)
+static bool coy_trace_decode_records_(const struct coy_trace_record_* records, size_t mask, uint64_t start, uint64_t end, FILE* file)
+{
+    bool ok = true;
+    // the oldest records may have been overwritten; skip any leftover block arguments or instruction operands
+    while(start < end && (records[start & mask].kind == COY_TRACE_ARG_ || records[start & mask].kind == COY_TRACE_OPERAND_))
+        ++start;
+    uint32_t pblock = UINT32_MAX;
+    for(uint64_t r = start; r < end; r++)
+    {
+        const struct coy_trace_record_* record = &records[r & mask];
+        switch(record->kind)
+        {
+        case COY_TRACE_FRAME_:
+            fprintf(file, "@function:%p (%" PRIu32 " params)\n", (void*)(uintptr_t)record->function, record->index);
+            pblock = UINT32_MAX;
+            break;
+        case COY_TRACE_BLOCK_:
+        {
+            // (like in the original trace) we only print blocks when they change
+            bool print = pblock != record->index;
+            pblock = record->index;
+            if(print) fprintf(file, ".block%" PRIu32 " (", record->index);
+            for(; r + 1 < end && records[(r + 1) & mask].kind == COY_TRACE_ARG_; r++)
+            {
+                const struct coy_trace_record_* arg = &records[(r + 1) & mask];
+                if(!print) continue;
+                char prefix[16];
+                snprintf(prefix, sizeof(prefix), "%s$%" PRIu32 "=", arg->index ? " " : "", arg->index);
+                coy_trace_decode_value_(prefix, arg, file);
+            }
+            if(print) fprintf(file, ")\n");
+            break;
+        }
+        case COY_TRACE_INSTR_:
+            coy_trace_decode_instr_(records, mask, &r, end, file);
+            break;
+        case COY_TRACE_RESULT_:
+            coy_trace_decode_value_("\t\tR:=", record, file);
+            fprintf(file, "\n");
+            break;
+        default:
+            // (stray arguments and operands are consumed by `BLOCK` and `INSTR`, so they can only come from a damaged file)
+            ok = false;
+            break;
+        }
+    }
+    return ok;
+}
+void coy_trace_decode_(const struct coy_trace_* trace, FILE* file)
+{
+    if(!trace->records)
+        return;
+    uint64_t nrecords = trace->mask + 1u;
+    uint64_t start = trace->head > nrecords ? trace->head - nrecords : 0;
+    bool ok = coy_trace_decode_records_(trace->records, trace->mask, start, trace->head, file);
+    COY_ASSERT(ok);
+    (void)ok;
+}
+
+bool coy_trace_enable(coy_context_t* ctx, size_t nrecords)
+{
+    if(!COY_ENSURE(nrecords, "misuse: trace buffer must hold at least 1 record"))
+        return false;
+    size_t capacity = 1;
+    while(capacity < nrecords)
+        capacity <<= 1;
+    struct coy_trace_record_* records = malloc(capacity * sizeof(struct coy_trace_record_));
+    if(!records)
+        return false;
+    coy_trace_deinit_(&ctx->trace);
+    ctx->trace.records = records;
+    ctx->trace.mask = capacity - 1u;
+    return true;
+}
+void coy_trace_disable(coy_context_t* ctx)
+{
+    coy_trace_deinit_(&ctx->trace);
+}
+bool coy_trace_is_enabled(coy_context_t* ctx)
+{
+    return ctx->trace.records != NULL;
+}
+void coy_trace_dump(coy_context_t* ctx, FILE* file)
+{
+    coy_trace_decode_(&ctx->trace, file);
+}
+bool coy_trace_save(coy_context_t* ctx, FILE* file)
+{
+    const struct coy_trace_* trace = &ctx->trace;
+    if(!trace->records)
+        return true;
+    uint64_t nrecords = trace->mask + 1u;
+    for(uint64_t r = trace->head > nrecords ? trace->head - nrecords : 0; r < trace->head; r++)
+        if(fwrite(&trace->records[r & trace->mask], sizeof(struct coy_trace_record_), 1, file) != 1)
+            return false;
+    return true;
+}
+bool coy_trace_decode(FILE* in, FILE* out)
+{
+    struct coy_trace_record_* records = NULL;
+    size_t nrecords = 0, capacity = 0;
+    for(;;)
+    {
+        if(nrecords == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 256;
+            struct coy_trace_record_* grown = realloc(records, capacity * sizeof(struct coy_trace_record_));
+            if(!grown)
+            {
+                free(records);
+                return false;
+            }
+            records = grown;
+        }
+        size_t nread = fread(&records[nrecords], sizeof(struct coy_trace_record_), capacity - nrecords, in);
+        nrecords += nread;
+        if(nrecords < capacity)
+            break;
+    }
+    bool ok = !ferror(in) && coy_trace_decode_records_(records, SIZE_MAX, 0, nrecords, out);
+    free(records);
+    return ok;
+}
@@ -0,0 +1,78 @@
+#ifndef COY_VM_TRACE_H_
+#define COY_VM_TRACE_H_
+
+#include "register.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+struct coy_context;
+struct coy_function_;
+
+/*
+Execution tracing. While enabled, the interpreter appends fixed-size binary records into a per-context ring buffer
+(overwriting the oldest ones once it is full); they are only turned into text when the trace is decoded. Records are
+self-contained (they copy what the decoder prints, rather than pointing into the traced code), so a trace can also be
+saved, and decoded later or by another process (see `coy_trace_save` and `coy_trace_decode`).
+
+Tracing is selected once per frame entry (the interpreter runs traced frames with a separate set of handlers),
+so it costs nothing while it is disabled. Native code (see jit.h) is not used while tracing.
+*/
+
+enum coy_trace_kind_
+{
+    COY_TRACE_FRAME_,   //< entered (or returned into) `function`, which has `index` parameters
+    COY_TRACE_BLOCK_,   //< entered block `index` of `function`; followed by one `ARG` per block parameter
+    COY_TRACE_ARG_,     //< value of parameter `index` of the preceding block
+    COY_TRACE_INSTR_,   //< about to execute the instruction at bytecode offset `index` of `function`; `value.u32` is its `dst`; followed by one `OPERAND` per argument
+    COY_TRACE_OPERAND_, //< argument of the preceding instruction, as encoded (`index` is a register, constant index or immediate)
+    COY_TRACE_RESULT_,  //< `value` is the result of the preceding instruction
+};
+struct coy_trace_record_
+{
+    uint64_t function;  //< address of the traced function, as an identifier only (never dereferenced); unused for `ARG`, `OPERAND` and `RESULT`
+    uint32_t index;
+    uint8_t kind;       //< `COY_TRACE_*_`
+    uint8_t isptr;      //< is `value` a pointer? (`OPERAND`: is it a constant?)
+    uint8_t code;       //< opcode (`INSTR` only)
+    uint8_t flags;      //< opcode flags (`INSTR` only)
+    union coy_register_ value;
+};
+
+struct coy_trace_
+{
+    struct coy_trace_record_* records;  //< ring buffer, or NULL if tracing is disabled
+    size_t mask;                        //< capacity - 1 (capacity is a power of 2)
+    uint64_t head;                      //< total number of records written (the next one goes to `head & mask`)
+};
+
+void coy_trace_init_(struct coy_trace_* trace);
+void coy_trace_deinit_(struct coy_trace_* trace);
+static inline struct coy_trace_record_* coy_trace_push_(struct coy_trace_* trace, uint8_t kind, const struct coy_function_* function, uint32_t index)
+{
+    struct coy_trace_record_* record = &trace->records[trace->head++ & trace->mask];
+    record->function = (uintptr_t)function;
+    record->index = index;
+    record->kind = kind;
+    record->isptr = false;
+    record->code = 0;
+    record->flags = 0;
+    return record;
+}
+// writes the trace in human-readable form (the oldest records that are still in the buffer come first)
+void coy_trace_decode_(const struct coy_trace_* trace, FILE* file);
+
+// starts tracing into a buffer of (at least) `nrecords` records, discarding any previous trace; takes effect on the next frame entry
+bool coy_trace_enable(struct coy_context* ctx, size_t nrecords);
+// stops tracing, and frees the trace buffer
+void coy_trace_disable(struct coy_context* ctx);
+bool coy_trace_is_enabled(struct coy_context* ctx);
+void coy_trace_dump(struct coy_context* ctx, FILE* file);
+// writes the raw records (oldest first, in the host's layout) for `coy_trace_decode`
+bool coy_trace_save(struct coy_context* ctx, FILE* file);
+// decodes a trace written by `coy_trace_save` (on a host with the same layout) into the same form as `coy_trace_dump`
+bool coy_trace_decode(FILE* in, FILE* out);
+
+#endif /* COY_VM_TRACE_H_ */
@@ -1,11 +1,15 @@
 #include "function.h"
+#include "decode.h"
+#include "jit.h"
 #include "context.h"
 #include "stack.h"
 #include "register.h"
+#include "trace.h"
 
 #include "stb_ds.h"
 
 #include "../bytecode.h"
+#include "../util/atomic.h"
 #include "../util/bitarray.h"
 #include "../util/debug.h"
 
@@ -17,76 +21,55 @@
 #include <assert.h>
 #include <stdio.h>
 
-#define COY_OP_TRACE_   1
-
 // a continuation is a fiber, generator, or similar --- a "slice" of stack that can be resumed
 // TODO: Unused for now, but will replace some uses of coy_stack_segment_ at some point
 /*struct coy_continuation_
 {
 };*/
 
-static union coy_register_ coy_op_getreg_(struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, union coy_instruction_ regarg, bool* isptr)
+/*
+Register access comes in two flavors, selected by the (compile-time constant) `checked` parameter of each handler:
+- checked: bounds-checks every access (used for unverified code, and in debug builds)
+- unchecked: accesses `regs` directly; only valid for verified code, because the verifier has already proven
+  that every register index is within the frame (and `enter_frame` ensures that the frame's slots exist)
+
+Stack registers carry no pointer bits: which ones hold pointers is known statically (see `coy_function_block_.ptrs`),
+so the GC finds them via the frames' stack maps, and operands know their pointer-ness from the decoder.
+Only the native slots (`ctx->slots`) track pointers dynamically.
+*/
+static inline union coy_register_ coy_op_get_(bool checked, struct coy_regs_* regs, size_t i)
 {
-    if(regarg.arg.isconst)
-    {
-        if(isptr) *isptr = regarg.arg.index < frame->function->u.coy.consts.nsymbols + frame->function->u.coy.consts.nrefs;
-        return frame->function->u.coy.consts.data[regarg.arg.index];
-    }
+    if(checked)
+        COY_CHECK(i < coy_regs_getlen_(regs));
+    return regs->data[i];
+}
+static inline void coy_op_set_(bool checked, struct coy_regs_* regs, size_t i, union coy_register_ reg)
+{
+    if(checked)
+        COY_CHECK(i < coy_regs_getlen_(regs));
+    regs->data[i] = reg;
+}
+static inline union coy_register_ coy_op_getreg_(bool checked, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, const struct coy_doperand_* op)
+{
+    if(op->cptr)
+        return *op->cptr;
     else
-        return coy_slots_get_(&seg->slots, frame->fp + regarg.arg.index, isptr);
+        return coy_op_get_(checked, &seg->regs, frame->fp + op->index);
 }
-static void coy_op_copyreg_(struct coy_slots_* dst, size_t d, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, union coy_instruction_ regarg)
+static inline void coy_op_copyreg_(bool checked, struct coy_regs_* dst, size_t d, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, const struct coy_doperand_* op)
 {
-    bool isptr;
-    union coy_register_ reg = coy_op_getreg_(seg, frame, regarg, &isptr);
-    coy_slots_set_(dst, d, reg, isptr);
+    coy_op_set_(checked, dst, d, coy_op_getreg_(checked, seg, frame, op));
 }
-
-static bool coy_op_handle_add_(coy_context_t* ctx, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, const union coy_instruction_* instr, uint32_t dstreg)
+// copies an operand into the native slots (which need to know whether it is a pointer)
+static inline void coy_op_exportreg_(bool checked, coy_context_t* ctx, size_t d, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, const struct coy_doperand_* op)
 {
-    COY_CHECK(instr->op.nargs == 2);
-    union coy_register_ a = coy_op_getreg_(seg, frame, instr[1], NULL);
-    union coy_register_ b = coy_op_getreg_(seg, frame, instr[2], NULL);
-    union coy_register_ dst;
-    switch(instr->op.flags & COY_OPFLG_TYPE_MASK)
-    {
-    case COY_OPFLG_TYPE_INT32:
-    case COY_OPFLG_TYPE_UINT32:
-        dst.u32 = a.u32 + b.u32;
-        break;
-    case COY_OPFLG_TYPE_INT32X2_TEMP:
-    case COY_OPFLG_TYPE_UINT32X2_TEMP:
-        dst.temp.u32x2[0] = a.temp.u32x2[0] + b.temp.u32x2[0];
-        dst.temp.u32x2[1] = a.temp.u32x2[1] + b.temp.u32x2[1];
-        break;
-    default:
-        COY_CHECK_MSG(false, "invalid instruction");
-    }
-    coy_slots_setval_(&seg->slots, dstreg, dst);
-    return true;
+    coy_slots_set_(&ctx->slots, d, coy_op_getreg_(checked, seg, frame, op), op->isptr);
 }
-static bool coy_op_handle_sub_(coy_context_t* ctx, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, const union coy_instruction_* instr, uint32_t dstreg)
+
+// invalid instructions are quickened into this, so that they only fail if actually executed (like they used to)
+static inline void coy_op_handle_invalid_(coy_context_t* ctx, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, const struct coy_dcode_* dcode, const struct coy_dinstr_* instr, bool checked)
 {
-    COY_CHECK(instr->op.nargs == 2);
-    union coy_register_ a = coy_op_getreg_(seg, frame, instr[1], NULL);
-    union coy_register_ b = coy_op_getreg_(seg, frame, instr[2], NULL);
-    union coy_register_ dst;
-    switch(instr->op.flags & COY_OPFLG_TYPE_MASK)
-    {
-    case COY_OPFLG_TYPE_INT32:
-    case COY_OPFLG_TYPE_UINT32:
-        dst.u32 = a.u32 - b.u32;
-        break;
-    case COY_OPFLG_TYPE_INT32X2_TEMP:
-    case COY_OPFLG_TYPE_UINT32X2_TEMP:
-        dst.temp.u32x2[0] = a.temp.u32x2[0] - b.temp.u32x2[0];
-        dst.temp.u32x2[1] = a.temp.u32x2[1] - b.temp.u32x2[1];
-        break;
-    default:
-        COY_CHECK_MSG(false, "invalid instruction");
-    }
-    coy_slots_setval_(&seg->slots, dstreg, dst);
-    return true;
+    COY_CHECK_MSG(false, "invalid instruction");
 }
 static int32_t coy_mul_i32_i32_(int32_t a, int32_t b)
 {
@@ -109,226 +92,233 @@ static int32_t coy_rem_i32_i32(int32_t a, int32_t b)
     COY_TODO("remainder of int");
     return 0;
 }
-static bool coy_op_handle_mul_(coy_context_t* ctx, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, const union coy_instruction_* instr, uint32_t dstreg)
-{
-    COY_CHECK(instr->op.nargs == 2);
-    union coy_register_ a = coy_op_getreg_(seg, frame, instr[1], NULL);
-    union coy_register_ b = coy_op_getreg_(seg, frame, instr[2], NULL);
-    union coy_register_ dst;
-    switch(instr->op.flags & COY_OPFLG_TYPE_MASK)
-    {
-    case COY_OPFLG_TYPE_INT32:
-        dst.i32 = coy_mul_i32_i32_(a.i32, b.i32);
-        break;
-    case COY_OPFLG_TYPE_UINT32:
-        dst.u32 = a.u32 * b.u32;
-        break;
-    case COY_OPFLG_TYPE_INT32X2_TEMP:
-        dst.temp.i32x2[0] = coy_mul_i32_i32_(a.temp.i32x2[0], b.temp.i32x2[0]);
-        dst.temp.i32x2[1] = coy_mul_i32_i32_(a.temp.i32x2[1], b.temp.i32x2[1]);
-        break;
-    case COY_OPFLG_TYPE_UINT32X2_TEMP:
-        dst.temp.u32x2[0] = a.temp.u32x2[0] * b.temp.u32x2[0];
-        dst.temp.u32x2[1] = a.temp.u32x2[1] * b.temp.u32x2[1];
-        break;
-    default:
-        COY_CHECK_MSG(false, "invalid instruction");
+// defines a quickened arithmetic handler; the body computes `dst` from `a` and `b`
+#define COY_OP_ARITH_HANDLER_(NAME, ...)                                                                                                                                            \
+    static inline void coy_op_handle_##NAME##_(coy_context_t* ctx, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, const struct coy_dcode_* dcode, const struct coy_dinstr_* instr, bool checked)  \
+    {                                                                                                                                                                               \
+        union coy_register_ a = coy_op_getreg_(checked, seg, frame, &instr->a);                                                                                                        \
+        union coy_register_ b = coy_op_getreg_(checked, seg, frame, &instr->b);                                                                                                        \
+        union coy_register_ dst;                                                                                                                                                    \
+        __VA_ARGS__                                                                                                                                                                 \
+        coy_op_set_(checked, &seg->regs, frame->fp + instr->dst, dst);                                                                                                                \
     }
-    coy_slots_setval_(&seg->slots, dstreg, dst);
-    return true;
-}
-static bool coy_op_handle_div_(coy_context_t* ctx, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, const union coy_instruction_* instr, uint32_t dstreg)
+COY_OP_ARITH_HANDLER_(add_32,
+    dst.u32 = a.u32 + b.u32;
+)
+COY_OP_ARITH_HANDLER_(add_32x2,
+    dst.temp.u32x2[0] = a.temp.u32x2[0] + b.temp.u32x2[0];
+    dst.temp.u32x2[1] = a.temp.u32x2[1] + b.temp.u32x2[1];
+)
+COY_OP_ARITH_HANDLER_(sub_32,
+    dst.u32 = a.u32 - b.u32;
+)
+COY_OP_ARITH_HANDLER_(sub_32x2,
+    dst.temp.u32x2[0] = a.temp.u32x2[0] - b.temp.u32x2[0];
+    dst.temp.u32x2[1] = a.temp.u32x2[1] - b.temp.u32x2[1];
+)
+COY_OP_ARITH_HANDLER_(mul_i32,
+    dst.i32 = coy_mul_i32_i32_(a.i32, b.i32);
+)
+COY_OP_ARITH_HANDLER_(mul_u32,
+    dst.u32 = a.u32 * b.u32;
+)
+COY_OP_ARITH_HANDLER_(mul_i32x2,
+    dst.temp.i32x2[0] = coy_mul_i32_i32_(a.temp.i32x2[0], b.temp.i32x2[0]);
+    dst.temp.i32x2[1] = coy_mul_i32_i32_(a.temp.i32x2[1], b.temp.i32x2[1]);
+)
+COY_OP_ARITH_HANDLER_(mul_u32x2,
+    dst.temp.u32x2[0] = a.temp.u32x2[0] * b.temp.u32x2[0];
+    dst.temp.u32x2[1] = a.temp.u32x2[1] * b.temp.u32x2[1];
+)
+COY_OP_ARITH_HANDLER_(div_i32,
+    if(!b.i32)
+        COY_TODO("handling division by 0");
+    dst.i32 = coy_div_i32_i32(a.i32, b.i32);
+)
+COY_OP_ARITH_HANDLER_(div_u32,
+    if(!b.u32)
+        COY_TODO("handling division by 0");
+    dst.u32 = a.u32 / b.u32;
+)
+COY_OP_ARITH_HANDLER_(div_i32x2,
+    if(!b.temp.i32x2[0] || !b.temp.i32x2[1])
+        COY_TODO("handling division by 0");
+    dst.temp.u32x2[0] = coy_div_i32_i32(a.temp.u32x2[0], b.temp.u32x2[0]);
+    dst.temp.u32x2[1] = coy_div_i32_i32(a.temp.u32x2[1], b.temp.u32x2[1]);
+)
+COY_OP_ARITH_HANDLER_(div_u32x2,
+    if(!b.temp.u32x2[0] || !b.temp.u32x2[1])
+        COY_TODO("handling division by 0");
+    dst.temp.u32x2[0] = a.temp.u32x2[0] / b.temp.u32x2[0];
+    dst.temp.u32x2[1] = a.temp.u32x2[1] / b.temp.u32x2[1];
+)
+COY_OP_ARITH_HANDLER_(rem_i32,
+    if(!b.i32)
+        COY_TODO("handling remainder by 0");
+    dst.i32 = coy_rem_i32_i32(a.i32, b.i32);
+)
+COY_OP_ARITH_HANDLER_(rem_u32,
+    if(!b.u32)
+        COY_TODO("handling remainder by 0");
+    dst.u32 = a.u32 % b.u32;
+)
+COY_OP_ARITH_HANDLER_(rem_i32x2,
+    if(!b.temp.i32x2[0] || !b.temp.i32x2[1])
+        COY_TODO("handling remainder by 0");
+    dst.temp.u32x2[0] = coy_rem_i32_i32(a.temp.u32x2[0], b.temp.u32x2[0]);
+    dst.temp.u32x2[1] = coy_rem_i32_i32(a.temp.u32x2[1], b.temp.u32x2[1]);
+)
+COY_OP_ARITH_HANDLER_(rem_u32x2,
+    if(!b.temp.u32x2[0] || !b.temp.u32x2[1])
+        COY_TODO("handling remainder by 0");
+    dst.temp.u32x2[0] = a.temp.u32x2[0] % b.temp.u32x2[0];
+    dst.temp.u32x2[1] = a.temp.u32x2[1] % b.temp.u32x2[1];
+)
+#undef COY_OP_ARITH_HANDLER_
+// performs a parallel move (of block or tail call arguments) within `frame`
+static inline void coy_op_moves_(struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, const struct coy_dmove_* moves, uint32_t nmoves, bool checked)
 {
-    COY_CHECK(instr->op.nargs == 2);
-    union coy_register_ a = coy_op_getreg_(seg, frame, instr[1], NULL);
-    union coy_register_ b = coy_op_getreg_(seg, frame, instr[2], NULL);
-    union coy_register_ dst;
-    switch(instr->op.flags & COY_OPFLG_TYPE_MASK)
+    // the moves were ordered by the decoder, so they can be done in-place
+    union coy_register_ temp = {0};
+    for(uint32_t i = 0; i < nmoves; i++)
     {
-    case COY_OPFLG_TYPE_INT32:
-        if(!b.i32)
-            COY_TODO("handling division by 0");
-        dst.i32 = coy_div_i32_i32(a.i32, b.i32);
-        break;
-    case COY_OPFLG_TYPE_UINT32:
-        if(!b.u32)
-            COY_TODO("handling division by 0");
-        dst.u32 = a.u32 / b.u32;
-        break;
-    case COY_OPFLG_TYPE_INT32X2_TEMP:
-        if(!b.temp.i32x2[0] || !b.temp.i32x2[1])
-            COY_TODO("handling division by 0");
-        dst.temp.u32x2[0] = coy_div_i32_i32(a.temp.u32x2[0], b.temp.u32x2[0]);
-        dst.temp.u32x2[1] = coy_div_i32_i32(a.temp.u32x2[1], b.temp.u32x2[1]);
-        break;
-    case COY_OPFLG_TYPE_UINT32X2_TEMP:
-        if(!b.temp.u32x2[0] || !b.temp.u32x2[1])
-            COY_TODO("handling division by 0");
-        dst.temp.u32x2[0] = a.temp.u32x2[0] / b.temp.u32x2[0];
-        dst.temp.u32x2[1] = a.temp.u32x2[1] / b.temp.u32x2[1];
-        break;
-    default:
-        COY_CHECK_MSG(false, "invalid instruction");
-    }
-    coy_slots_setval_(&seg->slots, dstreg, dst);
-    return true;
-}
-static bool coy_op_handle_rem_(coy_context_t* ctx, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, const union coy_instruction_* instr, uint32_t dstreg)
-{
-    COY_CHECK(instr->op.nargs == 2);
-    union coy_register_ a = coy_op_getreg_(seg, frame, instr[1], NULL);
-    union coy_register_ b = coy_op_getreg_(seg, frame, instr[2], NULL);
-    union coy_register_ dst;
-    switch(instr->op.flags & COY_OPFLG_TYPE_MASK)
-    {
-    case COY_OPFLG_TYPE_INT32:
-        if(!b.i32)
-            COY_TODO("handling remainder by 0");
-        dst.i32 = coy_rem_i32_i32(a.i32, b.i32);
-        break;
-    case COY_OPFLG_TYPE_UINT32:
-        if(!b.u32)
-            COY_TODO("handling remainder by 0");
-        dst.u32 = a.u32 % b.u32;
-        break;
-    case COY_OPFLG_TYPE_INT32X2_TEMP:
-        if(!b.temp.i32x2[0] || !b.temp.i32x2[1])
-            COY_TODO("handling remainder by 0");
-        dst.temp.u32x2[0] = coy_rem_i32_i32(a.temp.u32x2[0], b.temp.u32x2[0]);
-        dst.temp.u32x2[1] = coy_rem_i32_i32(a.temp.u32x2[1], b.temp.u32x2[1]);
-        break;
-    case COY_OPFLG_TYPE_UINT32X2_TEMP:
-        if(!b.temp.u32x2[0] || !b.temp.u32x2[1])
-            COY_TODO("handling remainder by 0");
-        dst.temp.u32x2[0] = a.temp.u32x2[0] % b.temp.u32x2[0];
-        dst.temp.u32x2[1] = a.temp.u32x2[1] % b.temp.u32x2[1];
-        break;
-    default:
-        COY_CHECK_MSG(false, "invalid instruction");
+        const struct coy_dmove_* move = &moves[i];
+        switch(move->kind)
+        {
+        case COY_DMOVE_COPY_:
+            coy_op_copyreg_(checked, &seg->regs, frame->fp + move->dst, seg, frame, &move->src);
+            break;
+        case COY_DMOVE_SAVE_:
+            temp = coy_op_getreg_(checked, seg, frame, &move->src);
+            break;
+        case COY_DMOVE_RESTORE_:
+            coy_op_set_(checked, &seg->regs, frame->fp + move->dst, temp);
+            break;
+        default:
+            COY_UNREACHABLE();
+        }
     }
-    coy_slots_setval_(&seg->slots, dstreg, dst);
-    return true;
 }
-static void coy_op_handle_jmp_helper_(coy_context_t* ctx, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, const union coy_instruction_* instr, uint32_t block_arg, uint32_t mov_head, uint32_t mov_tail)
+static inline void coy_op_jump_(coy_context_t* ctx, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, const struct coy_dcode_* dcode, const struct coy_djump_* jump, bool checked)
 {
-    COY_ASSERT(mov_head <= mov_tail);
-    uint32_t block = instr[1+block_arg].raw;
-    uint32_t mov_num = mov_tail - mov_head;
-    // move temp <= stack
-    for(size_t i = 0; i < mov_num; i++)
-        coy_op_copyreg_(&ctx->slots, i, seg, frame, instr[1+mov_head+i]);
-    // move stack <= temp
-    for(size_t i = 0; i < mov_num; i++)
-        coy_slots_copy_(&seg->slots, frame->fp + i, &ctx->slots, i);
-    COY_CHECK(block < stbds_arrlenu(frame->function->u.coy.blocks));
-    frame->block = block;
-    struct coy_function_block_* blockinfo = &frame->function->u.coy.blocks[block];
-    frame->bp = frame->fp + blockinfo->nparams;
-    frame->pc = blockinfo->offset;
+    coy_op_moves_(seg, frame, &dcode->moves[jump->moves], jump->nmoves, checked);
+    frame->block = jump->block;
+    frame->pc = jump->pc;
 }
-static bool coy_op_handle_jmp_(coy_context_t* ctx, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, const union coy_instruction_* instr, uint32_t dstreg)
+static inline void coy_op_handle_jmp_(coy_context_t* ctx, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, const struct coy_dcode_* dcode, const struct coy_dinstr_* instr, bool checked)
 {
-    coy_op_handle_jmp_helper_(ctx, seg, frame, instr, 0, 1, instr->op.nargs);
-    return true;
+    coy_op_jump_(ctx, seg, frame, dcode, &dcode->jumps[instr->extra], checked);
 }
-static bool coy_op_handle_jmpc_(coy_context_t* ctx, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, const union coy_instruction_* instr, uint32_t dstreg)
+// defines a quickened `jmpc` handler; `TEST` compares `a` and `b`
+#define COY_OP_JMPC_HANDLER_(NAME, TEST)                                                                                                                                            \
+    static inline void coy_op_handle_jmpc_##NAME##_(coy_context_t* ctx, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, const struct coy_dcode_* dcode, const struct coy_dinstr_* instr, bool checked)  \
+    {                                                                                                                                                                               \
+        union coy_register_ a = coy_op_getreg_(checked, seg, frame, &instr->a);                                                                                                        \
+        union coy_register_ b = coy_op_getreg_(checked, seg, frame, &instr->b);                                                                                                        \
+        bool test = (TEST);                                                                                                                                                         \
+        /* the "true" target comes first, followed by the "false" target */                                                                                                         \
+        coy_op_jump_(ctx, seg, frame, dcode, &dcode->jumps[instr->extra + !test], checked);                                                                                                  \
+    }
+COY_OP_JMPC_HANDLER_(eq_32, a.u32 == b.u32)
+COY_OP_JMPC_HANDLER_(ne_32, a.u32 != b.u32)
+COY_OP_JMPC_HANDLER_(le_i32, a.i32 <= b.i32)
+COY_OP_JMPC_HANDLER_(lt_i32, a.i32 < b.i32)
+COY_OP_JMPC_HANDLER_(le_u32, a.u32 <= b.u32)
+COY_OP_JMPC_HANDLER_(lt_u32, a.u32 < b.u32)
+COY_OP_JMPC_HANDLER_(eq_32x2, !memcmp(a.temp.u32x2, b.temp.u32x2, sizeof(a.temp.u32x2)))
+COY_OP_JMPC_HANDLER_(ne_32x2, !!memcmp(a.temp.u32x2, b.temp.u32x2, sizeof(a.temp.u32x2)))
+#undef COY_OP_JMPC_HANDLER_
+/*
+Returns the callee of `instr` (in `caller`), (re)filling its call-site cache if `func` is not the function it was filled
+for; that differs from `func` if it was a stub (see `coy_function_link_`). Other threads may be running the same code, so
+the cache is only published once the callee is ready to be called (see `coy_dcallsite_`).
+*/
+static inline struct coy_function_* coy_op_callsite_(coy_context_t* ctx, struct coy_function_* caller, const struct coy_dcode_* dcode, const struct coy_dinstr_* instr, struct coy_function_* func)
 {
-    COY_CHECK(instr->op.nargs >= 5);
-    union coy_register_ a = coy_op_getreg_(seg, frame, instr[1], NULL);
-    union coy_register_ b = coy_op_getreg_(seg, frame, instr[2], NULL);
-    bool testeq, testlt, haslt;
-    switch(instr->op.flags & COY_OPFLG_TYPE_MASK)
+    struct coy_dcallsite_* site = &dcode->calls[instr->b.index];
+    if(COY_ATOMIC_LOAD_ACQUIRE(&site->function) == func)
+        return func;
+    if(func->attrib & COY_FUNCTION_ATTRIB_STUB_)
     {
-    case COY_OPFLG_TYPE_INT32:
-        testeq = a.i32 == b.i32;
-        testlt = a.i32 < b.i32;
-        haslt = true;
-        break;
-    case COY_OPFLG_TYPE_UINT32:
-        testeq = a.u32 == b.u32;
-        testlt = a.u32 < b.u32;
-        haslt = true;
-        break;
-    case COY_OPFLG_TYPE_INT32X2_TEMP:
-    case COY_OPFLG_TYPE_UINT32X2_TEMP:
-        testeq = !memcmp(a.temp.u32x2, b.temp.u32x2, sizeof(a.temp.u32x2));
-        testlt = false;
-        haslt = false;
-        break;
-    default:
-        testeq = testlt = false;
-        COY_CHECK_MSG(false, "invalid instruction");
+        // first call through a lazily linked symbol: patch the constant, so that later calls do not come through here
+        // (other threads may be reading it, and get either the stub or its target)
+        func = coy_function_resolve_stub_(ctx->env, func);
+        COY_CHECK_MSG(func, "call to an unresolved symbol");
+        if(instr->a.cptr)
+        {
+            union coy_register_* constant = &caller->u.coy.consts.data[instr->a.cptr - caller->u.coy.consts.data];
+            COY_ATOMIC_STORE_RELEASE(&constant->ptr, (void*)func);
+        }
+        if(COY_ATOMIC_LOAD_ACQUIRE(&site->function) == func)
+            return func;
     }
-    bool test;
-    switch(instr->op.flags & COY_OPFLG_CMP_MASK)
+    // the GC trusts the caller's stack map for the result; the verifier can only check that for constant callees
+    COY_CHECK_MSG(instr->b.isptr == coy_function_returns_ref_(func), "call result does not match the function's return type");
+    if(func->attrib & COY_FUNCTION_ATTRIB_NATIVE_)
+        COY_ASSERT(func->u.nat.handler);
+    else
     {
-    case COY_OPFLG_CMP_EQ: test = testeq; break;
-    case COY_OPFLG_CMP_NE: test = !testeq; break;
-    case COY_OPFLG_CMP_LE: COY_CHECK_MSG(haslt, "`<=` test is not supported for this type"); test = testlt || testeq; break;
-    case COY_OPFLG_CMP_LT: COY_CHECK_MSG(haslt, "`<` test is not supported for this type"); test = testlt; break;
-    default:
-        test = false;
-        COY_UNREACHABLE();
+        coy_function_get_dcode_(func);
+        COY_CHECK_MSG(instr->nextra == func->u.coy.blocks[0].nparams, "invalid number of arguments passed to the function");
     }
-    uint32_t moves_sep = instr[5].raw;
-    if(test)
-        coy_op_handle_jmp_helper_(ctx, seg, frame, instr, 2, 5, 5 + moves_sep);
-    else
-        coy_op_handle_jmp_helper_(ctx, seg, frame, instr, 3, 5 + moves_sep, instr->op.nargs);
-    return true;
+    COY_ATOMIC_STORE_RELEASE(&site->function, func);
+    return func;
 }
-static bool coy_op_handle_call_(coy_context_t* ctx, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, const union coy_instruction_* instr, uint32_t dstreg)
+static inline void coy_op_handle_call_(coy_context_t* ctx, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, const struct coy_dcode_* dcode, const struct coy_dinstr_* instr, bool checked)
 {
     // TODO: verify type
-    bool isptr;
-    struct coy_function_* func = coy_op_getreg_(seg, frame, instr[1], &isptr).ptr;
-    COY_ASSERT(isptr);
+    COY_ASSERT(instr->a.isptr);
+    struct coy_function_* func = coy_op_callsite_(ctx, frame->function, dcode, instr, coy_op_getreg_(checked, seg, frame, &instr->a).ptr);
+    const struct coy_doperand_* args = &dcode->operands[instr->extra];
     if(func->attrib & COY_FUNCTION_ATTRIB_NATIVE_)
     {
-        coy_slots_setlen_(&ctx->slots, instr->op.nargs - 1);
-        for(uint32_t a = 0; a < instr->op.nargs - 1u; a++)
-            coy_op_copyreg_(&ctx->slots, a, seg, frame, instr[2+a]);
-        COY_ASSERT(func->u.nat.handler);
+        // calling may push frames, which could invalidate the pointer (so we use the index to fix this up)
+        uint32_t frameidx = frame - seg->frames;
+        coy_slots_setlen_(&ctx->slots, instr->nextra);
+        for(uint32_t a = 0; a < instr->nextra; a++)
+            coy_op_exportreg_(checked, ctx, a, seg, frame, &args[a]);
         int32_t status = func->u.nat.handler(ctx, func->u.nat.udata);
         COY_CHECK_MSG(0 <= status, "user: error in function");
         // multiple returns are not (yet?) implemented
         COY_CHECK_MSG(status <= 1, "too many return values from function");
+        frame = &seg->frames[frameidx];
         if(status)
-        {
-            bool isptr;
-            union coy_register_ reg = coy_slots_get_(&ctx->slots, 0, &isptr);
-            coy_slots_set_(&seg->slots, dstreg, reg, isptr);
-        }
+            coy_op_set_(checked, &seg->regs, frame->fp + instr->dst, coy_slots_get_(&ctx->slots, 0, NULL));
+        ++frame->pc;
     }
     else
     {
-        uint32_t frameidx = frame - seg->frames;
-        frame->pc -= 1u + instr->op.nargs;  // workaround: push_frame_ relies on pc being at the *start* of a frame (TODO: remove this)
-        coy_context_push_frame_(ctx, func, false, false);
-        // pushing a frame could invalidate the pointer, so we fix this up
-        frame = &seg->frames[frameidx];
-        frame->pc += 1u + instr->op.nargs;  // workaround: undo change done for push_frame_ (TODO: remove this)
-        struct coy_stack_frame_* nframe = &seg->frames[stbds_arrlenu(seg->frames) - 1u];
-        for(uint32_t a = 0; a < instr->op.nargs - 1u; a++)
-            coy_op_copyreg_(&seg->slots, nframe->fp + a, seg, frame, instr[2+a]);
+        // the new frame starts at our destination register (which is where `ret` will store the result);
+        // arguments are always below it, so they can be copied straight into the callee's parameters
+        uint32_t nfp = frame->fp + instr->dst;
+        coy_regs_reserve_(&seg->regs, nfp + func->u.coy.maxslots);
+        for(uint32_t a = 0; a < instr->nextra; a++)
+            coy_op_copyreg_(checked, &seg->regs, nfp + a, seg, frame, &args[a]);
+        ++frame->pc;    // return to the next instruction
+        struct coy_stack_frame_ nframe = {
+            .fp = nfp,
+            .block = 0,
+            .return_native = false,
+            .pc = 0,
+            .function = func,
+        };
+        stbds_arrput(seg->frames, nframe);  //< (invalidates `frame`)
     }
-    return false;
 }
-static bool coy_op_handle_retcall_(coy_context_t* ctx, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, const union coy_instruction_* instr, uint32_t dstreg)
+static inline void coy_op_handle_retcall_(coy_context_t* ctx, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, const struct coy_dcode_* dcode, const struct coy_dinstr_* instr, bool checked)
 {
-    bool isptr;
-    struct coy_function_* nfunction = coy_op_getreg_(seg, frame, instr[1], &isptr).ptr;
-    COY_ASSERT(isptr);
+    COY_ASSERT(instr->a.isptr);
+    struct coy_function_* nfunction = coy_op_callsite_(ctx, frame->function, dcode, instr, coy_op_getreg_(checked, seg, frame, &instr->a).ptr);
+    const struct coy_doperand_* args = &dcode->operands[instr->extra];
+    uint32_t nargs = instr->nextra;
     if(nfunction->attrib & COY_FUNCTION_ATTRIB_NATIVE_)
     {
-        coy_slots_setlen_(&ctx->slots, instr->op.nargs - 1);
-        for(uint32_t a = 0; a < instr->op.nargs - 1u; a++)
-            coy_op_copyreg_(&ctx->slots, a, seg, frame, instr[2+a]);
+        coy_slots_setlen_(&ctx->slots, nargs);
+        for(uint32_t a = 0; a < nargs; a++)
+            coy_op_exportreg_(checked, ctx, a, seg, frame, &args[a]);
         bool old_return_native = frame->return_native;
         uint32_t old_fp = frame->fp;
         coy_context_pop_frame_(ctx);
-        uint32_t nframes = stbds_arrlenu(ctx->top->frames);
-        COY_ASSERT(nfunction->u.nat.handler);
         int32_t status = nfunction->u.nat.handler(ctx, nfunction->u.nat.udata);
         COY_CHECK_MSG(0 <= status, "user: error in function");
         // multiple returns are not (yet?) implemented
@@ -336,166 +326,260 @@ static bool coy_op_handle_retcall_(coy_context_t* ctx, struct coy_stack_segment_
         if(old_return_native)
             coy_slots_setlen_(&ctx->slots, status);
         else if(status)
-        {
-            frame = &ctx->top->frames[nframes - 1u];
-            bool isptr;
-            union coy_register_ reg = coy_slots_get_(&ctx->slots, 0, &isptr);
-            coy_slots_set_(&seg->slots, old_fp, reg, isptr);
-        }
+            coy_op_set_(checked, &seg->regs, old_fp, coy_slots_get_(&ctx->slots, 0, NULL));
     }
     else
     {
-        struct coy_stack_frame_ nframe = {0};
-        uint32_t nargs = instr->op.nargs - 1u;
-        COY_CHECK(nargs == nfunction->u.coy.blocks[0].nparams);
-        nframe.fp = frame->fp;
-        nframe.bp = frame->fp + nargs;
-        nframe.block = 0;
-        nframe.return_native = frame->return_native;
-        nframe.pc = 0;
-        nframe.function = nfunction;
-        // move temp <= stack
-        for(size_t i = 0; i < nargs; i++)
-            coy_op_copyreg_(&ctx->slots, i, seg, frame, instr[2+i]);
-        coy_slots_setlen_(&seg->slots, nframe.fp + nfunction->u.coy.maxslots);
-        // move stack <= temp
-        for(size_t i = 0; i < nargs; i++)
-            coy_slots_copy_(&seg->slots, nframe.fp + i, &ctx->slots, i);
-        *frame = nframe;
+        // the arguments are moved into the start of our frame in-place (like block arguments), so no temporary frame is needed
+        const struct coy_dcallsite_* site = &dcode->calls[instr->b.index];
+        coy_regs_reserve_(&seg->regs, frame->fp + nfunction->u.coy.maxslots);
+        coy_op_moves_(seg, frame, &dcode->moves[site->moves], site->nmoves, checked);
+        // the new function reuses our frame (`fp` and `return_native` stay the same)
+        frame->function = nfunction;
+        frame->block = 0;
+        frame->pc = 0;
     }
-    return false;
 }
-static bool coy_op_handle_ret_(coy_context_t* ctx, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, const union coy_instruction_* instr, uint32_t dstreg)
+static inline void coy_op_handle_ret_(coy_context_t* ctx, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, const struct coy_dcode_* dcode, const struct coy_dinstr_* instr, bool checked)
 {
-    COY_CHECK(instr->op.nargs <= 1);
     if(frame->return_native)
     {
-        coy_slots_setlen_(&ctx->slots, instr->op.nargs);
-        if(instr->op.nargs)
-            coy_op_copyreg_(&ctx->slots, 0, seg, frame, instr[1]);
+        coy_slots_setlen_(&ctx->slots, instr->nextra);
+        if(instr->nextra)
+            coy_op_exportreg_(checked, ctx, 0, seg, frame, &instr->a);
     }
-    else if(instr->op.nargs)
-        coy_op_copyreg_(&seg->slots, frame->fp + 0, seg, frame, instr[1]);
+    else if(instr->nextra)
+        coy_op_copyreg_(checked, &seg->regs, frame->fp + 0, seg, frame, &instr->a);
     coy_context_pop_frame_(ctx);
-    return false;
 }
-static bool coy_op_handle__dumpu32_(coy_context_t* ctx, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, const union coy_instruction_* instr, uint32_t dstreg)
+static inline void coy_op_handle__dumpu32_(coy_context_t* ctx, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, const struct coy_dcode_* dcode, const struct coy_dinstr_* instr, bool checked)
 {
     // we don't generally want unconditional colors (because of file output), but eh
-    printf("\033[35m*** [$%" PRIu32 "]__dumpu32:", dstreg);
-    for(size_t i = 1; i <= instr->op.nargs; i++)
+    printf("\033[35m*** [$%" PRIu32 "]__dumpu32:", frame->fp + instr->dst);
+    for(uint32_t i = 0; i < instr->nextra; i++)
     {
-        size_t r = frame->fp + instr[i].arg.index;
-        union coy_register_ reg = coy_slots_getval_(&seg->slots, r);
-        printf(" $%" PRIu32 "=%" PRIu32, instr[i].arg.index, reg.u32);
+        const struct coy_doperand_* op = &dcode->operands[instr->extra + i];
+        union coy_register_ reg = coy_op_getreg_(true, seg, frame, op);
+        printf(" $%" PRIu32 "=%" PRIu32, op->index, reg.u32);
     }
     printf("\033[0m\n");
-    return true;
 }
 
-typedef bool coy_op_handler_(coy_context_t* ctx, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, const union coy_instruction_* instr, uint32_t dstreg);
-static coy_op_handler_* const coy_op_handlers_[256] = {
-    [COY_OPCODE_ADD]    = coy_op_handle_add_,       // add $a, $b
-    [COY_OPCODE_SUB]    = coy_op_handle_sub_,       // sub $a, $b
-    [COY_OPCODE_MUL]    = coy_op_handle_mul_,       // mul $a, $b
-    [COY_OPCODE_DIV]    = coy_op_handle_div_,       // div $a, $b
-    [COY_OPCODE_REM]    = coy_op_handle_rem_,       // rem $a, $b
-    [COY_OPCODE_JMP]    = coy_op_handle_jmp_,       // jmp <block>, $vmaps...
-    [COY_OPCODE_JMPC]   = coy_op_handle_jmpc_,      // jmpc $a, $b, <block1>, <block2>, <nargs1>, $vmaps...
-    [COY_OPCODE_CALL]   = coy_op_handle_call_,      // call $func $args...
-    [COY_OPCODE_RETCALL]= coy_op_handle_retcall_,   // retcall $func $args...
-    [COY_OPCODE_RET]    = coy_op_handle_ret_,       // ret $vals...
-    [COY_OPCODE__DUMPU32] = coy_op_handle__dumpu32_,
-};
+// tracing hooks (only called from traced handlers, which are always checked); see trace.h
+static void coy_op_trace_frame_(coy_context_t* ctx, struct coy_stack_frame_* frame)
+{
+    coy_trace_push_(&ctx->trace, COY_TRACE_FRAME_, frame->function, frame->function->u.coy.blocks[0].nparams);
+}
+static void coy_op_trace_block_(coy_context_t* ctx, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame)
+{
+    coy_trace_push_(&ctx->trace, COY_TRACE_BLOCK_, frame->function, frame->block);
+    for(uint32_t i = 0; i < frame->function->u.coy.blocks[frame->block].nparams; i++)
+    {
+        struct coy_trace_record_* record = coy_trace_push_(&ctx->trace, COY_TRACE_ARG_, NULL, i);
+        record->value = coy_op_get_(true, &seg->regs, frame->fp + i);
+        record->isptr = coy_function_block_isptr_(&frame->function->u.coy.blocks[frame->block], i);
+    }
+}
+static void coy_op_trace_instr_(coy_context_t* ctx, struct coy_stack_frame_* frame, const struct coy_dinstr_* dinstr)
+{
+    // (we record the original instruction, since that's what the user would recognize)
+    const union coy_instruction_* instr = &frame->function->u.coy.instrs[dinstr->pc];
+    struct coy_trace_record_* record = coy_trace_push_(&ctx->trace, COY_TRACE_INSTR_, frame->function, dinstr->pc);
+    record->code = instr->op.code;
+    record->flags = instr->op.flags;
+    record->value.u32 = dinstr->dst;
+    for(uint32_t i = 1; i <= instr->op.nargs; i++)
+        coy_trace_push_(&ctx->trace, COY_TRACE_OPERAND_, NULL, instr[i].arg.index)->isptr = instr[i].arg.isconst;
+}
+static void coy_op_trace_result_(coy_context_t* ctx, struct coy_stack_segment_* seg, struct coy_stack_frame_* frame, const struct coy_dinstr_* dinstr)
+{
+    struct coy_trace_record_* record = coy_trace_push_(&ctx->trace, COY_TRACE_RESULT_, NULL, 0);
+    record->value = coy_op_get_(true, &seg->regs, frame->fp + dinstr->dst);
+    record->isptr = coy_function_block_isptr_(&frame->function->u.coy.blocks[frame->block], dinstr->dst);
+}
+
+#if !defined(COY_VM_COMPUTED_GOTO_) && defined(__GNUC__)
+// threaded dispatch (each handler jumps directly to the next one); define as 0 to force the portable `switch`
+#define COY_VM_COMPUTED_GOTO_   1
+#endif
+
+/*
+Every handler is instantiated three times: with unchecked register access (for verified code), checked, and checked & traced.
+`CHECKED` and `TRACED` must be a literal `0` or `1`, because they are pasted into label names.
+*/
+#define COY_VM_OPS_(OP, OP_BRANCH, OP_FRAME, CHECKED, TRACED)                                       \
+    OP_BRANCH(COY_OPCODE_JMP, coy_op_handle_jmp_, CHECKED, TRACED)                                  \
+    OP_FRAME(COY_OPCODE_CALL, coy_op_handle_call_, CHECKED, TRACED)                                 \
+    OP_FRAME(COY_OPCODE_RETCALL, coy_op_handle_retcall_, CHECKED, TRACED)                           \
+    OP_FRAME(COY_OPCODE_RET, coy_op_handle_ret_, CHECKED, TRACED)                                   \
+    OP(COY_OPCODE__DUMPU32, coy_op_handle__dumpu32_, CHECKED, TRACED)                               \
+    OP(COY_DOPCODE_INVALID_, coy_op_handle_invalid_, CHECKED, TRACED)                               \
+    OP(COY_DOPCODE_ADD_32_, coy_op_handle_add_32_, CHECKED, TRACED)                                 \
+    OP(COY_DOPCODE_ADD_32X2_, coy_op_handle_add_32x2_, CHECKED, TRACED)                             \
+    OP(COY_DOPCODE_SUB_32_, coy_op_handle_sub_32_, CHECKED, TRACED)                                 \
+    OP(COY_DOPCODE_SUB_32X2_, coy_op_handle_sub_32x2_, CHECKED, TRACED)                             \
+    OP(COY_DOPCODE_MUL_I32_, coy_op_handle_mul_i32_, CHECKED, TRACED)                               \
+    OP(COY_DOPCODE_MUL_U32_, coy_op_handle_mul_u32_, CHECKED, TRACED)                               \
+    OP(COY_DOPCODE_MUL_I32X2_, coy_op_handle_mul_i32x2_, CHECKED, TRACED)                           \
+    OP(COY_DOPCODE_MUL_U32X2_, coy_op_handle_mul_u32x2_, CHECKED, TRACED)                           \
+    OP(COY_DOPCODE_DIV_I32_, coy_op_handle_div_i32_, CHECKED, TRACED)                               \
+    OP(COY_DOPCODE_DIV_U32_, coy_op_handle_div_u32_, CHECKED, TRACED)                               \
+    OP(COY_DOPCODE_DIV_I32X2_, coy_op_handle_div_i32x2_, CHECKED, TRACED)                           \
+    OP(COY_DOPCODE_DIV_U32X2_, coy_op_handle_div_u32x2_, CHECKED, TRACED)                           \
+    OP(COY_DOPCODE_REM_I32_, coy_op_handle_rem_i32_, CHECKED, TRACED)                               \
+    OP(COY_DOPCODE_REM_U32_, coy_op_handle_rem_u32_, CHECKED, TRACED)                               \
+    OP(COY_DOPCODE_REM_I32X2_, coy_op_handle_rem_i32x2_, CHECKED, TRACED)                           \
+    OP(COY_DOPCODE_REM_U32X2_, coy_op_handle_rem_u32x2_, CHECKED, TRACED)                           \
+    OP_BRANCH(COY_DOPCODE_JMPC_EQ_32_, coy_op_handle_jmpc_eq_32_, CHECKED, TRACED)                  \
+    OP_BRANCH(COY_DOPCODE_JMPC_NE_32_, coy_op_handle_jmpc_ne_32_, CHECKED, TRACED)                  \
+    OP_BRANCH(COY_DOPCODE_JMPC_LE_I32_, coy_op_handle_jmpc_le_i32_, CHECKED, TRACED)                \
+    OP_BRANCH(COY_DOPCODE_JMPC_LT_I32_, coy_op_handle_jmpc_lt_i32_, CHECKED, TRACED)                \
+    OP_BRANCH(COY_DOPCODE_JMPC_LE_U32_, coy_op_handle_jmpc_le_u32_, CHECKED, TRACED)                \
+    OP_BRANCH(COY_DOPCODE_JMPC_LT_U32_, coy_op_handle_jmpc_lt_u32_, CHECKED, TRACED)                \
+    OP_BRANCH(COY_DOPCODE_JMPC_EQ_32X2_, coy_op_handle_jmpc_eq_32x2_, CHECKED, TRACED)              \
+    OP_BRANCH(COY_DOPCODE_JMPC_NE_32X2_, coy_op_handle_jmpc_ne_32x2_, CHECKED, TRACED)
+
+#if COY_VM_COMPUTED_GOTO_
+#define COY_VM_CASE_(CODE, CHECKED, TRACED)     coy_op_label_##CODE##_##CHECKED##_##TRACED
+#define COY_VM_DISPATCH_()                      __extension__ ({ COY_ASSERT(labels[instr->code] && "Invalid instruction"); goto *labels[instr->code]; })
+#define COY_VM_LABEL_(CODE, HANDLER, CHECKED, TRACED)   [CODE] = __extension__ &&COY_VM_CASE_(CODE, CHECKED, TRACED),
+#else
+#define COY_VM_CASE_(CODE, CHECKED, TRACED)     case (CODE) | ((CHECKED) + (TRACED)) << 8
+#define COY_VM_DISPATCH_()                      goto dispatch
+#endif
+// `HANDLER` stays within the current block, so we just continue with the next instruction
+#define COY_VM_OP_(CODE, HANDLER, CHECKED, TRACED)                  \
+    COY_VM_CASE_(CODE, CHECKED, TRACED):                            \
+        if(TRACED) coy_op_trace_instr_(ctx, frame, instr);          \
+        HANDLER(ctx, seg, frame, dcode, instr, CHECKED);            \
+        if(TRACED) coy_op_trace_result_(ctx, seg, frame, instr);    \
+        ++instr;                                                    \
+        COY_VM_DISPATCH_();
+// `HANDLER` switches blocks within the same frame (and updates `frame->pc` accordingly)
+#define COY_VM_OP_BRANCH_(CODE, HANDLER, CHECKED, TRACED)           \
+    COY_VM_CASE_(CODE, CHECKED, TRACED):                            \
+        if(TRACED) coy_op_trace_instr_(ctx, frame, instr);          \
+        HANDLER(ctx, seg, frame, dcode, instr, CHECKED);            \
+        if(TRACED) coy_op_trace_result_(ctx, seg, frame, instr);    \
+        if(TRACED) coy_op_trace_block_(ctx, seg, frame);            \
+        goto enter_block;
+// `HANDLER` may switch frames, so we need to reload it (`frame->pc` must be up-to-date for this)
+#define COY_VM_OP_FRAME_(CODE, HANDLER, CHECKED, TRACED)            \
+    COY_VM_CASE_(CODE, CHECKED, TRACED):                            \
+        if(TRACED) coy_op_trace_instr_(ctx, frame, instr);          \
+        frame->pc = instr - dcode->instrs;                          \
+        HANDLER(ctx, seg, frame, dcode, instr, CHECKED);            \
+        goto enter_frame;
+
+#ifndef COY_VM_ALWAYS_CHECKED_
+#ifdef COY_DEBUG
+#define COY_VM_ALWAYS_CHECKED_  1
+#else
+#define COY_VM_ALWAYS_CHECKED_  0
+#endif
+#endif
 
 // runs a frame until it exits
 void coy_vm_exec_frame_(coy_context_t* ctx)
 {
+#if COY_VM_COMPUTED_GOTO_
+    // indexed by `mode`
+    static void* const coy_op_labels_[3][256] = {
+        { COY_VM_OPS_(COY_VM_LABEL_, COY_VM_LABEL_, COY_VM_LABEL_, 0, 0) },
+        { COY_VM_OPS_(COY_VM_LABEL_, COY_VM_LABEL_, COY_VM_LABEL_, 1, 0) },
+        { COY_VM_OPS_(COY_VM_LABEL_, COY_VM_LABEL_, COY_VM_LABEL_, 1, 1) },
+    };
+    void* const* labels;
+#endif
     struct coy_stack_segment_* seg = ctx->top;
     assert(stbds_arrlenu(seg->frames) && "Cannot execute a frame without a pending frame");
     size_t nframes_start = stbds_arrlenu(seg->frames);
-    while(stbds_arrlenu(seg->frames) >= nframes_start)  // we exit when we leave the starting frame
+    struct coy_stack_frame_* frame;
+    struct coy_function_* func;
+    struct coy_dcode_* dcode;
+#if COY_JIT_
+    struct coy_jit_code_* jit;
+#endif
+    const struct coy_dinstr_* instr;
+    bool traced;
+    unsigned mode;  //< 0 = unchecked, 1 = checked, 2 = checked & traced
+enter_frame:
+    if(stbds_arrlenu(seg->frames) < nframes_start)  // we exit when we leave the starting frame
+        return;
+    frame = &seg->frames[stbds_arrlenu(seg->frames) - 1];
+    func = frame->function;
+    if(func->attrib & COY_FUNCTION_ATTRIB_NATIVE_)
+    {
+        COY_ASSERT_MSG(false, "somehow ended up with native function in frame");
+        int32_t ret = func->u.nat.handler(ctx, func->u.nat.udata);
+        if(ret < 0)
+            abort();    // error in cfunc
+        coy_context_pop_frame_(ctx);
+        goto enter_frame;
+    }
+    dcode = func->u.coy.dcode;
+    COY_ASSERT(dcode);  //< decoded by `coy_context_push_frame_`
+    // tracing is only (de)activated here, so that disabled tracing has no cost in the handlers
+    traced = ctx->trace.records != NULL;
+    mode = traced ? 2 : COY_VM_ALWAYS_CHECKED_ || !COY_ATOMIC_LOAD_RELAXED(&dcode->verified);
+#if COY_VM_COMPUTED_GOTO_
+    labels = coy_op_labels_[mode];
+#endif
+    // reserved by `coy_context_push_frame_` (or `retcall`); this is what makes unchecked register access valid,
+    // since verified code never goes past `maxslots`
+    COY_ASSERT(frame->fp + func->u.coy.maxslots <= coy_regs_getlen_(&seg->regs));
+    if(traced)
+    {
+        coy_op_trace_frame_(ctx, frame);
+        coy_op_trace_block_(ctx, seg, frame);
+    }
+enter_block:
+#if COY_JIT_
+    // tier up once the function gets hot (counting block entries covers both calls and loops)
+    jit = COY_ATOMIC_LOAD_ACQUIRE(&dcode->jit);
+    if(!jit && COY_ATOMIC_LOAD_RELAXED(&dcode->verified) && COY_ATOMIC_LOAD_RELAXED(&dcode->hotness) < COY_JIT_THRESHOLD_
+    && COY_ATOMIC_ADD_RELAXED(&dcode->hotness, 1u) == COY_JIT_THRESHOLD_)
     {
-        struct coy_stack_frame_* frame = &seg->frames[stbds_arrlenu(seg->frames) - 1];
-        struct coy_function_* func = frame->function;
-        // TODO: we'll need to optimize this at some point ...
-        size_t slen = frame->bp + func->u.coy.maxslots;
-        coy_slots_setlen_(&seg->slots, slen);
-        if(func->attrib & COY_FUNCTION_ATTRIB_NATIVE_)
+        // (contexts on other threads run the same code, so only the first compiled code to get published is kept)
+        struct coy_jit_code_* published = NULL;
+        jit = coy_jit_compile_(func);
+        if(jit && !COY_ATOMIC_CAS(&dcode->jit, &published, jit))
         {
-            COY_ASSERT_MSG(false, "somehow ended up with native function in frame");
-            int32_t ret = func->u.nat.handler(ctx, func->u.nat.udata);
-            if(ret < 0)
-                abort();    // error in cfunc
-            coy_context_pop_frame_(ctx);
-            continue;
+            coy_jit_free_(jit);
+            jit = published;
         }
-#if COY_OP_TRACE_
-        printf("@function:%p (%" PRIu32 " params)\n", (void*)func, func->u.coy.blocks[0].nparams);
-        uint32_t pblock = UINT32_MAX;
+    }
+    if(jit && !traced)
+        coy_jit_run_(jit, seg, frame);  //< returns at the first instruction that needs the interpreter
 #endif
-        bool sameframe;
-        do // execute function; this loop is optional, but is done as an optimization
-        {
-            const union coy_instruction_* instr = &func->u.coy.instrs[frame->pc];
-            uint32_t dstreg = frame->bp + frame->pc - func->u.coy.blocks[frame->block].offset;
-#if COY_OP_TRACE_
-            {
-                if(pblock != frame->block)
-                {
-                    pblock = frame->block;
-                    printf(".block%" PRIu32 " (", pblock);
-                    for(uint32_t i = 0; i < func->u.coy.blocks[frame->block].nparams; i++)
-                    {
-                        if(i) putchar(' ');
-                        bool isptr;
-                        union coy_register_ reg = coy_slots_get_(&seg->slots, frame->fp+i, &isptr);
-                        if(isptr)
-                            printf("$%" PRIu32 "=%p", i, reg.ptr);
-                        else
-                            printf("$%" PRIu32 "=%" PRIu32, i, reg.u32);
-                    }
-                    printf(")\n");
-                }
-                const char* name = coy_instruction_opcode_names_[instr->op.code];
-                if(!name) name = "<?>";
-                printf("\t$%" PRIu32 " = %s", dstreg - frame->fp, name);
-                for(size_t i = 1; i <= instr->op.nargs; i++)
-                {
-                    const bool is_block = instr->op.code == COY_OPCODE_JMPC && (i == 3 || i == 4);
-                    const bool is_imm = instr->op.code == COY_OPCODE_JMPC && (i == 5);
-                    printf(" %s%s%" PRIu32, instr[i].arg.isconst ? "c" : "", is_block ? ".block" : is_imm ? "" : "$", instr[i].arg.index);
-                }
-                printf("\n");
-            }
+    instr = &dcode->instrs[frame->pc];
+#if COY_VM_COMPUTED_GOTO_
+    COY_VM_DISPATCH_();
+#else
+dispatch:
+    switch(instr->code | mode << 8)
 #endif
-            frame->pc += 1U + instr->op.nargs;
-            coy_op_handler_* h = coy_op_handlers_[instr->op.code];
-            assert(h && "Invalid instruction"); // for now, we trust the bytecode
-            sameframe = h(ctx, seg, frame, instr, dstreg);
-#if COY_OP_TRACE_
-            if(sameframe)
-            {
-                bool isptr;
-                union coy_register_ reg = coy_slots_get_(&seg->slots, dstreg, &isptr);
-                if(isptr)
-                    printf("\t\tR:=%p\n", reg.ptr);
-                else
-                    printf("\t\tR:=%" PRIu32 "\n", reg.u32);
-            }
+    {
+    COY_VM_OPS_(COY_VM_OP_, COY_VM_OP_BRANCH_, COY_VM_OP_FRAME_, 0, 0)
+    COY_VM_OPS_(COY_VM_OP_, COY_VM_OP_BRANCH_, COY_VM_OP_FRAME_, 1, 0)
+    COY_VM_OPS_(COY_VM_OP_, COY_VM_OP_BRANCH_, COY_VM_OP_FRAME_, 1, 1)
+#if !COY_VM_COMPUTED_GOTO_
+    default:
+        assert(0 && "Invalid instruction"); // for now, we trust the bytecode
+        COY_UNREACHABLE();
 #endif
-        }
-        while(sameframe);
     }
-    // TODO: determine number of return values
-    //coy_slots_setlen_(&ctx->slots, 1);
-    //bool isptr;
-    //union coy_register_ ret = coy_slots_get_(&ctx->top->slots, 0, &isptr);
-    //coy_slots_set_(&ctx->slots, 0, ret, isptr);
 }
 
 bool coy_vm_call_(struct coy_context* ctx, struct coy_function_* function, bool segmented)
 {
+    // (native code can get hold of a lazily linked symbol as a value, e.g. as an argument)
+    if(function->attrib & COY_FUNCTION_ATTRIB_STUB_)
+    {
+        function = coy_function_resolve_stub_(ctx->env, function);
+        if(!COY_ENSURE(function, "call to an unresolved symbol"))
+            return false;
+    }
     if(function->attrib & COY_FUNCTION_ATTRIB_NATIVE_)
     {
         COY_ASSERT(function->u.nat.handler);
@@ -512,7 +596,9 @@ bool coy_vm_call_(struct coy_context* ctx, struct coy_function_* function, bool
     coy_context_push_frame_(ctx, function, segmented, true);
     struct coy_stack_frame_* frame = coy_context_get_top_frame_(ctx);
     COY_ASSERT(frame);
-    memcpy(ctx->top->slots.regs + frame->fp, ctx->slots.regs, function->u.coy.blocks[0].nparams * sizeof(union coy_register_));
+    // (without parameters, the slots may not even have been allocated)
+    if(function->u.coy.blocks[0].nparams)
+        memcpy(ctx->top->regs.data + frame->fp, ctx->slots.regs, function->u.coy.blocks[0].nparams * sizeof(union coy_register_));
     coy_slots_setlen_(&ctx->slots, function->u.coy.maxslots);   //< TODO: set # of slots to maxparams (a lower number) to save memory
     coy_vm_exec_frame_(ctx);
     return true;
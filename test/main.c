@@ -8,7 +8,16 @@
 #include "vm/register.h"
 #include "vm/context.h"
 #include "vm/env.h"
+#include "vm/decode.h"
+#include "vm/jit.h"
+#include "vm/trace.h"
+#include "vm/stack.h"
+#include "vm/vm.h"
+#include "vm/image.h"
+#include "util/memio.h"
+#include "util/strpool.h"
 #include "bytecode.h"
+#include "typeinfo.h"
 
 #include "stb_ds.h"
 
@@ -69,6 +78,55 @@ TEST(stb_ds)
     ASSERT_EQ_STR(entry->value, "this is `main`");
 }
 
+TEST(memio_bulk)
+{
+    uint64_t aligned[3];    //< (reads must be aligned)
+    uint8_t* bytes = (uint8_t*)aligned;
+    memcpy(bytes, (const uint8_t[]){1,2,3,4,5,6,7,8, 9,10,11,12,13,14,15,16, 0xFF,0,0,0,0,0,0,0x80}, 24);
+    struct coy_memio_ memio = {.data = bytes, .pos = 0, .len = 24, .ok = true};
+
+    uint32_t u32s[4];
+    ASSERT(coy_memio_read32le_array_(&memio, u32s, 4));
+    ASSERT_EQ_UINT(u32s[0], UINT32_C(0x04030201));
+    ASSERT_EQ_UINT(u32s[3], UINT32_C(0x100F0E0D));
+    ASSERT_EQ_UINT(memio.pos, 16);
+    uint64_t u64s[2];
+    ASSERT(coy_memio_read64le_array_at_(&memio, 8, u64s, 2));
+    ASSERT_EQ_UINT(u64s[0], UINT64_C(0x100F0E0D0C0B0A09));
+    ASSERT_EQ_UINT(u64s[1], UINT64_C(0x80000000000000FF));
+    ASSERT(memio.ok);
+
+    // out of bounds reads fail as a whole
+    ASSERT(!coy_memio_read64le_array_(&memio, u64s, 2));
+    ASSERT(!memio.ok);
+    ASSERT_EQ_UINT(u64s[0], 0);
+}
+
+TEST(strpool)
+{
+    struct coy_strpool_ pool;
+    PRECONDITION(coy_strpool_init_(&pool));
+    ASSERT(!coy_strpool_find_(&pool, "main", 4));
+
+    const struct coy_istring_* main_ = coy_strpool_intern_(&pool, "main;add", 4);
+    ASSERT_EQ_STR(main_->str, "main");
+    ASSERT_EQ_UINT(main_->len, 4);
+    ASSERT_EQ_UINT(main_->hash, coy_strpool_hash_("main", 4));
+    ASSERT_EQ_PTR(coy_strpool_intern_(&pool, "main", 4), main_);
+    ASSERT_EQ_PTR(coy_strpool_find_(&pool, "main", 4), main_);
+    ASSERT(coy_strpool_intern_(&pool, "main;add", 8) != main_);
+    ASSERT(!coy_strpool_find_(&pool, "mai", 3));
+
+    // handles stay valid (and unique) as the pool grows
+    char buf[32];
+    for(int i = 0; i < 10000; i++)
+        coy_strpool_intern_(&pool, buf, sprintf(buf, "symbol%d", i));
+    ASSERT_EQ_UINT(pool.count, 2 + 10000);
+    ASSERT_EQ_PTR(coy_strpool_find_(&pool, "main", 4), main_);
+    ASSERT_EQ_STR(coy_strpool_find_(&pool, "symbol1234", 10)->str, "symbol1234");
+    coy_strpool_deinit_(&pool);
+}
+
 TEST(lexer)
 {
     coyc_lexer_t lexer;
@@ -514,6 +572,7 @@ TEST(vm_basic)
     memcpy(func.u.coy.blocks, in_blocks, sizeof(in_blocks));
     stbds_arrsetlen(func.u.coy.instrs, sizeof(in_instrs) / sizeof(*in_instrs));
     memcpy(func.u.coy.instrs, in_instrs, sizeof(in_instrs));
+    func.u.coy.ninstrs = sizeof(in_instrs) / sizeof(*in_instrs);
     coy_function_coy_compute_maxslots_(&func);
 
     struct coy_module_* module = coy_module_create_(&env, "main", false);
@@ -532,6 +591,100 @@ TEST(vm_basic)
     coy_env_deinit(&env);
 }
 
+// decodes the trace of `ctx` into `buf`
+static void trace_dump_to_string(coy_context_t* ctx, char* buf, size_t bufsize)
+{
+    FILE* file = tmpfile();
+    coy_trace_dump(ctx, file);
+    rewind(file);
+    size_t len = fread(buf, 1, bufsize - 1, file);
+    buf[len] = 0;
+    fclose(file);
+}
+TEST(vm_trace)
+{
+    coy_env_t env;
+    PRECONDITION(coy_env_init(&env));
+
+    struct coy_typeinfo_* ti_int = coy_typeinfo_integer_(&env, 32, true);
+    struct coy_typeinfo_* ti_function_int_int_int = coy_typeinfo_function_(&env, ti_int, (const struct coy_typeinfo_*[]){ti_int, ti_int}, 2);
+
+/*
+u32 add(u32 a, u32 b)
+.0_entry(a,b):
+    $2 = add $0, $1
+    ret $2
+*/
+    struct coy_function_builder_ builder;
+    PRECONDITION(coy_function_builder_init_(&builder, &env, ti_function_int_int_int, 0));
+    struct coy_function_ func;
+    {
+        coy_function_builder_block_(&builder, 2, NULL, 0);
+        {
+            uint32_t add = coy_function_builder_op_(&builder, COY_OPCODE_ADD, COY_OPFLG_TYPE_UINT32, false);
+                coy_function_builder_arg_reg_(&builder, 0);
+                coy_function_builder_arg_reg_(&builder, 1);
+            coy_function_builder_op_(&builder, COY_OPCODE_RET, 0, false);
+                coy_function_builder_arg_reg_(&builder, add);
+        }
+        coy_function_builder_finish_(&builder, &func);
+    }
+    struct coy_module_* module = coy_module_create_(&env, "main", false);
+    coy_module_inject_function_(module, "add", &func);
+
+    coy_context_t* ctx = coy_context_create(&env);
+    ASSERT(!coy_trace_is_enabled(ctx));
+    PRECONDITION(coy_trace_enable(ctx, 64));
+
+    coy_ensure_slots(ctx, 2);
+    coy_set_uint(ctx, 0, 5);
+    coy_set_uint(ctx, 1, 7);
+    ASSERT(coy_call(ctx, "main", "add"));
+    ASSERT_EQ_INT(coy_get_uint(ctx, 0), 5 + 7);
+
+    char expected[256];
+    char actual[256];
+    snprintf(expected, sizeof(expected),
+        "@function:%p (2 params)\n"
+        ".block0 ($0=5 $1=7)\n"
+        "\t$2 = ADD $0 $1\n"
+        "\t\tR:=12\n"
+        "\t$5 = RET $2\n", (void*)&func);
+    trace_dump_to_string(ctx, actual, sizeof(actual));
+    ASSERT_EQ_STR(actual, expected);
+
+    // a saved trace does not refer to the traced code, so it can be decoded after that is gone
+    FILE* saved = tmpfile();
+    PRECONDITION(saved);
+    ASSERT(coy_trace_save(ctx, saved));
+
+    // only the newest records are kept once the buffer is full
+    PRECONDITION(coy_trace_enable(ctx, 4));
+    coy_ensure_slots(ctx, 2);
+    coy_set_uint(ctx, 0, 5);
+    coy_set_uint(ctx, 1, 7);
+    ASSERT(coy_call(ctx, "main", "add"));
+    trace_dump_to_string(ctx, actual, sizeof(actual));
+    ASSERT_EQ_STR(actual, "\t\tR:=12\n\t$5 = RET $2\n");
+
+    coy_trace_disable(ctx);
+    ASSERT(!coy_trace_is_enabled(ctx));
+
+    coy_env_deinit(&env);
+    coy_function_deinit_(&func);
+
+    FILE* decoded = tmpfile();
+    PRECONDITION(decoded);
+    rewind(saved);
+    ASSERT(coy_trace_decode(saved, decoded));
+    rewind(decoded);
+    size_t len = fread(actual, 1, sizeof(actual) - 1, decoded);
+    actual[len] = 0;
+    ASSERT_EQ_STR(actual, expected);
+    fclose(saved);
+    fclose(decoded);
+}
+
 static void function_builder_prepare(struct coy_function_* func, bool precondition)
 {
     coy_env_t env;
@@ -541,7 +694,7 @@ static void function_builder_prepare(struct coy_function_* func, bool preconditi
     struct coy_typeinfo_* ti_function_int_int = coy_typeinfo_function_(&env, ti_int, (const struct coy_typeinfo_*[]){ti_int}, 1);
 
     struct coy_function_builder_ builder;
-    PRECONDITION(coy_function_builder_init_(&builder, ti_function_int_int, 0));
+    PRECONDITION(coy_function_builder_init_(&builder, &env, ti_function_int_int, 0));
 
 /*
 u32 factorial(u32 num)
@@ -656,7 +809,7 @@ u32 factorial(u32 num)
     $1 = call factpart($0, 1)
     ret $1
 */
-    PRECONDITION(coy_function_builder_init_(&builder, ti_function_int_int, 0));
+    PRECONDITION(coy_function_builder_init_(&builder, &env, ti_function_int_int, 0));
     struct coy_function_ func_factorial;
     {
         uint32_t b0_entry = coy_function_builder_block_(&builder, 1, NULL, 0);
@@ -690,7 +843,7 @@ u32 factpart(u32 num, u32 acc)
 .2_end(acc):
     ret $0
 */
-    PRECONDITION(coy_function_builder_init_(&builder, ti_function_int_int_int, 0));
+    PRECONDITION(coy_function_builder_init_(&builder, &env, ti_function_int_int_int, 0));
     struct coy_function_ func_factpart;
     {
         uint32_t b0_entry = coy_function_builder_block_(&builder, 2, NULL, 0);
@@ -748,6 +901,291 @@ u32 factpart(u32 num, u32 acc)
     coy_env_deinit(&env);
 }
 
+TEST(vm_block_args_cycle)
+{
+    coy_env_t env;
+    coy_env_init(&env);
+
+    struct coy_typeinfo_* ti_uint = coy_typeinfo_integer_(&env, 32, false);
+    struct coy_typeinfo_* ti_function_uint_uint_uint_uint = coy_typeinfo_function_(&env, ti_uint, (const struct coy_typeinfo_*[]){ti_uint,ti_uint,ti_uint}, 3);
+
+    struct coy_module_* module = coy_module_create_(&env, "main", false);
+
+    struct coy_function_builder_ builder;
+/*
+u32 rotate(u32 a, u32 b, u32 c)
+.0_entry(a,b,c):
+    jmp .1_end($1, $2, $0)      ; block arguments form a cycle
+.1_end(x,y,z):
+    $3 = mul $0, 100
+    $6 = mul $1, 10
+    $9 = add $3, $6
+    $12 = add $9, $2
+    ret $12
+*/
+    PRECONDITION(coy_function_builder_init_(&builder, &env, ti_function_uint_uint_uint_uint, 0));
+    struct coy_function_ func;
+    {
+        uint32_t b0_entry = coy_function_builder_block_(&builder, 3, NULL, 0);
+        uint32_t b1_end = coy_function_builder_block_(&builder, 3, NULL, 0);
+
+        coy_function_builder_useblock_(&builder, b0_entry);
+        {
+            coy_function_builder_op_(&builder, COY_OPCODE_JMP, 0, false);
+                coy_function_builder_arg_imm_(&builder, b1_end);
+                coy_function_builder_arg_reg_(&builder, 1);
+                coy_function_builder_arg_reg_(&builder, 2);
+                coy_function_builder_arg_reg_(&builder, 0);
+        }
+        coy_function_builder_useblock_(&builder, b1_end);
+        {
+            uint32_t x100 = coy_function_builder_op_(&builder, COY_OPCODE_MUL, COY_OPFLG_TYPE_UINT32, false);
+                coy_function_builder_arg_reg_(&builder, 0);
+                coy_function_builder_arg_const_val_(&builder, (union coy_register_){.u32=100});
+            uint32_t y10 = coy_function_builder_op_(&builder, COY_OPCODE_MUL, COY_OPFLG_TYPE_UINT32, false);
+                coy_function_builder_arg_reg_(&builder, 1);
+                coy_function_builder_arg_const_val_(&builder, (union coy_register_){.u32=10});
+            uint32_t xy = coy_function_builder_op_(&builder, COY_OPCODE_ADD, COY_OPFLG_TYPE_UINT32, false);
+                coy_function_builder_arg_reg_(&builder, x100);
+                coy_function_builder_arg_reg_(&builder, y10);
+            uint32_t xyz = coy_function_builder_op_(&builder, COY_OPCODE_ADD, COY_OPFLG_TYPE_UINT32, false);
+                coy_function_builder_arg_reg_(&builder, xy);
+                coy_function_builder_arg_reg_(&builder, 2);
+            coy_function_builder_op_(&builder, COY_OPCODE_RET, 0, false);
+                coy_function_builder_arg_reg_(&builder, xyz);
+        }
+
+        coy_function_builder_finish_(&builder, &func);
+        coy_module_inject_function_(module, "rotate", &func);
+    }
+    PRECONDITION(coy_module_link_(module));
+    PRECONDITION(coy_function_verify_(&func));
+
+    coy_context_t* ctx = coy_context_create(&env);
+
+    coy_ensure_slots(ctx, 3);
+    coy_set_uint(ctx, 0, 1);
+    coy_set_uint(ctx, 1, 2);
+    coy_set_uint(ctx, 2, 3);
+    ASSERT(coy_call(ctx, "main", "rotate"));
+    ASSERT_EQ_INT(coy_get_uint(ctx, 0), 231);
+
+    coy_env_deinit(&env);
+}
+
+TEST(vm_retcall_cycle)
+{
+    coy_env_t env;
+    coy_env_init(&env);
+
+    struct coy_typeinfo_* ti_uint = coy_typeinfo_integer_(&env, 32, false);
+    struct coy_typeinfo_* ti_function_uint_uint_uint_uint = coy_typeinfo_function_(&env, ti_uint, (const struct coy_typeinfo_*[]){ti_uint,ti_uint,ti_uint}, 3);
+
+    struct coy_module_* module = coy_module_create_(&env, "main", false);
+
+    struct coy_function_builder_ builder;
+/*
+u32 swap(u32 n, u32 x, u32 y)
+.0_entry(n,x,y):
+    jmpc eq 0, $0,
+        .1_end($1),
+        .2_call($0,$1,$2)
+.1_end(x):
+    ret $0
+.2_call(n,x,y):
+    $3 = sub $0, 1
+    retcall swap($3, $2, $1)    ; tail call arguments form a cycle
+*/
+    PRECONDITION(coy_function_builder_init_(&builder, &env, ti_function_uint_uint_uint_uint, 0));
+    struct coy_function_ func;
+    {
+        uint32_t b0_entry = coy_function_builder_block_(&builder, 3, NULL, 0);
+        uint32_t b1_end = coy_function_builder_block_(&builder, 1, NULL, 0);
+        uint32_t b2_call = coy_function_builder_block_(&builder, 3, NULL, 0);
+
+        coy_function_builder_useblock_(&builder, b0_entry);
+        {
+            coy_function_builder_op_(&builder, COY_OPCODE_JMPC, COY_OPFLG_CMP_EQ|COY_OPFLG_TYPE_UINT32, false);
+                coy_function_builder_arg_const_val_(&builder, (union coy_register_){.u32=0});
+                coy_function_builder_arg_reg_(&builder, 0);
+                coy_function_builder_arg_imm_(&builder, b1_end);
+                coy_function_builder_arg_imm_(&builder, b2_call);
+                coy_function_builder_arg_imm_(&builder, 1);
+                coy_function_builder_arg_reg_(&builder, 1);
+                coy_function_builder_arg_reg_(&builder, 0);
+                coy_function_builder_arg_reg_(&builder, 1);
+                coy_function_builder_arg_reg_(&builder, 2);
+        }
+        coy_function_builder_useblock_(&builder, b1_end);
+        {
+            coy_function_builder_op_(&builder, COY_OPCODE_RET, 0, false);
+                coy_function_builder_arg_reg_(&builder, 0);
+        }
+        coy_function_builder_useblock_(&builder, b2_call);
+        {
+            uint32_t sub = coy_function_builder_op_(&builder, COY_OPCODE_SUB, COY_OPFLG_TYPE_UINT32, false);
+                coy_function_builder_arg_reg_(&builder, 0);
+                coy_function_builder_arg_const_val_(&builder, (union coy_register_){.u32=1});
+            coy_function_builder_op_(&builder, COY_OPCODE_RETCALL, 0, false);
+                coy_function_builder_arg_const_sym_(&builder, "main;swap");
+                coy_function_builder_arg_reg_(&builder, sub);
+                coy_function_builder_arg_reg_(&builder, 2);
+                coy_function_builder_arg_reg_(&builder, 1);
+        }
+
+        coy_function_builder_finish_(&builder, &func);
+        coy_module_inject_function_(module, "swap", &func);
+    }
+    PRECONDITION(coy_module_link_(module));
+    PRECONDITION(coy_function_verify_(&func));
+
+    coy_context_t* ctx = coy_context_create(&env);
+
+    coy_ensure_slots(ctx, 3);
+    coy_set_uint(ctx, 0, 7);
+    coy_set_uint(ctx, 1, 3);
+    coy_set_uint(ctx, 2, 4);
+    ASSERT(coy_call(ctx, "main", "swap"));
+    ASSERT_EQ_INT(coy_get_uint(ctx, 0), 4);
+
+    coy_env_deinit(&env);
+}
+
+TEST(vm_jit_loop)
+{
+    coy_env_t env;
+    coy_env_init(&env);
+
+    struct coy_typeinfo_* ti_uint = coy_typeinfo_integer_(&env, 32, false);
+    struct coy_typeinfo_* ti_function_uint_uint = coy_typeinfo_function_(&env, ti_uint, (const struct coy_typeinfo_*[]){ti_uint}, 1);
+
+    struct coy_module_* module = coy_module_create_(&env, "main", false);
+
+    struct coy_function_builder_ builder;
+    /* ========== twice ========== */
+/*
+u32 twice(u32 x)
+.0_entry(x):
+    $1 = mul $0, 2
+    ret $1
+*/
+    PRECONDITION(coy_function_builder_init_(&builder, &env, ti_function_uint_uint, 0));
+    struct coy_function_ func_twice;
+    {
+        coy_function_builder_block_(&builder, 1, NULL, 0);
+        {
+            uint32_t mul = coy_function_builder_op_(&builder, COY_OPCODE_MUL, COY_OPFLG_TYPE_UINT32, false);
+                coy_function_builder_arg_reg_(&builder, 0);
+                coy_function_builder_arg_const_val_(&builder, (union coy_register_){.u32=2});
+            coy_function_builder_op_(&builder, COY_OPCODE_RET, 0, false);
+                coy_function_builder_arg_reg_(&builder, mul);
+        }
+        coy_function_builder_finish_(&builder, &func_twice);
+        coy_module_inject_function_(module, "twice", &func_twice);
+    }
+
+    /* ========== sum ========== */
+/*
+u32 sum(u32 num)
+.0_entry(num):
+    jmp .1_test($0, 0, 1, 2)
+.1_test(num,acc,x,y):
+    jmpc lt 0, $0,
+        .2_loop($0,$1,$2,$3),
+        .3_end($1)
+.2_loop(num,acc,x,y):
+    $4 = sub $0, 1
+    $7 = call twice($0)
+    $10 = add $1, $7
+    $13 = add $10, $2
+    jmp .1_test($4, $13, $3, $2)    ; swaps `x` and `y`
+.3_end(acc):
+    ret $0
+*/
+    PRECONDITION(coy_function_builder_init_(&builder, &env, ti_function_uint_uint, 0));
+    struct coy_function_ func_sum;
+    {
+        uint32_t b0_entry = coy_function_builder_block_(&builder, 1, NULL, 0);
+        uint32_t b1_test = coy_function_builder_block_(&builder, 4, NULL, 0);
+        uint32_t b2_loop = coy_function_builder_block_(&builder, 4, NULL, 0);
+        uint32_t b3_end = coy_function_builder_block_(&builder, 1, NULL, 0);
+
+        coy_function_builder_useblock_(&builder, b0_entry);
+        {
+            coy_function_builder_op_(&builder, COY_OPCODE_JMP, 0, false);
+                coy_function_builder_arg_imm_(&builder, b1_test);
+                coy_function_builder_arg_reg_(&builder, 0);
+                coy_function_builder_arg_const_val_(&builder, (union coy_register_){.u32=0});
+                coy_function_builder_arg_const_val_(&builder, (union coy_register_){.u32=1});
+                coy_function_builder_arg_const_val_(&builder, (union coy_register_){.u32=2});
+        }
+        coy_function_builder_useblock_(&builder, b1_test);
+        {
+            coy_function_builder_op_(&builder, COY_OPCODE_JMPC, COY_OPFLG_CMP_LT|COY_OPFLG_TYPE_UINT32, false);
+                coy_function_builder_arg_const_val_(&builder, (union coy_register_){.u32=0});
+                coy_function_builder_arg_reg_(&builder, 0);
+                coy_function_builder_arg_imm_(&builder, b2_loop);
+                coy_function_builder_arg_imm_(&builder, b3_end);
+                coy_function_builder_arg_imm_(&builder, 4);
+                coy_function_builder_arg_reg_(&builder, 0);
+                coy_function_builder_arg_reg_(&builder, 1);
+                coy_function_builder_arg_reg_(&builder, 2);
+                coy_function_builder_arg_reg_(&builder, 3);
+                coy_function_builder_arg_reg_(&builder, 1);
+        }
+        coy_function_builder_useblock_(&builder, b2_loop);
+        {
+            uint32_t sub = coy_function_builder_op_(&builder, COY_OPCODE_SUB, COY_OPFLG_TYPE_UINT32, false);
+                coy_function_builder_arg_reg_(&builder, 0);
+                coy_function_builder_arg_const_val_(&builder, (union coy_register_){.u32=1});
+            uint32_t call = coy_function_builder_op_(&builder, COY_OPCODE_CALL, 0, false);
+                coy_function_builder_arg_const_sym_(&builder, "main;twice");
+                coy_function_builder_arg_reg_(&builder, 0);
+            uint32_t add1 = coy_function_builder_op_(&builder, COY_OPCODE_ADD, COY_OPFLG_TYPE_UINT32, false);
+                coy_function_builder_arg_reg_(&builder, 1);
+                coy_function_builder_arg_reg_(&builder, call);
+            uint32_t add2 = coy_function_builder_op_(&builder, COY_OPCODE_ADD, COY_OPFLG_TYPE_UINT32, false);
+                coy_function_builder_arg_reg_(&builder, add1);
+                coy_function_builder_arg_reg_(&builder, 2);
+            coy_function_builder_op_(&builder, COY_OPCODE_JMP, 0, false);
+                coy_function_builder_arg_imm_(&builder, b1_test);
+                coy_function_builder_arg_reg_(&builder, sub);
+                coy_function_builder_arg_reg_(&builder, add2);
+                coy_function_builder_arg_reg_(&builder, 3);
+                coy_function_builder_arg_reg_(&builder, 2);
+        }
+        coy_function_builder_useblock_(&builder, b3_end);
+        {
+            coy_function_builder_op_(&builder, COY_OPCODE_RET, 0, false);
+                coy_function_builder_arg_reg_(&builder, 0);
+        }
+
+        coy_function_builder_finish_(&builder, &func_sum);
+        coy_module_inject_function_(module, "sum", &func_sum);
+    }
+    PRECONDITION(coy_module_link_(module));
+    PRECONDITION(coy_function_verify_(&func_twice));
+    PRECONDITION(coy_function_verify_(&func_sum));
+
+    /* ========== execute ========== */
+    coy_context_t* ctx = coy_context_create(&env);
+
+    // enough iterations for both functions to get compiled (if the JIT is enabled)
+    for(uint32_t i = 0; i < 2; i++)
+    {
+        coy_ensure_slots(ctx, 1);
+        coy_set_uint(ctx, 0, 300);
+        ASSERT(coy_call(ctx, "main", "sum"));
+        ASSERT_EQ_INT(coy_get_uint(ctx, 0), 300 * 301 + 300 / 2 * 3);
+    }
+#if COY_JIT_
+    ASSERT(func_sum.u.coy.dcode->jit);
+    ASSERT(func_twice.u.coy.dcode->jit);
+#endif
+
+    coy_env_deinit(&env);
+}
+
 static int32_t nat_main_add(coy_context_t* ctx, void* udata)
 {
     // they're made 3 separate statements for debugging reasons (for gdb stepping)
@@ -774,7 +1212,7 @@ static void vm_native_call_prepare(coy_env_t* env, bool use_main, bool use_main_
     if(use_main)
     {
         struct coy_function_builder_ builder;
-        PRECONDITION(coy_function_builder_init_(&builder, ti_function_uint, 0));
+        PRECONDITION(coy_function_builder_init_(&builder, env, ti_function_uint, 0));
 
         coy_function_builder_block_(&builder, 0, NULL, 0);
         {
@@ -796,6 +1234,39 @@ static void vm_native_call_prepare(coy_env_t* env, bool use_main, bool use_main_
     if(use_main)
         PRECONDITION(coy_function_verify_(&f_main_main));
 }
+TEST(vm_call_no_params)
+{
+    coy_env_t env;
+    PRECONDITION(coy_env_init(&env));
+    struct coy_typeinfo_* ti_uint = coy_typeinfo_integer_(&env, 32, false);
+    struct coy_typeinfo_* ti_function_uint = coy_typeinfo_function_(&env, ti_uint, NULL, 0);
+
+/*
+u32 answer()
+.0_entry():
+    ret 42
+*/
+    struct coy_function_builder_ builder;
+    PRECONDITION(coy_function_builder_init_(&builder, &env, ti_function_uint, 0));
+    struct coy_function_ func;
+    coy_function_builder_block_(&builder, 0, NULL, 0);
+    {
+        coy_function_builder_op_(&builder, COY_OPCODE_RET, 0, false);
+            coy_function_builder_arg_const_val_(&builder, (union coy_register_){.u32=42});
+    }
+    coy_function_builder_finish_(&builder, &func);
+    struct coy_module_* module = coy_module_create_(&env, "main", false);
+    coy_module_inject_function_(module, "answer", &func);
+    PRECONDITION(coy_function_verify_(&func));
+
+    // (a fresh context has no slots to pass)
+    coy_context_t* ctx = coy_context_create(&env);
+    ASSERT(coy_call(ctx, "main", "answer"));
+    ASSERT_EQ_INT(coy_get_uint(ctx, 0), 42);
+
+    coy_env_deinit(&env);
+    coy_function_deinit_(&func);
+}
 TEST(vm_native_call)
 {
     coy_env_t env;
@@ -859,7 +1330,7 @@ TEST(vm_vector2_add)
 
     struct coy_function_builder_ builder;
 
-    PRECONDITION(coy_function_builder_init_(&builder, ti_function_int2_int2_int2, 0));
+    PRECONDITION(coy_function_builder_init_(&builder, &env, ti_function_int2_int2_int2, 0));
     struct coy_function_ func_add_int2;
     {
         coy_function_builder_block_(&builder, 2, NULL, 0);
@@ -876,7 +1347,7 @@ TEST(vm_vector2_add)
         coy_module_inject_function_(module, "add_int2", &func_add_int2);
     }
 
-    PRECONDITION(coy_function_builder_init_(&builder, ti_function_uint2_uint2_uint2, 0));
+    PRECONDITION(coy_function_builder_init_(&builder, &env, ti_function_uint2_uint2_uint2, 0));
     struct coy_function_ func_add_uint2;
     {
         coy_function_builder_block_(&builder, 2, NULL, 0);
@@ -926,9 +1397,683 @@ TEST(vm_vector2_add)
     coy_env_deinit(&env);
 }
 
+TEST(vm_stack_segment_reuse)
+{
+    coy_env_t env;
+    PRECONDITION(coy_env_init(&env));
+
+    struct coy_typeinfo_* ti_uint = coy_typeinfo_integer_(&env, 32, false);
+    struct coy_typeinfo_* ti_function_uint_uint_uint = coy_typeinfo_function_(&env, ti_uint, (const struct coy_typeinfo_*[]){ti_uint, ti_uint}, 2);
+
+    struct coy_function_builder_ builder;
+    PRECONDITION(coy_function_builder_init_(&builder, &env, ti_function_uint_uint_uint, 0));
+    struct coy_function_ func;
+    {
+        coy_function_builder_block_(&builder, 2, NULL, 0);
+        {
+            uint32_t add = coy_function_builder_op_(&builder, COY_OPCODE_ADD, COY_OPFLG_TYPE_UINT32, false);
+                coy_function_builder_arg_reg_(&builder, 0);
+                coy_function_builder_arg_reg_(&builder, 1);
+            coy_function_builder_op_(&builder, COY_OPCODE_RET, 0, false);
+                coy_function_builder_arg_reg_(&builder, add);
+        }
+        coy_function_builder_finish_(&builder, &func);
+    }
+    struct coy_module_* module = coy_module_create_(&env, "main", false);
+    coy_module_inject_function_(module, "add", &func);
+
+    coy_context_t* ctx = coy_context_create(&env);
+    ctx->gc.threshold = SIZE_MAX;
+    struct coy_stack_segment_* top = ctx->top;
+
+    // (the first segmented call allocates a segment, which is then retired)
+    coy_ensure_slots(ctx, 2);
+    coy_set_uint(ctx, 0, 1);
+    coy_set_uint(ctx, 1, 2);
+    ASSERT(coy_vm_call_(ctx, &func, true));
+    ASSERT_EQ_UINT(coy_get_uint(ctx, 0), 3);
+    ASSERT_EQ_PTR(ctx->top, top);
+    ASSERT_EQ_UINT(stbds_arrlenu(ctx->spare_segments), 1);
+    size_t nallocated = ctx->gc.nallocated;
+
+    // ... after which segmented calls do not allocate anymore
+    for(uint32_t i = 0; i < 100; i++)
+    {
+        coy_ensure_slots(ctx, 2);
+        coy_set_uint(ctx, 0, i);
+        coy_set_uint(ctx, 1, 2);
+        ASSERT(coy_vm_call_(ctx, &func, true));
+        ASSERT_EQ_UINT(coy_get_uint(ctx, 0), i + 2);
+    }
+    ASSERT_EQ_UINT(ctx->gc.nallocated, nallocated);
+    ASSERT_EQ_PTR(ctx->top, top);
+
+    // spare segments survive collections
+    coy_gc_collect_(&ctx->gc);
+    ASSERT_EQ_UINT(stbds_arrlenu(ctx->spare_segments), 1);
+    coy_ensure_slots(ctx, 2);
+    ASSERT(coy_vm_call_(ctx, &func, true));
+
+    coy_env_deinit(&env);
+}
+
+struct gc_test_node
+{
+    struct gc_test_node* next;
+};
+static uint32_t gc_test_ndtors;
+static void gc_test_node_mark(struct coy_gc_* gc, void* ptr)
+{
+    struct gc_test_node* node = ptr;
+    coy_gc_mark_(gc, node->next);
+}
+static void gc_test_node_dtor(struct coy_gc_* gc, void* ptr)
+{
+    ++gc_test_ndtors;
+}
+static const struct coy_typeinfo_ gc_test_ti_node = {
+    .category = COY_TYPEINFO_CAT_INTERNAL_,
+    .u={.internal_name = "gc_test_node"},
+    .cb_mark = gc_test_node_mark,
+    .cb_dtor = gc_test_node_dtor,
+};
+static struct gc_test_node* gc_test_node_new(coy_context_t* ctx, struct gc_test_node* next)
+{
+    struct gc_test_node* node = coy_gc_malloc_(&ctx->gc, sizeof(struct gc_test_node), &gc_test_ti_node);
+    node->next = next;
+    return node;
+}
+TEST(vm_gc_collect)
+{
+    coy_env_t env;
+    PRECONDITION(coy_env_init(&env));
+
+    coy_context_t* ctx = coy_context_create(&env);
+    ctx->gc.threshold = SIZE_MAX;
+    gc_test_ndtors = 0;
+
+    // a -> b is reachable from a slot, c is garbage
+    struct gc_test_node* b = gc_test_node_new(ctx, NULL);
+    struct gc_test_node* a = gc_test_node_new(ctx, b);
+    gc_test_node_new(ctx, NULL);
+    coy_ensure_slots(ctx, 1);
+    coy_slots_setptr_(&ctx->slots, 0, a);
+
+    coy_gc_collect_(&ctx->gc);
+    ASSERT_EQ_UINT(gc_test_ndtors, 1);
+    ASSERT_EQ_PTR(a->next, b);
+    // (nothing changed, so nothing else should be collected)
+    coy_gc_collect_(&ctx->gc);
+    ASSERT_EQ_UINT(gc_test_ndtors, 1);
+
+    // explicit roots keep objects alive, too
+    coy_gc_add_root_(&ctx->gc, b);
+    coy_set_uint(ctx, 0, 0);
+    coy_gc_collect_(&ctx->gc);
+    ASSERT_EQ_UINT(gc_test_ndtors, 2);
+    coy_gc_remove_root_(&ctx->gc, b);
+    coy_gc_collect_(&ctx->gc);
+    ASSERT_EQ_UINT(gc_test_ndtors, 3);
+
+    // allocations alone should trigger collections
+    ctx->gc.threshold = 1;
+    for(uint32_t i = 0; i < 10; i++)
+        gc_test_node_new(ctx, NULL);
+    ASSERT_EQ_UINT(gc_test_ndtors, 3 + 9);
+
+    coy_env_deinit(&env);
+    ASSERT_EQ_UINT(gc_test_ndtors, 3 + 10);
+}
+
+TEST(vm_gc_pool)
+{
+    coy_env_t env;
+    PRECONDITION(coy_env_init(&env));
+
+    coy_context_t* ctx = coy_context_create(&env);
+    ctx->gc.threshold = SIZE_MAX;
+    gc_test_ndtors = 0;
+
+    // small objects are packed into pages
+    struct gc_test_node* a = gc_test_node_new(ctx, NULL);
+    struct gc_test_node* b = gc_test_node_new(ctx, NULL);
+    ASSERT((char*)b - (char*)a == 32 || (char*)a - (char*)b == 32);
+    // large ones are not
+    void* large = coy_gc_malloc_(&ctx->gc, 2 * COY_GC_PAGE_SIZE_, &gc_test_ti_node);
+    ASSERT(large);
+    memset(large, 0, 2 * COY_GC_PAGE_SIZE_);
+
+    // (this keeps the page from being released once it is otherwise empty)
+    struct gc_test_node* keep = gc_test_node_new(ctx, NULL);
+    coy_gc_add_root_(&ctx->gc, keep);
+
+    coy_gc_collect_(&ctx->gc);
+    ASSERT_EQ_UINT(gc_test_ndtors, 3);
+    // freed cells are reused
+    struct gc_test_node* c = gc_test_node_new(ctx, NULL);
+    ASSERT(c == a || c == b);
+
+    // enough objects to need more than one page
+    coy_ensure_slots(ctx, 1);
+    struct gc_test_node* list = NULL;
+    for(uint32_t i = 0; i < 3 * COY_GC_PAGE_SIZE_ / 32; i++)
+    {
+        list = gc_test_node_new(ctx, list);
+        coy_slots_setptr_(&ctx->slots, 0, list);
+    }
+    coy_gc_collect_(&ctx->gc);
+    ASSERT_EQ_UINT(gc_test_ndtors, 4);
+
+    // a chain that is long enough to overflow the C stack if marking were recursive
+    for(uint32_t i = 0; i < 1000000; i++)
+    {
+        list = gc_test_node_new(ctx, list);
+        coy_slots_setptr_(&ctx->slots, 0, list);
+    }
+    coy_gc_collect_(&ctx->gc);
+    ASSERT_EQ_UINT(gc_test_ndtors, 4);
+
+    coy_env_deinit(&env);
+}
+
+TEST(vm_gc_generational)
+{
+    coy_env_t env;
+    PRECONDITION(coy_env_init(&env));
+
+    coy_context_t* ctx = coy_context_create(&env);
+    ctx->gc.threshold = SIZE_MAX;
+    gc_test_ndtors = 0;
+
+    // `old` survives a collection (and gets promoted), the other node is garbage
+    struct gc_test_node* old = gc_test_node_new(ctx, NULL);
+    coy_gc_add_root_(&ctx->gc, old);
+    gc_test_node_new(ctx, NULL);
+    coy_gc_collect_minor_(&ctx->gc);
+    ASSERT_EQ_UINT(gc_test_ndtors, 1);
+
+    // young objects that are only referenced by old ones are kept alive by the write barrier
+    struct gc_test_node* young = gc_test_node_new(ctx, NULL);
+    old->next = young;
+    coy_gc_write_barrier_(&ctx->gc, old);
+    gc_test_node_new(ctx, NULL);
+    coy_gc_collect_minor_(&ctx->gc);
+    ASSERT_EQ_UINT(gc_test_ndtors, 2);
+    ASSERT_EQ_PTR(old->next, young);
+
+    // old garbage is only collected by a full collection
+    old->next = NULL;
+    coy_gc_collect_minor_(&ctx->gc);
+    ASSERT_EQ_UINT(gc_test_ndtors, 2);
+    coy_gc_collect_(&ctx->gc);
+    ASSERT_EQ_UINT(gc_test_ndtors, 3);
+
+    coy_env_deinit(&env);
+    ASSERT_EQ_UINT(gc_test_ndtors, 4);
+}
+
+TEST(vm_gc_incremental)
+{
+    coy_env_t env;
+    PRECONDITION(coy_env_init(&env));
+
+    coy_context_t* ctx = coy_context_create(&env);
+    ctx->gc.threshold = SIZE_MAX;
+    gc_test_ndtors = 0;
+
+    // a long chain (so that marking takes more than one step), ending in `w`; and a separate root `b`
+    struct gc_test_node* w = gc_test_node_new(ctx, NULL);
+    struct gc_test_node* tail = gc_test_node_new(ctx, w);
+    struct gc_test_node* list = tail;
+    for(uint32_t i = 0; i < 10000; i++)
+        list = gc_test_node_new(ctx, list);
+    coy_gc_add_root_(&ctx->gc, list);
+    struct gc_test_node* b = gc_test_node_new(ctx, NULL);
+    coy_gc_add_root_(&ctx->gc, b);
+    gc_test_node_new(ctx, NULL);
+
+    // (with no budget, each step only scans a single batch)
+    ASSERT(coy_gc_step_(&ctx->gc, 0));
+    // `b` has been scanned already, so moving `w` there needs the write barrier to keep it alive
+    b->next = w;
+    coy_gc_write_barrier_(&ctx->gc, b);
+    tail->next = NULL;
+    // objects allocated in the meantime survive the collection
+    struct gc_test_node* young = gc_test_node_new(ctx, NULL);
+    coy_gc_add_root_(&ctx->gc, young);
+
+    uint32_t nsteps = 1;
+    while(coy_gc_step_(&ctx->gc, 0))
+        ++nsteps;
+    ASSERT(nsteps > 1);
+    ASSERT_EQ_UINT(gc_test_ndtors, 1);
+    ASSERT_EQ_PTR(b->next, w);
+
+    // nothing was allocated since, so there is nothing to do
+    ASSERT(!coy_gc_step_(&ctx->gc, 0));
+    coy_gc_collect_(&ctx->gc);
+    ASSERT_EQ_UINT(gc_test_ndtors, 1);
+
+    // a collection that is triggered while marking completes the incremental one
+    coy_gc_remove_root_(&ctx->gc, young);
+    gc_test_node_new(ctx, NULL);
+    ASSERT(coy_gc_step_(&ctx->gc, 0));
+    coy_gc_collect_minor_(&ctx->gc);
+    ASSERT_EQ_UINT(gc_test_ndtors, 3);
+    ASSERT(!ctx->gc.marking);
+
+    // allocating while marking opens new pages; none of their cells may be handed out twice once the collection is done
+    struct gc_test_node* chain = NULL;
+    for(uint32_t i = 0; i < 10000; i++)
+        chain = gc_test_node_new(ctx, chain);
+    coy_gc_add_root_(&ctx->gc, chain);
+    ASSERT(coy_gc_step_(&ctx->gc, 0));
+    struct gc_test_node* fresh = NULL;
+    for(uint32_t i = 0; i < 5000; i++)
+        fresh = gc_test_node_new(ctx, fresh);
+    coy_gc_add_root_(&ctx->gc, fresh);
+    while(coy_gc_step_(&ctx->gc, 0)) {}
+    struct gc_test_node* after = NULL;
+    for(uint32_t i = 0; i < 6000; i++)
+        after = gc_test_node_new(ctx, after);
+    coy_gc_add_root_(&ctx->gc, after);
+
+    struct { struct gc_test_node* key; bool value; }* seen = NULL;
+    struct gc_test_node* lists[] = {chain, fresh, after};
+    size_t nnodes = 0;
+    for(size_t l = 0; l < sizeof(lists) / sizeof(*lists); l++)
+        for(struct gc_test_node* node = lists[l]; node; node = node->next, nnodes++)
+            stbds_hmput(seen, node, true);
+    ASSERT_EQ_UINT(nnodes, 10000 + 5000 + 6000);
+    ASSERT_EQ_UINT(stbds_hmlenu(seen), nnodes);
+    stbds_hmfree(seen);
+
+    // the sweep is spread across steps as well
+    for(size_t l = 0; l < sizeof(lists) / sizeof(*lists); l++)
+        coy_gc_remove_root_(&ctx->gc, lists[l]);
+    gc_test_ndtors = 0;
+    uint32_t nsweeps = 0;
+    while(coy_gc_step_(&ctx->gc, 0))
+        nsweeps += ctx->gc.sweeping;
+    ASSERT(nsweeps > 1);
+    ASSERT_EQ_UINT(gc_test_ndtors, nnodes);
+    ASSERT(!ctx->gc.sweeping);
+
+    coy_env_deinit(&env);
+}
+
+TEST(vm_gc_parallel)
+{
+    coy_env_t env;
+    PRECONDITION(coy_env_init(&env));
+
+    coy_context_t* ctx = coy_context_create(&env);
+    ctx->gc.threshold = SIZE_MAX;
+    ctx->gc.nmarkers = 4;
+    gc_test_ndtors = 0;
+
+    // several chains (so that there is work to share), with garbage in between
+    struct gc_test_node* chains[16] = {NULL};
+    for(uint32_t i = 0; i < 5000; i++)
+        for(uint32_t c = 0; c < 16; c++)
+        {
+            chains[c] = gc_test_node_new(ctx, chains[c]);
+            gc_test_node_new(ctx, chains[c]);
+        }
+    for(uint32_t c = 0; c < 16; c++)
+        coy_gc_add_root_(&ctx->gc, chains[c]);
+
+    coy_gc_collect_(&ctx->gc);
+    ASSERT_EQ_UINT(gc_test_ndtors, 16 * 5000);
+    // (everything that is left is reachable)
+    ctx->gc.nmarkers = 1;
+    coy_gc_collect_(&ctx->gc);
+    ASSERT_EQ_UINT(gc_test_ndtors, 16 * 5000);
+
+    coy_env_deinit(&env);
+    ASSERT_EQ_UINT(gc_test_ndtors, 2 * 16 * 5000);
+}
+
+TEST(vm_gc_stats)
+{
+    coy_env_t env;
+    PRECONDITION(coy_env_init(&env));
+
+    coy_context_t* ctx = coy_context_create(&env);
+    ctx->gc.threshold = SIZE_MAX;
+    struct coy_gc_stats stats;
+    ASSERT(coy_gc_stats(ctx, &stats));
+    size_t nbase = stats.nbytes_live;
+    uint64_t nallocated = stats.nbytes_allocated;
+    coy_gc_stats_free(&stats);
+
+    // 10 nodes are kept alive, 90 are garbage
+    coy_ensure_slots(ctx, 1);
+    struct gc_test_node* list = NULL;
+    for(uint32_t i = 0; i < 100; i++)
+    {
+        struct gc_test_node* node = gc_test_node_new(ctx, i % 10 ? NULL : list);
+        if(!(i % 10)) list = node;
+    }
+    coy_slots_setptr_(&ctx->slots, 0, list);
+
+    ASSERT(coy_gc_stats(ctx, &stats));
+    ASSERT_EQ_UINT(stats.nbytes_allocated - nallocated, 100 * 32);
+    ASSERT_EQ_UINT(stats.nbytes_live - nbase, 100 * 32);
+    ASSERT_EQ_UINT(stats.nbytes_peak, stats.nbytes_live);
+    ASSERT_EQ_UINT(stats.ncollections_minor + stats.ncollections_major, 0);
+    ASSERT(stats.ntypes >= 1);
+    ASSERT_EQ_STR(stats.types[0].repr, "gc_test_node");
+    ASSERT_EQ_UINT(stats.types[0].nobjects, 100);
+    ASSERT_EQ_UINT(stats.types[0].nbytes, 100 * 32);
+    coy_gc_stats_free(&stats);
+
+    coy_gc_collect_minor_(&ctx->gc);
+    coy_gc_collect_(&ctx->gc);
+    ASSERT(coy_gc_stats(ctx, &stats));
+    ASSERT_EQ_UINT(stats.nbytes_live - nbase, 10 * 32);
+    ASSERT_EQ_UINT(stats.nbytes_peak - nbase, 100 * 32);
+    ASSERT_EQ_UINT(stats.ncollections_minor, 1);
+    ASSERT_EQ_UINT(stats.ncollections_major, 1);
+    ASSERT(stats.nbytes_heap >= stats.nbytes_live);
+    size_t nlive = 0;
+    for(size_t t = 0; t < stats.ntypes; t++)
+    {
+        nlive += stats.types[t].nbytes;
+        if(!strcmp(stats.types[t].repr, "gc_test_node"))
+            ASSERT_EQ_UINT(stats.types[t].nobjects, 10);
+    }
+    ASSERT_EQ_UINT(nlive, stats.nbytes_live);
+    coy_gc_stats_free(&stats);
+
+    coy_env_deinit(&env);
+}
+
+TEST(vm_gc_stack_map)
+{
+    coy_env_t env;
+    PRECONDITION(coy_env_init(&env));
+
+    struct coy_typeinfo_* ti_uint = coy_typeinfo_integer_(&env, 32, false);
+    struct coy_typeinfo_* ti_function_uint_uint_uint = coy_typeinfo_function_(&env, ti_uint, (const struct coy_typeinfo_*[]){ti_uint, ti_uint}, 2);
+
+    // only $0 is a pointer
+    struct coy_function_builder_ builder;
+    PRECONDITION(coy_function_builder_init_(&builder, &env, ti_function_uint_uint_uint, 0));
+    struct coy_function_ func;
+    {
+        coy_function_builder_block_(&builder, 2, (const uint32_t[]){0}, 1);
+        {
+            coy_function_builder_op_(&builder, COY_OPCODE_RET, 0, false);
+                coy_function_builder_arg_reg_(&builder, 1);
+        }
+        coy_function_builder_finish_(&builder, &func);
+    }
+    struct coy_module_* module = coy_module_create_(&env, "main", false);
+    coy_module_inject_function_(module, "f", &func);
+
+    coy_context_t* ctx = coy_context_create(&env);
+    ctx->gc.threshold = SIZE_MAX;
+    gc_test_ndtors = 0;
+
+    coy_context_push_frame_(ctx, &func, true, false);
+    struct coy_stack_segment_* seg = ctx->top;
+    PRECONDITION(coy_regs_getlen_(&seg->regs) >= 3);
+    struct gc_test_node* a = gc_test_node_new(ctx, NULL);
+    struct gc_test_node* b = gc_test_node_new(ctx, NULL);
+    struct gc_test_node* c = gc_test_node_new(ctx, NULL);
+    // $1 is not a pointer (even if its contents look like one), and $2 has not been written yet
+    seg->regs.data[0].ptr = a;
+    seg->regs.data[1].ptr = b;
+    seg->regs.data[2].ptr = c;
+
+    coy_gc_collect_(&ctx->gc);
+    ASSERT_EQ_UINT(gc_test_ndtors, 2);
+    ASSERT_EQ_PTR(a->next, NULL);
+
+    coy_context_pop_frame_(ctx);
+    coy_gc_collect_(&ctx->gc);
+    ASSERT_EQ_UINT(gc_test_ndtors, 3);
+
+    coy_env_deinit(&env);
+}
+
+// builds a module "image" with `add(a, b)` and `twice(x) = add(x, x)` (`twice` calls `add` through a symbol)
+static struct coy_module_* image_test_module(coy_env_t* env, struct coy_function_* func_add, struct coy_function_* func_twice)
+{
+    struct coy_typeinfo_* ti_uint = coy_typeinfo_integer_(env, 32, false);
+    struct coy_typeinfo_* ti_function_uint_uint = coy_typeinfo_function_(env, ti_uint, (const struct coy_typeinfo_*[]){ti_uint}, 1);
+    struct coy_typeinfo_* ti_function_uint_uint_uint = coy_typeinfo_function_(env, ti_uint, (const struct coy_typeinfo_*[]){ti_uint, ti_uint}, 2);
+    struct coy_module_* module = coy_module_create_(env, "image", false);
+
+    struct coy_function_builder_ builder;
+    coy_function_builder_init_(&builder, env, ti_function_uint_uint_uint, 0);
+    coy_function_builder_block_(&builder, 2, NULL, 0);
+    {
+        uint32_t add = coy_function_builder_op_(&builder, COY_OPCODE_ADD, COY_OPFLG_TYPE_UINT32, false);
+            coy_function_builder_arg_reg_(&builder, 0);
+            coy_function_builder_arg_reg_(&builder, 1);
+        coy_function_builder_op_(&builder, COY_OPCODE_RET, 0, false);
+            coy_function_builder_arg_reg_(&builder, add);
+    }
+    coy_function_builder_finish_(&builder, func_add);
+    coy_module_inject_function_(module, "add", func_add);
+
+    coy_function_builder_init_(&builder, env, ti_function_uint_uint, 0);
+    coy_function_builder_block_(&builder, 1, NULL, 0);
+    {
+        uint32_t call = coy_function_builder_op_(&builder, COY_OPCODE_CALL, 0, false);
+            coy_function_builder_arg_const_sym_(&builder, "image;add");
+            coy_function_builder_arg_reg_(&builder, 0);
+            coy_function_builder_arg_reg_(&builder, 0);
+        coy_function_builder_op_(&builder, COY_OPCODE_RET, 0, false);
+            coy_function_builder_arg_reg_(&builder, call);
+    }
+    coy_function_builder_finish_(&builder, func_twice);
+    coy_module_inject_function_(module, "twice", func_twice);
+    return module;
+}
+TEST(vm_module_image)
+{
+    static const char path[] = "test_module_image.tmp";
+    uint8_t* image = NULL;
+    {
+        coy_env_t env;
+        PRECONDITION(coy_env_init(&env));
+        struct coy_function_ func_add, func_twice;
+        struct coy_module_* module = image_test_module(&env, &func_add, &func_twice);
+        ASSERT(coy_module_write_image_(module, &image));
+        ASSERT(coy_module_save_image_(module, path));
+        coy_env_deinit(&env);
+    }
+
+    coy_env_t env;
+    PRECONDITION(coy_env_init(&env));
+    struct coy_module_* module = coy_env_load_image_data_(&env, image, stbds_arrlenu(image));
+    ASSERT(module);
+    ASSERT_EQ_STR(module->name->str, "image");
+    ASSERT(coy_module_find_symbol_(module, "add"));
+    ASSERT(coy_module_find_symbol_(module, "twice"));
+    // (a module can only be loaded once)
+    ASSERT(!coy_env_load_image_data_(&env, image, stbds_arrlenu(image)));
+
+    coy_context_t* ctx = coy_context_create(&env);
+    coy_ensure_slots(ctx, 1);
+    coy_set_uint(ctx, 0, 21);
+    ASSERT(coy_call(ctx, "image", "twice"));
+    ASSERT_EQ_UINT(coy_get_uint(ctx, 0), 42);
+    coy_env_deinit(&env);
+
+    // bad images are rejected
+    PRECONDITION(coy_env_init(&env));
+    ASSERT(!coy_env_load_image_data_(&env, image, stbds_arrlenu(image) / 2));
+    image[8] ^= 0xFF;   //< version
+    ASSERT(!coy_env_load_image_data_(&env, image, stbds_arrlenu(image)));
+    ASSERT(!coy_env_find_module_(&env, "image"));
+
+    // ... and files get mapped
+    module = coy_env_load_image(&env, path);
+    ASSERT(module);
+    ctx = coy_context_create(&env);
+    coy_ensure_slots(ctx, 2);
+    coy_set_uint(ctx, 0, 2);
+    coy_set_uint(ctx, 1, 3);
+    ASSERT(coy_call(ctx, "image", "add"));
+    ASSERT_EQ_UINT(coy_get_uint(ctx, 0), 5);
+    // (with the code used in place, including the symbol slot that linking patched)
+    struct coy_image_* loaded = env.images[stbds_arrlenu(env.images) - 1];
+    ASSERT(loaded->mapping);
+    for(size_t f = 0; f < loaded->nfunctions; f++)
+    {
+        const struct coy_function_* func = &loaded->functions[f];
+        if(!func->u.coy.is_mapped)
+            continue;   //< (big-endian hosts copy)
+        ASSERT((const uint8_t*)func->u.coy.instrs >= (const uint8_t*)loaded->mapping);
+        ASSERT((const uint8_t*)(func->u.coy.instrs + func->u.coy.ninstrs) <= (const uint8_t*)loaded->mapping + loaded->mapping_len);
+    }
+    coy_set_uint(ctx, 0, 21);
+    ASSERT(coy_call(ctx, "image", "twice"));
+    ASSERT_EQ_UINT(coy_get_uint(ctx, 0), 42);
+    coy_env_deinit(&env);
+
+    remove(path);
+    stbds_arrfree(image);
+}
+
+TEST(vm_lazy_link)
+{
+    coy_env_t env;
+    PRECONDITION(coy_env_init(&env));
+    env.link_lazily = true;
+    struct coy_function_ func_add, func_twice;
+    struct coy_module_* module = image_test_module(&env, &func_add, &func_twice);
+    ASSERT(coy_module_link_(module));
+    ASSERT(coy_function_verify_(&func_add));
+    ASSERT(coy_function_verify_(&func_twice));
+
+    // nothing was looked up yet: the symbol constant holds a stub ...
+    struct coy_function_* stub = func_twice.u.coy.consts.data[0].ptr;
+    ASSERT(stub->attrib & COY_FUNCTION_ATTRIB_STUB_);
+    ASSERT_EQ_STR(stub->u.stub.symbol->str, "image;add");
+    ASSERT(!stub->u.stub.target);
+
+    // ... until the first call goes through it, which patches the constant
+    coy_context_t* ctx = coy_context_create(&env);
+    coy_ensure_slots(ctx, 1);
+    coy_set_uint(ctx, 0, 21);
+    ASSERT(coy_call(ctx, "image", "twice"));
+    ASSERT_EQ_UINT(coy_get_uint(ctx, 0), 42);
+    ASSERT_EQ_PTR(func_twice.u.coy.consts.data[0].ptr, &func_add);
+    ASSERT_EQ_PTR(stub->u.stub.target, &func_add);
+    coy_set_uint(ctx, 0, 5);
+    ASSERT(coy_call(ctx, "image", "twice"));
+    ASSERT_EQ_UINT(coy_get_uint(ctx, 0), 10);
+
+    // native code can get hold of the stub as a value, and call it directly
+    coy_ensure_slots(ctx, 2);
+    coy_set_uint(ctx, 0, 2);
+    coy_set_uint(ctx, 1, 3);
+    ASSERT(coy_vm_call_(ctx, stub, false));
+    ASSERT_EQ_UINT(coy_get_uint(ctx, 0), 5);
+
+    coy_env_deinit(&env);
+    coy_function_deinit_(&func_add);
+    coy_function_deinit_(&func_twice);
+}
+TEST(function_verify_call_result)
+{
+    coy_env_t env;
+    PRECONDITION(coy_env_init(&env));
+    struct coy_function_ func_add, func_twice, func_bad;
+    struct coy_module_* module = image_test_module(&env, &func_add, &func_twice);
+
+    // `add` returns a value, so its result must not go into a pointer register (which the GC would take for a root)
+    struct coy_typeinfo_* ti_uint = coy_typeinfo_integer_(&env, 32, false);
+    struct coy_typeinfo_* ti_function_uint_uint = coy_typeinfo_function_(&env, ti_uint, (const struct coy_typeinfo_*[]){ti_uint}, 1);
+    struct coy_function_builder_ builder;
+    coy_function_builder_init_(&builder, &env, ti_function_uint_uint, 0);
+    coy_function_builder_block_(&builder, 1, NULL, 0);
+    {
+        coy_function_builder_op_(&builder, COY_OPCODE_CALL, 0, true);
+            coy_function_builder_arg_const_sym_(&builder, "image;add");
+            coy_function_builder_arg_reg_(&builder, 0);
+            coy_function_builder_arg_reg_(&builder, 0);
+        coy_function_builder_op_(&builder, COY_OPCODE_RET, 0, false);
+            coy_function_builder_arg_reg_(&builder, 0);
+    }
+    coy_function_builder_finish_(&builder, &func_bad);
+    coy_module_inject_function_(module, "bad", &func_bad);
+    ASSERT(coy_module_link_(module));
+    ASSERT(coy_function_verify_(&func_twice));
+    ASSERT(!coy_function_verify_(&func_bad));
+
+    coy_env_deinit(&env);
+    coy_function_deinit_(&func_add);
+    coy_function_deinit_(&func_twice);
+    coy_function_deinit_(&func_bad);
+}
+TEST(function_verify_params)
+{
+    coy_env_t env;
+    PRECONDITION(coy_env_init(&env));
+    struct coy_typeinfo_* ti_uint = coy_typeinfo_integer_(&env, 32, false);
+    struct coy_typeinfo_* ti_function_uint_uint_uint = coy_typeinfo_function_(&env, ti_uint, (const struct coy_typeinfo_*[]){ti_uint, ti_uint}, 2);
+    struct coy_function_builder_ builder;
+    struct coy_function_ func_ret, func_add, func_jmp;
+    const uint32_t ptrs[] = {0};
+
+    // `uint f(uint a, uint b) { return b; }` (operands are registers, which already count the block parameters)
+    coy_function_builder_init_(&builder, &env, ti_function_uint_uint_uint, 0);
+    coy_function_builder_block_(&builder, 2, NULL, 0);
+    {
+        coy_function_builder_op_(&builder, COY_OPCODE_RET, 0, false);
+            coy_function_builder_arg_reg_(&builder, 1);
+    }
+    coy_function_builder_finish_(&builder, &func_ret);
+    ASSERT(coy_function_verify_(&func_ret));
+
+    // a reference parameter cannot be an arithmetic operand ...
+    coy_function_builder_init_(&builder, &env, ti_function_uint_uint_uint, 0);
+    coy_function_builder_block_(&builder, 2, ptrs, 1);
+    {
+        coy_function_builder_op_(&builder, COY_OPCODE_ADD, COY_OPFLG_TYPE_UINT32, false);
+            coy_function_builder_arg_reg_(&builder, 0);
+            coy_function_builder_arg_reg_(&builder, 1);
+        coy_function_builder_op_(&builder, COY_OPCODE_RET, 0, false);
+            coy_function_builder_arg_reg_(&builder, 2);
+    }
+    coy_function_builder_finish_(&builder, &func_add);
+    ASSERT(!coy_function_verify_(&func_add));
+
+    // ... nor be passed to a value parameter of another block
+    coy_function_builder_init_(&builder, &env, ti_function_uint_uint_uint, 0);
+    uint32_t b0_entry = coy_function_builder_block_(&builder, 2, ptrs, 1);
+    uint32_t b1_end = coy_function_builder_block_(&builder, 1, NULL, 0);
+    coy_function_builder_useblock_(&builder, b0_entry);
+    {
+        coy_function_builder_op_(&builder, COY_OPCODE_JMP, 0, false);
+            coy_function_builder_arg_imm_(&builder, b1_end);
+            coy_function_builder_arg_reg_(&builder, 0);
+    }
+    coy_function_builder_useblock_(&builder, b1_end);
+    {
+        coy_function_builder_op_(&builder, COY_OPCODE_RET, 0, false);
+            coy_function_builder_arg_reg_(&builder, 0);
+    }
+    coy_function_builder_finish_(&builder, &func_jmp);
+    ASSERT(!coy_function_verify_(&func_jmp));
+
+    coy_env_deinit(&env);
+    coy_function_deinit_(&func_ret);
+    coy_function_deinit_(&func_add);
+    coy_function_deinit_(&func_jmp);
+}
+
 int main()
 {
     TEST_EXEC(stb_ds);
+    TEST_EXEC(memio_bulk);
+    TEST_EXEC(strpool);
     TEST_EXEC(lexer);
     TEST_EXEC(parser);
     TEST_EXEC(semantic_analysis);
@@ -938,13 +2083,30 @@ int main()
     TEST_EXEC(typeinfo_function);
     TEST_EXEC(typeinfo_intern_dedup);
     TEST_EXEC(vm_basic);
+    TEST_EXEC(vm_trace);
     TEST_EXEC(function_builder_verify);
     TEST_EXEC(vm_factorial);
     TEST_EXEC(vm_factorial_call);
+    TEST_EXEC(vm_block_args_cycle);
+    TEST_EXEC(vm_retcall_cycle);
+    TEST_EXEC(vm_jit_loop);
+    TEST_EXEC(vm_call_no_params);
     TEST_EXEC(vm_native_call);
     TEST_EXEC(vm_native_retcall);
     TEST_EXEC(vm_native_call_direct);
     TEST_EXEC(vm_vector2_add);
+    TEST_EXEC(vm_stack_segment_reuse);
+    TEST_EXEC(vm_gc_collect);
+    TEST_EXEC(vm_gc_pool);
+    TEST_EXEC(vm_gc_generational);
+    TEST_EXEC(vm_gc_incremental);
+    TEST_EXEC(vm_gc_parallel);
+    TEST_EXEC(vm_gc_stack_map);
+    TEST_EXEC(vm_gc_stats);
+    TEST_EXEC(vm_module_image);
+    TEST_EXEC(vm_lazy_link);
+    TEST_EXEC(function_verify_call_result);
+    TEST_EXEC(function_verify_params);
     TEST_EXEC(codegen);
     TEST_EXEC(compiler);
     return TEST_REPORT();